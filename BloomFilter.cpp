@@ -0,0 +1,223 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "BloomFilter.hpp"
+
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/endian/conversion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+
+namespace {
+
+/* Saved filters are a header followed by the bits, all little endian
+ *
+ * offset  size  field
+ *      0     8  magic
+ *      8     8  capacity
+ *     16     8  number of bits
+ *     24     4  number of hashes
+ *     28     8  number of insertions
+ *     36     8  queue items when saved
+ *     44     4  length of the queue identity
+ *     48        the queue identity, then the bits as 64 bit words
+ *
+ * Filters of the first format had no identity and the magic "RSCBLOOM"
+ */
+const char            filter_magic[8]     = { 'R', 'S', 'C', 'B', 'L', 'M', '0', '2' };
+const std::size_t     filter_header_size  = 48;
+const std::size_t     max_queue_id_size   = 256;
+const boost::uint64_t max_filter_bits     = boost::uint64_t(1) << 40;    // 128GB, way beyond any queue
+
+template <typename T>
+void put(char *n_dst, const T n_value) {
+
+	const T value = boost::endian::native_to_little(n_value);
+	std::memcpy(n_dst, &value, sizeof(value));
+}
+
+template <typename T>
+T get(const char *n_src) {
+
+	T value;
+	std::memcpy(&value, n_src, sizeof(value));
+	return boost::endian::little_to_native(value);
+}
+
+boost::uint64_t load_u64(const boost::uint8_t *n_src) {
+
+	boost::uint64_t value;
+	std::memcpy(&value, n_src, sizeof(value));
+	return value;
+}
+
+} // anon namespace
+
+BloomFilter::BloomFilter(const boost::uint64_t n_capacity, const double n_false_positive_rate)
+        : m_capacity{ std::max<boost::uint64_t>(n_capacity, 1) }
+        , m_count{ 0 }
+        , m_queue_items{ 0 } {
+
+	MOOSE_ASSERT((n_false_positive_rate > 0.0) && (n_false_positive_rate < 1.0))
+
+	// The textbook optimum: m = -n ln p / (ln 2)^2 bits and k = m / n ln 2 hashes
+	const double ln2 = std::log(2.0);
+	const double bits = -static_cast<double>(m_capacity) * std::log(n_false_positive_rate) / (ln2 * ln2);
+
+	m_words.resize(static_cast<std::size_t>(std::ceil(bits / 64)));
+	m_bits = m_words.size() * 64;
+	m_hashes = std::max<boost::uint32_t>(1, static_cast<boost::uint32_t>(std::round(bits / m_capacity * ln2)));
+}
+
+BloomFilter::BloomFilter(const boost::filesystem::path &n_file) {
+
+	boost::filesystem::ifstream file(n_file, std::ios::in | std::ios::binary);
+
+	char header[filter_header_size];
+	if (!file.read(header, sizeof(header)) || (std::memcmp(header, filter_magic, sizeof(filter_magic)) != 0)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Not a candidate filter file")
+		            << error_argument(n_file.string()));
+	}
+
+	m_capacity    = get<boost::uint64_t>(header + 8);
+	m_bits        = get<boost::uint64_t>(header + 16);
+	m_hashes      = get<boost::uint32_t>(header + 24);
+	m_count       = get<boost::uint64_t>(header + 28);
+	m_queue_items = get<boost::uint64_t>(header + 36);
+	const boost::uint32_t id_size = get<boost::uint32_t>(header + 44);
+
+	if ((m_bits == 0) || (m_bits % 64) || (m_bits > max_filter_bits) || (m_hashes == 0) || (m_hashes > 64)
+	        || (id_size > max_queue_id_size)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Corrupt candidate filter file")
+		            << error_argument(n_file.string()));
+	}
+
+	// Only allocate the bits when the file actually has them
+	boost::system::error_code ec;
+	const boost::uintmax_t file_size = boost::filesystem::file_size(n_file, ec);
+	if (ec || (file_size != filter_header_size + id_size + m_bits / 8)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Candidate filter file size does not match its header")
+		            << error_argument(n_file.string()));
+	}
+
+	m_queue_id.resize(id_size);
+	if (!file.read(&m_queue_id[0], id_size)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Truncated candidate filter file")
+		            << error_argument(n_file.string()));
+	}
+
+	m_words.resize(m_bits / 64);
+	if (!file.read(reinterpret_cast<char *>(m_words.data()), m_words.size() * sizeof(boost::uint64_t))) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Truncated candidate filter file")
+		            << error_argument(n_file.string()));
+	}
+
+	for (boost::uint64_t &word : m_words) {
+		boost::endian::little_to_native_inplace(word);
+	}
+}
+
+void BloomFilter::save(const boost::filesystem::path &n_file, const boost::uint64_t n_queue_items,
+                       const std::string &n_queue_id) const {
+
+	if (n_queue_id.size() > max_queue_id_size) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Queue identity too long for candidate filter")
+		            << error_argument(n_queue_id));
+	}
+
+	char header[filter_header_size];
+	std::memcpy(header, filter_magic, sizeof(filter_magic));
+	put<boost::uint64_t>(header + 8, m_capacity);
+	put<boost::uint64_t>(header + 16, m_bits);
+	put<boost::uint32_t>(header + 24, m_hashes);
+	put<boost::uint64_t>(header + 28, m_count);
+	put<boost::uint64_t>(header + 36, n_queue_items);
+	put<boost::uint32_t>(header + 44, static_cast<boost::uint32_t>(n_queue_id.size()));
+
+	// Write next to it first, so we never leave half a filter behind
+	const boost::filesystem::path temp = n_file.string() + ".tmp";
+	{
+		boost::filesystem::ofstream file(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write(header, sizeof(header));
+		file.write(n_queue_id.data(), n_queue_id.size());
+
+		std::vector<boost::uint64_t> words{ m_words };
+		for (boost::uint64_t &word : words) {
+			boost::endian::native_to_little_inplace(word);
+		}
+		file.write(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(boost::uint64_t));
+
+		if (!file.flush()) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Could not write candidate filter")
+			            << error_argument(temp.string()));
+		}
+	}
+
+	boost::filesystem::rename(temp, n_file);
+}
+
+bool BloomFilter::insert(const sha512_digest &n_digest) noexcept {
+
+	return set(n_digest.data());
+}
+
+void BloomFilter::insert(const boost::uint8_t *n_key) noexcept {
+
+	set(n_key);
+}
+
+bool BloomFilter::contains(const sha512_digest &n_digest) const noexcept {
+
+	const boost::uint8_t *key = n_digest.data();
+	for (boost::uint32_t i = 0; i < m_hashes; i++) {
+		const boost::uint64_t bit = bit_index(key, i);
+		if (!(m_words[bit / 64] & (boost::uint64_t(1) << (bit % 64)))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+boost::uint64_t BloomFilter::bit_index(const boost::uint8_t *n_key, const boost::uint32_t n_hash) const noexcept {
+
+	// Double hashing, the two halves of the key are independent enough
+	const boost::uint64_t h1 = load_u64(n_key);
+	const boost::uint64_t h2 = load_u64(n_key + 8) | 1;
+	return (h1 + n_hash * h2) % m_bits;
+}
+
+bool BloomFilter::set(const boost::uint8_t *n_key) noexcept {
+
+	bool known = true;
+	for (boost::uint32_t i = 0; i < m_hashes; i++) {
+		const boost::uint64_t bit = bit_index(n_key, i);
+		const boost::uint64_t mask = boost::uint64_t(1) << (bit % 64);
+		boost::uint64_t &word = m_words[bit / 64];
+
+		if (!(word & mask)) {
+			known = false;
+			word |= mask;
+		}
+	}
+
+	if (!known) {
+		m_count++;
+	}
+
+	return known;
+}
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,87 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+#include "Sha512.hpp"
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include <string>
+#include <vector>
+
+namespace moose {
+namespace rescue {
+
+/*! @brief Bloom filter of candidates that are known to the queue
+
+	Keyed by SHA-512 digests, of which the first 16 bytes are used.
+	Those are random enough to derive all bit positions from.
+
+	A candidate it contains may still be new with the probability given at
+	construction, which is why it should be kept tiny. That only holds up to
+	capacity() candidates. Beyond that, saturated() tells callers to stop trusting it.
+ */
+class BloomFilter final {
+
+	public:
+		/*! @brief an empty filter
+			@param n_capacity number of candidates it is sized for
+			@param n_false_positive_rate probability of a new candidate to be reported as known
+		 */
+		RESCUE_API BloomFilter(const boost::uint64_t n_capacity, const double n_false_positive_rate = 1e-7);
+
+		/*! @brief load a filter saved before
+			@throw serialization_error when the file is unreadable or not a filter
+		 */
+		RESCUE_API explicit BloomFilter(const boost::filesystem::path &n_file);
+
+		/*! @brief write to n_file, replacing it
+			@param n_queue_items how many items the queue had, see queue_items()
+			@param n_queue_id identity of the queue, see queue_id()
+			@throw internal_error when the file can't be written
+		 */
+		RESCUE_API void save(const boost::filesystem::path &n_file, const boost::uint64_t n_queue_items,
+		                     const std::string &n_queue_id) const;
+
+		//! @return true when n_digest was known already, false when it is new and has been added
+		RESCUE_API bool insert(const sha512_digest &n_digest) noexcept;
+
+		//! add the first 16 bytes of a digest, as queues with binary keys store them
+		RESCUE_API void insert(const boost::uint8_t *n_key) noexcept;
+
+		RESCUE_API bool contains(const sha512_digest &n_digest) const noexcept;
+
+		//! true when more than capacity() have been inserted and false positives become likely
+		bool saturated() const noexcept { return m_count > m_capacity; }
+
+		boost::uint64_t capacity() const noexcept { return m_capacity; }
+
+		//! number of insertions that were new
+		boost::uint64_t size() const noexcept { return m_count; }
+
+		//! the number of queue items passed to save() when this was loaded, 0 for new filters
+		boost::uint64_t queue_items() const noexcept { return m_queue_items; }
+
+		//! the queue identity passed to save() when this was loaded, empty for new filters
+		const std::string &queue_id() const noexcept { return m_queue_id; }
+
+	private:
+		boost::uint64_t bit_index(const boost::uint8_t *n_key, const boost::uint32_t n_hash) const noexcept;
+
+		//! @return true when all bits were set already
+		bool set(const boost::uint8_t *n_key) noexcept;
+
+		boost::uint64_t              m_capacity;
+		boost::uint64_t              m_bits;
+		boost::uint32_t              m_hashes;
+		boost::uint64_t              m_count;
+		boost::uint64_t              m_queue_items;
+		std::string                  m_queue_id;
+		std::vector<boost::uint64_t> m_words;
+};
+
+} // namespace rescue
+} // namespace moose
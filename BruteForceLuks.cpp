@@ -6,9 +6,12 @@
 
 #include "tools/Log.hpp"
 #include "tools/Assert.hpp"
+#include "tools/Error.hpp"
 
 #include <libcryptsetup.h>
 
+#include <algorithm>
+
 namespace moose {
 namespace rescue {
 
@@ -33,33 +36,181 @@ void crypt_log_callback(int n_level, const char *n_msg, void *) {
 	}
 }
 
-bool attempt_password(const boost::filesystem::path &n_header_file, const std::string &n_password) {
+std::vector<std::size_t> select_key_slots(const fs::path &n_header_file, const int n_slot) {
 
-	std::string header_file_name{ n_header_file.string() };
+	std::vector<luks_slot_cost> costs;
+	try {
+		const luks_volume volume = read_luks_volume(n_header_file);
+		costs = estimate_slot_costs(volume);
 
-	int ret = 0;
-	struct crypt_device *crypt_dev = nullptr;
+		for (const luks_slot &slot : volume.m_slots) {
+			const luks_kdf &kdf = slot.m_kdf;
+			const double seconds = std::find_if(costs.cbegin(), costs.cend(),
+			        [&](const luks_slot_cost &n_cost) { return n_cost.m_index == slot.m_index; })->m_seconds;
 
+			if (kdf.m_type == "pbkdf2") {
+				BOOST_LOG_SEV(logger(), normal) << "Key slot " << slot.m_index << ": pbkdf2 " << kdf.m_hash << ", "
+				        << kdf.m_iterations << " iterations, ~" << seconds << "s per attempt";
+			} else {
+				BOOST_LOG_SEV(logger(), normal) << "Key slot " << slot.m_index << ": " << kdf.m_type << ", time " << kdf.m_iterations
+				        << ", memory " << kdf.m_memory_kb << " KiB, " << kdf.m_parallelism << " threads, ~" << seconds << "s per attempt";
+			}
+		}
 
-	// Load the LUKS volume header
-	crypt_init(&crypt_dev, header_file_name.c_str());
-	crypt_load(crypt_dev, CRYPT_LUKS1, nullptr);
-
-	crypt_set_log_callback(crypt_dev, &crypt_log_callback, &ret);
-
-	// Decrypt the LUKS volume with the password
-	ret = crypt_activate_by_passphrase(crypt_dev, nullptr, CRYPT_ANY_SLOT, n_password.c_str(), n_password.size(), CRYPT_ACTIVATE_READONLY);
-	if (ret >= 0) {
-		// We have a positive result. Who would have guessed?
-		BOOST_LOG_SEV(logger(), normal) << "Activation returned " << ret << ". Seems like we have a winner: " << n_password;
-		crypt_free(crypt_dev);
-		return true;
+	} catch (const serialization_error &serr) {
+		BOOST_LOG_SEV(logger(), warning) << "Cannot inspect key slots: " << boost::diagnostic_information(serr);
+
+		// Without knowing more, a single slot is all we can target
+		if (n_slot >= 0) {
+			return std::vector<std::size_t>{ static_cast<std::size_t>(n_slot) };
+		}
+		return std::vector<std::size_t>();
+	}
+
+	std::vector<std::size_t> ret;
+	if (n_slot >= 0) {
+		if (std::none_of(costs.cbegin(), costs.cend(), [&](const luks_slot_cost &n_cost) { return n_cost.m_index == static_cast<std::size_t>(n_slot); })) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Key slot is not active")
+			            << error_argument(n_slot));
+		}
+		ret.push_back(static_cast<std::size_t>(n_slot));
+	} else if ((n_slot == cheapest_key_slot) && !costs.empty()) {
+		ret.push_back(costs.front().m_index);
 	} else {
-		BOOST_LOG_SEV(logger(), debug) << "Failed to open volume";
-		crypt_free(crypt_dev);
-		return false;
+		for (const luks_slot_cost &cost : costs) {
+			ret.push_back(cost.m_index);
+		}
+	}
+
+	if (ret.size() == 1) {
+		BOOST_LOG_SEV(logger(), normal) << "Trying key slot " << ret.front() << " only";
+	} else {
+		BOOST_LOG_SEV(logger(), normal) << "Trying all " << ret.size() << " key slots, cheapest first";
+	}
+
+	return ret;
+}
+
+LuksContext::LuksContext(const boost::filesystem::path &n_header_file, const bool n_native, const std::vector<std::size_t> &n_slots)
+        : m_header_file{ n_header_file }
+        , m_slots{ n_slots }
+        , m_memory_cost{ 0 }
+        , m_crypt_dev{ nullptr } {
+
+	if (n_native) {
+		try {
+			m_verifier.reset(new LuksVerifier{ m_header_file, m_slots });
+			m_memory_cost = m_verifier->memory_cost();
+			return;
+		} catch (const serialization_error &serr) {
+			BOOST_LOG_SEV(logger(), warning) << "Header not supported by native verifier, falling back to libcryptsetup: "
+			        << boost::diagnostic_information(serr);
+		}
+	}
+
+	load_crypt_device();
+
+	// libcryptsetup needs the same memory for its KDF. Find out how much if we can
+	try {
+		for (const luks_slot &slot : read_luks_volume(m_header_file).m_slots) {
+			if (m_slots.empty() || (std::find(m_slots.cbegin(), m_slots.cend(), slot.m_index) != m_slots.cend())) {
+				m_memory_cost = std::max(m_memory_cost, static_cast<boost::uint64_t>(slot.m_kdf.m_memory_kb) * 1024);
+			}
+		}
+	} catch (const moose_error &) {
+		BOOST_LOG_SEV(logger(), warning) << "Cannot determine KDF memory cost of " << m_header_file.string();
+	}
+}
+
+void LuksContext::load_crypt_device() {
+
+	const std::string header_file_name{ m_header_file.string() };
+
+	// Load the LUKS volume header
+	int ret = crypt_init(&m_crypt_dev, header_file_name.c_str());
+	if (ret < 0) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot initialize crypt device")
+		            << error_argument(header_file_name));
+	}
+
+	crypt_set_log_callback(m_crypt_dev, &crypt_log_callback, nullptr);
+
+	// Any LUKS version
+	ret = crypt_load(m_crypt_dev, CRYPT_LUKS, nullptr);
+	if (ret < 0) {
+		crypt_free(m_crypt_dev);
+		m_crypt_dev = nullptr;
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot load LUKS header")
+		            << error_argument(header_file_name));
 	}
 }
 
+LuksContext::~LuksContext() noexcept {
+
+	if (m_crypt_dev) {
+		crypt_free(m_crypt_dev);
+	}
+}
+
+bool attempt_password(LuksContext &n_context, const std::string &n_password) {
+
+	if (n_context.m_verifier) {
+		if (n_context.m_verifier->verify(n_password)) {
+			BOOST_LOG_SEV(logger(), normal) << "Seems like we have a winner: " << n_password;
+			return true;
+		} else {
+			BOOST_LOG_SEV(logger(), debug) << "Password does not match any key slot";
+			return false;
+		}
+	}
+
+	MOOSE_ASSERT(n_context.m_crypt_dev)
+
+	// Decrypt the LUKS volume with the password, in the slots we were told or any
+	std::vector<int> slots{ CRYPT_ANY_SLOT };
+	if (!n_context.m_slots.empty()) {
+		slots.assign(n_context.m_slots.cbegin(), n_context.m_slots.cend());
+	}
+
+	for (const int slot : slots) {
+		const int ret = crypt_activate_by_passphrase(n_context.m_crypt_dev, nullptr, slot,
+		        n_password.c_str(), n_password.size(), CRYPT_ACTIVATE_READONLY);
+		if (ret >= 0) {
+			// We have a positive result. Who would have guessed?
+			BOOST_LOG_SEV(logger(), normal) << "Activation returned " << ret << ". Seems like we have a winner: " << n_password;
+			return true;
+		}
+	}
+
+	BOOST_LOG_SEV(logger(), debug) << "Failed to open volume";
+	return false;
+}
+
+boost::optional<std::size_t> attempt_passwords(LuksContext &n_context, const std::vector<std::string> &n_passwords) {
+
+	if (n_context.m_verifier) {
+		const boost::optional<std::size_t> found = n_context.m_verifier->verify(n_passwords);
+		if (found) {
+			BOOST_LOG_SEV(logger(), normal) << "Seems like we have a winner: " << n_passwords[*found];
+		} else {
+			BOOST_LOG_SEV(logger(), debug) << "None of " << n_passwords.size() << " passwords match any key slot";
+		}
+		return found;
+	}
+
+	for (std::size_t i = 0; i < n_passwords.size(); i++) {
+		if (attempt_password(n_context, n_passwords[i])) {
+			return i;
+		}
+	}
+
+	return boost::none;
+}
+
+std::size_t preferred_batch_size(const LuksContext &n_context) noexcept {
+
+	return n_context.m_verifier ? n_context.m_verifier->batch_size() : 1;
+}
+
 } // namespace rescue
 } // namespace moose
@@ -5,21 +5,97 @@
 #pragma once
 #include "RescueConfig.hpp"
 #include "Types.hpp"
+#include "LuksVerifier.hpp"
 
 #include "mredis/FwdDeclarations.hpp"
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <boost/cstdint.hpp>
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <list>
 
+struct crypt_device;
+
 namespace moose {
 namespace rescue {
 
+/*! @brief report the key slots of a header and decide which to try in which order
+
+	Logs each active slot's KDF, its parameters and the estimated cost per attempt.
+	Call this once at startup and hand the result to all LuksContexts.
+
+	@param n_slot a key slot index, any_key_slot or cheapest_key_slot
+	@return key slot indexes to try in this order, empty for all in any order
+	        when the header cannot be inspected natively
+	@throw internal_error when n_slot is not an active key slot
+ */
+std::vector<std::size_t> RESCUE_API select_key_slots(const boost::filesystem::path &n_header_file, const int n_slot);
+
+/*! @brief A LUKS header, loaded once and used for many attempts.
+	Opening and parsing the header is done on construction, so it is
+	not part of each attempt anymore.
+
+	By default attempts are checked natively by LuksVerifier, which needs
+	no privileges. If the header isn't supported by it or n_native is false,
+	libcryptsetup is used to activate the volume read-only instead.
+	Both handle LUKS1 and LUKS2.
+
+	Only the key slots given in n_slots are tried, in that order,
+	see select_key_slots(). Each slot costs a whole KDF run per attempt.
+
+	Not thread safe. Create one for each worker thread.
+ */
+class LuksContext final {
+
+	public:
+		//! @throw internal_error when the header cannot be loaded
+		RESCUE_API explicit LuksContext(const boost::filesystem::path &n_header_file, const bool n_native = true,
+		                                const std::vector<std::size_t> &n_slots = std::vector<std::size_t>());
+		RESCUE_API ~LuksContext() noexcept;
+
+		LuksContext(const LuksContext &) = delete;
+		LuksContext &operator=(const LuksContext &) = delete;
+
+		const boost::filesystem::path &header_file() const noexcept { return m_header_file; }
+
+		/*! @brief bytes of memory one attempt takes, 0 if next to none or unknown
+			This is the Argon2 memory cost of LUKS2 key slots.
+			Workers have to be limited by it.
+		 */
+		boost::uint64_t memory_cost() const noexcept { return m_memory_cost; }
+
+	private:
+		friend bool attempt_password(LuksContext &n_context, const std::string &n_password);
+		friend boost::optional<std::size_t> attempt_passwords(LuksContext &n_context, const std::vector<std::string> &n_passwords);
+		friend std::size_t preferred_batch_size(const LuksContext &n_context) noexcept;
+
+		void load_crypt_device();
+
+		const boost::filesystem::path  m_header_file;
+		const std::vector<std::size_t> m_slots;       //!< to try, all if empty
+		boost::uint64_t                m_memory_cost;
+		std::unique_ptr<LuksVerifier>  m_verifier;    //!< native check, if supported
+		struct crypt_device           *m_crypt_dev;   //!< libcryptsetup otherwise
+};
+
 /*! @brief brute force attempt to open a Luks volume.
  */
-bool attempt_password(const boost::filesystem::path &n_header_file, const std::string &n_password);
+bool RESCUE_API attempt_password(LuksContext &n_context, const std::string &n_password);
+
+/*! @brief brute force attempt with a whole batch of passwords.
+	The native verifier runs PBKDF2 for all of them together in SIMD lanes,
+	which is much faster than one by one. libcryptsetup still goes one by one.
+
+	@return the index of the password that opened the volume
+ */
+boost::optional<std::size_t> RESCUE_API attempt_passwords(LuksContext &n_context, const std::vector<std::string> &n_passwords);
+
+//! @return how many passwords attempt_passwords() should be given at once
+std::size_t RESCUE_API preferred_batch_size(const LuksContext &n_context) noexcept;
 
 } // namespace rescue
 } // namespace moose
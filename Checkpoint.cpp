@@ -0,0 +1,404 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Checkpoint.hpp"
+#include "InputGenerator.hpp"
+#include "Sha512.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/endian/conversion.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+namespace fs = boost::filesystem;
+
+namespace {
+
+/* All files are a header followed by fixed size records, all little endian.
+ * A record torn by a crash is cut off when the file is opened again.
+ *
+ * run file:      magic, u32 settings length, settings
+ *                records: u64 input lines done, the last one counts
+ *
+ * patterns file: magic
+ *                records: 16 byte pattern key, u64 begin, u64 end of a range that is done
+ *
+ * Earlier versions had a file per pattern, named after its key. Those are ignored.
+ */
+const char run_magic[8]     = { 'R', 'S', 'C', 'R', 'U', 'N', '0', '1' };
+const char pattern_magic[8] = { 'R', 'S', 'C', 'P', 'A', 'T', '0', '2' };
+
+const std::size_t key_size            = 16;
+const std::size_t run_record_size     = 8;
+const std::size_t pattern_record_size = key_size + 16;
+
+template <typename T>
+void put(std::string &n_dst, const T n_value) {
+
+	const T value = boost::endian::native_to_little(n_value);
+	n_dst.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(const char *n_src) {
+
+	T value;
+	std::memcpy(&value, n_src, sizeof(value));
+	return boost::endian::little_to_native(value);
+}
+
+void throw_errno(const char *n_what, const fs::path &n_file) {
+
+	BOOST_THROW_EXCEPTION(internal_error() << error_message(std::string(n_what) + ": " + std::strerror(errno))
+	            << error_argument(n_file.string()));
+}
+
+void write_all(const int n_fd, const char *n_data, std::size_t n_size, const fs::path &n_file) {
+
+	while (n_size) {
+		const ssize_t written = ::write(n_fd, n_data, n_size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw_errno("Cannot write checkpoint", n_file);
+		}
+		n_data += written;
+		n_size -= static_cast<std::size_t>(written);
+	}
+}
+
+//! make a new file's directory entry survive a crash
+void sync_directory(const fs::path &n_directory) {
+
+	const int fd = ::open(n_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0) {
+		::fsync(fd);
+		::close(fd);
+	}
+}
+
+/* Open the log n_file, which starts with n_header, for appending.
+ * A new one or one torn while it was created gets a fresh header.
+ * @return the whole records in it
+ */
+std::string open_log(const fs::path &n_file, const std::string &n_header, const std::size_t n_record_size,
+                     const char *n_mismatch, int &n_fd) {
+
+	n_fd = ::open(n_file.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (n_fd < 0) {
+		throw_errno("Cannot open checkpoint", n_file);
+	}
+
+	try {
+		std::string content;
+		char buffer[65536];
+		for (off_t offset = 0; ; ) {
+			const ssize_t got = ::pread(n_fd, buffer, sizeof(buffer), offset);
+			if (got < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw_errno("Cannot read checkpoint", n_file);
+			}
+			if (got == 0) {
+				break;
+			}
+			content.append(buffer, static_cast<std::size_t>(got));
+			offset += got;
+		}
+
+		if ((content.size() < n_header.size()) && (n_header.compare(0, content.size(), content) == 0)) {
+			if (::ftruncate(n_fd, 0) != 0) {
+				throw_errno("Cannot truncate checkpoint", n_file);
+			}
+			write_all(n_fd, n_header.data(), n_header.size(), n_file);
+			::fdatasync(n_fd);
+			sync_directory(n_file.parent_path());
+			return std::string();
+		}
+
+		if (content.compare(0, n_header.size(), n_header) != 0) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message(n_mismatch) << error_argument(n_file.string()));
+		}
+
+		const std::size_t records = (content.size() - n_header.size()) / n_record_size * n_record_size;
+		if (n_header.size() + records < content.size()) {
+			BOOST_LOG_SEV(logger(), warning) << "Cutting off torn record at the end of " << n_file;
+			if (::ftruncate(n_fd, static_cast<off_t>(n_header.size() + records)) != 0) {
+				throw_errno("Cannot truncate checkpoint", n_file);
+			}
+		}
+
+		return content.substr(n_header.size(), records);
+
+	} catch (...) {
+		::close(n_fd);
+		n_fd = -1;
+		throw;
+	}
+}
+
+/* The first 16 bytes of the pattern's SHA-512. Collisions are as unlikely
+ * as they get, so the pattern itself needn't be kept
+ */
+std::string pattern_key(const std::string &n_pattern) {
+
+	const sha512_digest digest = sha512_raw(n_pattern);
+	return std::string(reinterpret_cast<const char *>(digest.data()), key_size);
+}
+
+} // anon namespace
+
+//! what is done of one pattern
+struct Checkpoint::PatternLog {
+
+	std::uint64_t                          m_size = 0;   //!< number of permutations, once known
+	bool                                   m_sized = false;
+	std::map<std::uint64_t, std::uint64_t> m_ranges;     //!< begin to end, merged where they touch
+
+	void add(std::uint64_t n_begin, std::uint64_t n_end) {
+
+		if (n_begin >= n_end) {
+			return;
+		}
+
+		// Swallow all ranges overlapping or touching [n_begin, n_end)
+		auto it = m_ranges.upper_bound(n_begin);
+		if ((it != m_ranges.begin()) && (std::prev(it)->second >= n_begin)) {
+			--it;
+		}
+		while ((it != m_ranges.end()) && (it->first <= n_end)) {
+			n_begin = std::min(n_begin, it->first);
+			n_end = std::max(n_end, it->second);
+			it = m_ranges.erase(it);
+		}
+
+		m_ranges.emplace(n_begin, n_end);
+	}
+
+	bool covers(const std::uint64_t n_begin, const std::uint64_t n_end) const {
+
+		if (n_begin >= n_end) {
+			return true;
+		}
+
+		auto it = m_ranges.upper_bound(n_begin);
+		if (it == m_ranges.begin()) {
+			return false;
+		}
+		--it;
+		return it->second >= n_end;
+	}
+
+	bool complete(const std::string &n_pattern) {
+
+		if (!m_sized) {
+			m_size = count_permutations(n_pattern);
+			m_sized = true;
+		}
+
+		return covers(0, m_size);
+	}
+};
+
+Checkpoint::Checkpoint(const fs::path &n_directory, const std::string &n_settings,
+                       const std::size_t n_sync_records, const boost::chrono::milliseconds n_sync_interval)
+        : m_directory{ n_directory }
+        , m_sync_records{ std::max<std::size_t>(1, n_sync_records) }
+        , m_sync_interval{ n_sync_interval }
+        , m_run_fd{ -1 }
+        , m_patterns_fd{ -1 }
+        , m_input_position{ 0 }
+        , m_unsynced{ 0 }
+        , m_last_sync{ boost::chrono::steady_clock::now() } {
+
+	fs::create_directories(m_directory);
+
+	std::string header{ run_magic, sizeof(run_magic) };
+	put<std::uint32_t>(header, static_cast<std::uint32_t>(n_settings.size()));
+	header += n_settings;
+
+	const std::string records = open_log(m_directory / "run", header, run_record_size,
+	        "Checkpoint was made with other settings", m_run_fd);
+
+	if (!records.empty()) {
+		m_input_position = get<std::uint64_t>(records.data() + records.size() - run_record_size);
+		BOOST_LOG_SEV(logger(), normal) << "Resuming from checkpoint in " << m_directory << ", "
+		        << m_input_position << " input lines done";
+	}
+
+	try {
+		const std::string ranges = open_log(m_directory / "patterns", std::string{ pattern_magic, sizeof(pattern_magic) },
+		        pattern_record_size, "Not a checkpoint pattern file", m_patterns_fd);
+
+		for (std::size_t offset = 0; offset < ranges.size(); offset += pattern_record_size) {
+			std::unique_ptr<PatternLog> &log = m_patterns[ranges.substr(offset, key_size)];
+			if (!log) {
+				log.reset(new PatternLog);
+			}
+			log->add(get<std::uint64_t>(ranges.data() + offset + key_size), get<std::uint64_t>(ranges.data() + offset + key_size + 8));
+		}
+	} catch (...) {
+		::close(m_run_fd);
+		throw;
+	}
+
+	if (!m_patterns.empty()) {
+		BOOST_LOG_SEV(logger(), normal) << "Checkpoint has progress on " << m_patterns.size() << " patterns";
+	}
+}
+
+boost::optional<std::string> Checkpoint::settings(const fs::path &n_directory) {
+
+	fs::ifstream file{ n_directory / "run", std::ios::in | std::ios::binary };
+
+	char header[sizeof(run_magic) + 4];
+	if (!file.read(header, sizeof(header)) || (std::memcmp(header, run_magic, sizeof(run_magic)) != 0)) {
+		return boost::none;
+	}
+
+	// Settings are a line or two of text. A length beyond that is a broken file
+	const std::uint32_t size = get<std::uint32_t>(header + sizeof(run_magic));
+	if (size > 65536) {
+		return boost::none;
+	}
+
+	std::string ret(size, '\0');
+	if (!file.read(&ret[0], ret.size())) {
+		return boost::none;
+	}
+
+	return ret;
+}
+
+void Checkpoint::clear(const fs::path &n_directory) {
+
+	fs::remove(n_directory / "run");
+	fs::remove(n_directory / "patterns");
+	sync_directory(n_directory);
+}
+
+Checkpoint::~Checkpoint() noexcept {
+
+	try {
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		sync_locked();
+	} catch (const std::exception &sex) {
+		BOOST_LOG_SEV(logger(), error) << "Cannot sync checkpoint: " << sex.what();
+	}
+
+	::close(m_patterns_fd);
+	::close(m_run_fd);
+}
+
+std::uint64_t Checkpoint::input_position() const {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_input_position;
+}
+
+void Checkpoint::input_done(const std::uint64_t n_lines) {
+
+	std::string record;
+	put<std::uint64_t>(record, n_lines);
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	append(m_run_fd, record.data(), record.size());
+	m_input_position = n_lines;
+}
+
+void Checkpoint::done(const std::string &n_pattern, const std::uint64_t n_begin, const std::uint64_t n_end) {
+
+	if (n_begin >= n_end) {
+		return;
+	}
+
+	const std::string key = pattern_key(n_pattern);
+
+	std::string record{ key };
+	put<std::uint64_t>(record, n_begin);
+	put<std::uint64_t>(record, n_end);
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	std::unique_ptr<PatternLog> &log = m_patterns[key];
+	if (!log) {
+		log.reset(new PatternLog);
+	} else if (log->covers(n_begin, n_end)) {
+		return;
+	}
+
+	append(m_patterns_fd, record.data(), record.size());
+	log->add(n_begin, n_end);
+}
+
+bool Checkpoint::is_done(const std::string &n_pattern, const std::uint64_t n_begin, const std::uint64_t n_end) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	const PatternLog *log = find(n_pattern);
+	return log ? log->covers(n_begin, n_end) : (n_begin >= n_end);
+}
+
+bool Checkpoint::complete(const std::string &n_pattern) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	PatternLog *log = find(n_pattern);
+
+	// Without any progress only a pattern without permutations is
+	return log ? log->complete(n_pattern) : (count_permutations(n_pattern) == 0);
+}
+
+void Checkpoint::sync() {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	sync_locked();
+}
+
+Checkpoint::PatternLog *Checkpoint::find(const std::string &n_pattern) {
+
+	const auto known = m_patterns.find(pattern_key(n_pattern));
+	return (known != m_patterns.end()) ? known->second.get() : nullptr;
+}
+
+void Checkpoint::append(const int n_fd, const char *n_data, const std::size_t n_size) {
+
+	MOOSE_ASSERT(n_fd >= 0)
+
+	write_all(n_fd, n_data, n_size, m_directory);
+	m_dirty.insert(n_fd);
+
+	if ((++m_unsynced >= m_sync_records) || (boost::chrono::steady_clock::now() - m_last_sync >= m_sync_interval)) {
+		sync_locked();
+	}
+}
+
+void Checkpoint::sync_locked() {
+
+	for (const int fd : m_dirty) {
+		if (::fdatasync(fd) != 0) {
+			throw_errno("Cannot sync checkpoint", m_directory);
+		}
+	}
+
+	m_dirty.clear();
+	m_unsynced = 0;
+	m_last_sync = boost::chrono::steady_clock::now();
+}
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,109 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace moose {
+namespace rescue {
+
+/*! @brief progress of a run kept on disk, so a restart picks up where it stopped
+
+	A directory with one file for the run, holding the settings and the position
+	in the input file, and one for the patterns, holding the index ranges of their
+	permutations that are done, keyed by the pattern's hash. Both are append only
+	logs of fixed size records. They are synced in batches, a crash only loses the
+	last few records. That means some work is done twice but none is ever skipped.
+
+	Only patterns with progress take memory, asking about others costs nothing.
+
+	Thread safe.
+ */
+class Checkpoint final {
+
+	public:
+		/*! @brief open or start a checkpoint in n_directory, which is created if needed
+
+			@param n_settings what the progress is valid for, like the KDF settings of the header.
+			       Progress made with other settings is refused
+			@param n_sync_records sync after that many records at the latest
+			@param n_sync_interval ... or after that much time, whichever comes first
+
+			@throw serialization_error when the checkpoint was made with other settings
+			@throw internal_error when files can't be opened or written
+		 */
+		RESCUE_API Checkpoint(const boost::filesystem::path &n_directory, const std::string &n_settings,
+		                      const std::size_t n_sync_records = 256,
+		                      const boost::chrono::milliseconds n_sync_interval = boost::chrono::seconds(1));
+
+		//! syncs what's left
+		RESCUE_API ~Checkpoint() noexcept;
+
+		Checkpoint(const Checkpoint &) = delete;
+		Checkpoint &operator=(const Checkpoint &) = delete;
+
+		//! @return the number of input lines that are done
+		RESCUE_API std::uint64_t input_position() const;
+
+		//! record that the first n_lines input lines are done
+		RESCUE_API void input_done(const std::uint64_t n_lines);
+
+		//! record permutations [n_begin, n_end) of n_pattern as tried
+		RESCUE_API void done(const std::string &n_pattern, const std::uint64_t n_begin, const std::uint64_t n_end);
+
+		//! @return true when all of [n_begin, n_end) of n_pattern has been tried
+		RESCUE_API bool is_done(const std::string &n_pattern, const std::uint64_t n_begin, const std::uint64_t n_end);
+
+		/*! @return true when all permutations of n_pattern have been tried
+			@throw serialization_error on bad pattern
+		 */
+		RESCUE_API bool complete(const std::string &n_pattern);
+
+		//! write all records to disk now
+		RESCUE_API void sync();
+
+		//! @return the settings the checkpoint in n_directory was made with, none if there is none
+		RESCUE_API static boost::optional<std::string> settings(const boost::filesystem::path &n_directory);
+
+		//! drop all progress kept in n_directory. Must not be open
+		RESCUE_API static void clear(const boost::filesystem::path &n_directory);
+
+	private:
+		struct PatternLog;
+
+		//! @return the progress of n_pattern, nullptr when there is none
+		PatternLog *find(const std::string &n_pattern);
+
+		//! append n_size bytes to n_fd, syncing when it is time
+		void append(const int n_fd, const char *n_data, const std::size_t n_size);
+
+		void sync_locked();
+
+		const boost::filesystem::path                        m_directory;
+		const std::size_t                                    m_sync_records;
+		const boost::chrono::milliseconds                    m_sync_interval;
+
+		mutable boost::mutex                                 m_mutex;
+		int                                                  m_run_fd;
+		int                                                  m_patterns_fd;
+		std::uint64_t                                        m_input_position;
+		std::map<std::string, std::unique_ptr<PatternLog> >  m_patterns;     //!< by key, see pattern_key()
+		std::set<int>                                        m_dirty;        //!< files written to since the last sync
+		std::size_t                                          m_unsynced;
+		boost::chrono::steady_clock::time_point              m_last_sync;
+};
+
+} // namespace rescue
+} // namespace moose
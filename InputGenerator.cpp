@@ -11,13 +11,16 @@
 
 #include <boost/variant.hpp>
 
+#include <algorithm>
 #include <bitset>
+#include <limits>
 #include <locale>
 #include <list>
 
 namespace moose {
 namespace rescue {
 
+using namespace moose::tools;
 
 /* create all upper and lowercase permutations of a string */
 void case_permutations(const std::string &n_input, std::vector<std::string> &n_output) {
@@ -70,6 +73,21 @@ void case_permutations(const std::string &n_input, std::vector<std::string> &n_o
 #endif
 }
 
+namespace {
+
+//! what a single whitespace becomes
+void whitespace_options(std::vector<std::string> &n_output) {
+
+	n_output.push_back("");
+	n_output.push_back(" ");
+	n_output.push_back("_");
+	n_output.push_back(".");
+	n_output.push_back("-");
+	n_output.push_back("\t");
+}
+
+} // anon namespace
+
 class TokenVisitor : boost::static_visitor<> {
 
 	public:
@@ -80,12 +98,7 @@ class TokenVisitor : boost::static_visitor<> {
 
 		void operator()(const whitespace &) {
 
-			m_dst.push_back("");
-			m_dst.push_back(" ");
-			m_dst.push_back("_");
-			m_dst.push_back(".");
-			m_dst.push_back("-");
-			m_dst.push_back("\t");
+			whitespace_options(m_dst);
 		}
 
 		void operator()(const string_var &n_str_var) {
@@ -100,38 +113,304 @@ class TokenVisitor : boost::static_visitor<> {
 };
 
 
-std::vector<std::string> recurse_permutations(const std::list<token> &n_remains) {
+CompiledPattern::CompiledPattern(const std::string &n_input) {
+
+	flat_pattern pattern;
+	parse_input_flat(n_input, pattern);
+
+	// Same as the visitor does for tokens, straight from the input
+	std::vector<std::string> options;
+	for (const flat_token &t : pattern.m_tokens) {
+		options.clear();
+		switch (t.m_type) {
+			case flat_token::type::text:
+				case_permutations(n_input.substr(t.m_span.m_offset, t.m_span.m_size), options);
+				break;
+			case flat_token::type::whitespace:
+				whitespace_options(options);
+				break;
+			case flat_token::type::variant:
+				for (std::size_t o = t.m_span.m_offset; o < t.m_span.m_offset + t.m_span.m_size; o++) {
+					case_permutations(n_input.substr(pattern.m_options[o].m_offset, pattern.m_options[o].m_size), options);
+				}
+				break;
+		}
+		add(options);
+	}
+}
 
-	std::list<token> remains = n_remains;
+CompiledPattern::CompiledPattern(const std::list<token> &n_tokens) {
 
-	// Get a vector with all the permutations for the first remaining token
+	for (const token &t : n_tokens) {
+		TokenVisitor v;
+		boost::apply_visitor(v, t);
+		add(v.m_dst);
+	}
+}
 
-	TokenVisitor v;
-	boost::apply_visitor(v, remains.front());
+void CompiledPattern::add(const std::vector<std::string> &n_options) {
 
-	remains.pop_front();
+	MOOSE_ASSERT(!n_options.empty())
 
-	// If we reached the last of tokens, we return all permutations of it
-	if (remains.empty()) {
+	std::size_t longest = 0;
+	for (const std::string &option : n_options) {
+		m_arena.append(option);
+		m_offsets.push_back(m_arena.size());
+		longest = std::max(longest, option.size());
+	}
 
-		return v.m_dst;
+	m_first.push_back(m_offsets.size() - 1);
+	m_max_size += longest;
+}
 
-	// Otherwise we recurse further
-	} else {
+PermutationGenerator::PermutationGenerator(const std::string &n_input)
+        : m_size{ 0 }
+        , m_exhausted{ false } {
 
-		std::vector<std::string> ret;
+	if (!n_input.empty()) {
+		m_pattern = CompiledPattern{ n_input };
+	}
 
-		// All permutations of all combinations after that. What a waste of memory...
-		std::vector<std::string> recursed_strings = recurse_permutations(remains);
+	count();
+	reset();
+}
 
-		for (const std::string &begin : v.m_dst) {
-			for (const std::string &end : recursed_strings) {
-				ret.push_back(begin + end);
+PermutationGenerator::PermutationGenerator(const std::list<token> &n_tokens)
+        : m_pattern{ n_tokens }
+        , m_size{ 0 }
+        , m_exhausted{ false } {
+
+	count();
+	reset();
+}
+
+void PermutationGenerator::count() noexcept {
+
+	// The size of the permutation space is the product of all radices.
+	// Leave it at 0 if that product doesn't fit, size() will complain then
+	if (m_pattern.tokens() > 0) {
+		std::uint64_t size = 1;
+		for (std::size_t i = 0; i < m_pattern.tokens(); i++) {
+			if (size > std::numeric_limits<std::uint64_t>::max() / m_pattern.options(i)) {
+				return;
 			}
+			size *= m_pattern.options(i);
+		}
+		m_size = size;
+	}
+}
+
+void PermutationGenerator::assemble(const std::vector<std::size_t> &n_digits, std::string &n_candidate) const {
+
+	// Only the first candidate into a buffer may allocate
+	n_candidate.clear();
+	n_candidate.reserve(m_pattern.max_size());
+	for (std::size_t i = 0; i < m_pattern.tokens(); i++) {
+		n_candidate.append(m_pattern.option(i, n_digits[i]), m_pattern.option_size(i, n_digits[i]));
+	}
+}
+
+void PermutationGenerator::reset() noexcept {
+
+	m_odometer.assign(m_pattern.tokens(), 0);
+	m_bounds.assign(m_pattern.tokens() + 1, 0);
+	m_changed = 0;
+
+	// No tokens, no permutations
+	m_exhausted = (m_pattern.tokens() == 0);
+}
+
+bool PermutationGenerator::next(std::string &n_candidate) {
+
+	if (m_exhausted) {
+		return false;
+	}
+
+	update();
+	if (&n_candidate != &m_current) {
+		n_candidate.assign(m_current);
+	}
+
+	// Advance the odometer. The last token turns fastest, which yields the same
+	// order the old recursive implementation had.
+	std::size_t i = m_pattern.tokens();
+	while (i > 0) {
+		i--;
+		if (++m_odometer[i] < m_pattern.options(i)) {
+			m_changed = i;
+			return true;
+		}
+		m_odometer[i] = 0;
+	}
+
+	// Wrapped around the first token, this was the last one
+	m_exhausted = true;
+	return true;
+}
+
+std::size_t PermutationGenerator::next(std::vector<std::string> &n_batch, const std::size_t n_count) {
+
+	if (n_batch.size() < n_count) {
+		n_batch.resize(n_count);
+	}
+
+	std::size_t count = 0;
+	while ((count < n_count) && next(n_batch[count])) {
+		count++;
+	}
+
+	n_batch.resize(count);
+	return count;
+}
+
+void PermutationGenerator::update() {
+
+	// Tokens after the changed one have wrapped around, so the whole suffix is new
+	if (m_current.capacity() < m_pattern.max_size()) {
+		m_current.reserve(m_pattern.max_size());
+	}
+
+	m_current.resize(m_bounds[m_changed]);
+	for (std::size_t i = m_changed; i < m_pattern.tokens(); i++) {
+		m_current.append(m_pattern.option(i, m_odometer[i]), m_pattern.option_size(i, m_odometer[i]));
+		m_bounds[i + 1] = m_current.size();
+	}
+
+	m_changed = m_pattern.tokens();
+}
+
+std::uint64_t PermutationGenerator::size() const {
+
+	if ((m_size == 0) && (m_pattern.tokens() > 0)) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Number of permutations exceeds 64 bits"));
+	}
+
+	return m_size;
+}
+
+std::uint64_t PermutationGenerator::position() const {
+
+	if (m_exhausted) {
+		return size();
+	}
+
+	return rank(m_odometer);
+}
+
+void PermutationGenerator::seek(const std::uint64_t n_index) {
+
+	if (n_index == size()) {
+		m_exhausted = true;
+		return;
+	}
+
+	unrank(n_index, m_odometer);
+	m_changed = 0;
+	m_exhausted = false;
+}
+
+void PermutationGenerator::unrank(const std::uint64_t n_index, std::string &n_candidate) const {
+
+	std::vector<std::size_t> digits;
+	unrank(n_index, digits);
+	assemble(digits, n_candidate);
+}
+
+void PermutationGenerator::unrank(const std::uint64_t n_index, std::vector<std::size_t> &n_digits) const {
+
+	if (n_index >= size()) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Permutation index out of range")
+		            << error_argument(n_index));
+	}
+
+	n_digits.resize(m_pattern.tokens());
+
+	// Least significant digit is the last token
+	std::uint64_t remains = n_index;
+	std::size_t i = m_pattern.tokens();
+	while (i > 0) {
+		i--;
+		n_digits[i] = static_cast<std::size_t>(remains % m_pattern.options(i));
+		remains /= m_pattern.options(i);
+	}
+}
+
+std::uint64_t PermutationGenerator::rank(const std::vector<std::size_t> &n_digits) const {
+
+	if (n_digits.size() != m_pattern.tokens()) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Number of digits doesn't match number of tokens")
+		            << error_argument(n_digits.size()));
+	}
+
+	// Guard against overflow first, then Horner is fine
+	size();
+
+	std::uint64_t index = 0;
+	for (std::size_t i = 0; i < m_pattern.tokens(); i++) {
+		if (n_digits[i] >= m_pattern.options(i)) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Option index out of range")
+			            << error_argument(n_digits[i]));
+		}
+		index = index * m_pattern.options(i) + n_digits[i];
+	}
+
+	return index;
+}
+
+PermutationGenerator::const_iterator::const_iterator(PermutationGenerator *n_generator)
+        : m_generator{ n_generator } {
+
+	// Position on the first remaining permutation, which may already be the end
+	if (!m_generator->next(m_generator->m_current)) {
+		m_generator = nullptr;
+	}
+}
+
+PermutationGenerator::const_iterator &PermutationGenerator::const_iterator::operator++() {
+
+	MOOSE_ASSERT(m_generator)
+
+	if (!m_generator->next(m_generator->m_current)) {
+		m_generator = nullptr;
+	}
+
+	return *this;
+}
+
+Deduplicator::Deduplicator(const std::size_t n_max_bytes)
+        : m_max_bytes{ n_max_bytes }
+        , m_bytes{ 0 }
+        , m_duplicates{ 0 } {
+}
+
+bool Deduplicator::insert(const std::string &n_candidate) {
+
+	if (full()) {
+		if (m_seen.count(n_candidate)) {
+			m_duplicates++;
+			return false;
 		}
+		return true;
+	}
+
+	if (!m_seen.insert(n_candidate).second) {
+		m_duplicates++;
+		return false;
+	}
 
-		return ret;
+	// Roughly what a node and bucket of the set cost, plus the heap buffer
+	// of strings too long to be stored in the string object itself
+	m_bytes += sizeof(std::string) + 3 * sizeof(void *);
+	if (n_candidate.size() > 15) {
+		m_bytes += n_candidate.size() + 1;
 	}
+
+	if (full()) {
+		BOOST_LOG_SEV(logger(), warning) << "Deduplication memory full after " << m_seen.size()
+		        << " candidates, later ones are not remembered";
+	}
+
+	return true;
 }
 
 std::size_t generate_permutations(const std::string &n_input, std::vector<std::string> &n_output) {
@@ -140,14 +419,25 @@ std::size_t generate_permutations(const std::string &n_input, std::vector<std::s
 		return 0;
 	}
 
-	const std::list<token> tokens = parse_input_string(n_input);
+	PermutationGenerator generator{ n_input };
+	n_output.clear();
 
-	// Now that I have a vector of tokens, iterate and generate output for each
-	n_output = recurse_permutations(tokens);
+	for (std::string candidate; generator.next(candidate); ) {
+		n_output.push_back(candidate);
+	}
 
 	return n_output.size();
 }
 
+std::uint64_t count_permutations(const std::string &n_input) {
+
+	if (n_input.empty()) {
+		return 0;
+	}
+
+	return PermutationGenerator{ n_input }.size();
+}
+
 
 
 
@@ -4,14 +4,219 @@
 
 #pragma once
 #include "RescueConfig.hpp"
+#include "Types.hpp"
 
+#include <cstdint>
+#include <iterator>
 #include <vector>
 #include <string>
 #include <list>
+#include <unordered_set>
 
 namespace moose {
 namespace rescue {
 
+/*! @brief the options of every token of a pattern, expanded once into one block of memory
+
+	Case permutations, whitespace replacements and variants are all worked out
+	on construction and stored back to back in a single arena. Two offset tables
+	find them: token t has options m_first[t] to m_first[t + 1] and option o spans
+	m_offsets[o] to m_offsets[o + 1] of the arena. Appending an option to a
+	candidate is a single memcpy() that way.
+ */
+class RESCUE_API CompiledPattern {
+
+	public:
+		//! no tokens
+		CompiledPattern() = default;
+
+		//! @throw serialization_error
+		explicit CompiledPattern(const std::string &n_input);
+		explicit CompiledPattern(const std::list<token> &n_tokens);
+
+		std::size_t tokens() const noexcept { return m_first.size() - 1; }
+
+		//! number of options of token n_token
+		std::size_t options(const std::size_t n_token) const noexcept { return m_first[n_token + 1] - m_first[n_token]; }
+
+		//! option n_option of token n_token
+		const char *option(const std::size_t n_token, const std::size_t n_option) const noexcept {
+
+			return m_arena.data() + m_offsets[m_first[n_token] + n_option];
+		}
+
+		std::size_t option_size(const std::size_t n_token, const std::size_t n_option) const noexcept {
+
+			const std::size_t o = m_first[n_token] + n_option;
+			return m_offsets[o + 1] - m_offsets[o];
+		}
+
+		//! the longest a candidate can get
+		std::size_t max_size() const noexcept { return m_max_size; }
+
+	private:
+		//! add a token with options n_options
+		void add(const std::vector<std::string> &n_options);
+
+		std::string              m_arena;              //!< all options of all tokens
+		std::vector<std::size_t> m_offsets{ 0 };       //!< where each option starts, and the end
+		std::vector<std::size_t> m_first{ 0 };         //!< first option of each token, and the end
+		std::size_t              m_max_size = 0;
+};
+
+/*! @brief lazily generate all permutations of an input string, one at a time
+ *
+ * Yields the same candidates in the same order as generate_permutations() but
+ * never holds more than one of them. The options of every token are compiled
+ * once on construction, see CompiledPattern.
+ *
+ * Successive candidates mostly differ in the last token or two. The generator
+ * keeps the last candidate and where each of its tokens starts, and only rewrites
+ * the tokens from the first one that changed. The iterator interface hands out
+ * that buffer as it is, next() copies it into the caller's buffer.
+ *
+ * Use like this:
+ *
+ *     PermutationGenerator gen{ "Hi [wo|rl]!" };
+ *     std::string candidate;
+ *     while (gen.next(candidate)) {
+ *         ...
+ *     }
+ *
+ * or with range based for, which re-uses the generator's own buffer.
+ *
+ * Every token has a fixed number of options, which makes the whole permutation
+ * space a mixed radix number with one digit per token, the last token being the
+ * least significant. Each candidate therefore has an index in [0, size()) which
+ * can be converted into the candidate directly (unrank) and back (rank).
+ */
+class RESCUE_API PermutationGenerator {
+
+	public:
+		//! @throw serialization_error
+		explicit PermutationGenerator(const std::string &n_input);
+		explicit PermutationGenerator(const std::list<token> &n_tokens);
+
+		/*! @brief write the next candidate into n_candidate
+			@return false when all permutations have been generated. n_candidate is undefined then
+		 */
+		bool next(std::string &n_candidate);
+
+		/*! @brief fill n_batch with up to n_count next candidates
+			Strings already in n_batch are overwritten and keep their capacity,
+			so a batch that is used over and over doesn't allocate.
+			@return the number of candidates in n_batch, less than n_count when exhausted
+		 */
+		std::size_t next(std::vector<std::string> &n_batch, const std::size_t n_count);
+
+		//! start over with the first permutation
+		void reset() noexcept;
+
+		/*! @brief total number of permutations, without generating any
+			@throw internal_error when the number doesn't fit 64 bits
+		 */
+		std::uint64_t size() const;
+
+		//! @return the index of the candidate next() will yield, size() when exhausted
+		std::uint64_t position() const;
+
+		/*! @brief continue generating at index n_index
+			@throw internal_error when out of range
+		 */
+		void seek(const std::uint64_t n_index);
+
+		/*! @brief write candidate number n_index into n_candidate
+			@throw internal_error when out of range
+		 */
+		void unrank(const std::uint64_t n_index, std::string &n_candidate) const;
+
+		/*! @brief convert an index into the option index of every token
+			@throw internal_error when out of range
+		 */
+		void unrank(const std::uint64_t n_index, std::vector<std::size_t> &n_digits) const;
+
+		/*! @brief convert the option index of every token into the candidate's index
+			@throw internal_error when n_digits doesn't describe a candidate of this pattern
+		 */
+		std::uint64_t rank(const std::vector<std::size_t> &n_digits) const;
+
+		/*! @brief Single pass iterator over the remaining permutations
+			Advancing it advances the generator, so there can only be one.
+		 */
+		class const_iterator {
+
+			public:
+				using iterator_category = std::input_iterator_tag;
+				using value_type        = std::string;
+				using difference_type   = std::ptrdiff_t;
+				using pointer           = const std::string *;
+				using reference         = const std::string &;
+
+				const_iterator() noexcept = default;
+				reference operator*() const noexcept { return m_generator->m_current; }
+				pointer operator->() const noexcept { return &m_generator->m_current; }
+				const_iterator &operator++();
+				bool operator==(const const_iterator &n_other) const noexcept { return m_generator == n_other.m_generator; }
+				bool operator!=(const const_iterator &n_other) const noexcept { return m_generator != n_other.m_generator; }
+
+			private:
+				friend class PermutationGenerator;
+				explicit const_iterator(PermutationGenerator *n_generator);
+
+				PermutationGenerator *m_generator = nullptr;   // nullptr is end
+		};
+
+		const_iterator begin() { return const_iterator{ this }; }
+		const_iterator end() noexcept { return const_iterator{}; }
+
+	private:
+		//! set m_size from the options
+		void count() noexcept;
+
+		//! bring m_current up to date with the odometer, from token m_changed on
+		void update();
+		void assemble(const std::vector<std::size_t> &n_digits, std::string &n_candidate) const;
+
+		CompiledPattern                        m_pattern;
+		std::vector<std::size_t>               m_odometer;  //!< current option index per token
+		std::vector<std::size_t>               m_bounds;    //!< where each token starts in m_current, and the end
+		std::size_t                            m_changed;   //!< first token that differs from m_current
+		std::uint64_t                          m_size;      //!< number of permutations, 0 on overflow
+		bool                                   m_exhausted;
+		std::string                            m_current;   //!< the last candidate, also what the iterator yields
+};
+
+/*! @brief drops candidates that have been generated before, across patterns
+
+	Different patterns, or whitespace options like "nothing" within one, often
+	yield the same candidate. Every one of those would cost a hash and a trip to
+	redis further down the line. Put all candidates through insert() before that.
+
+	This is exact, candidates are remembered as they are. To bound memory, no
+	new ones are remembered once about n_max_bytes are used. Those already
+	remembered are still recognized, later duplicates just go through then.
+ */
+class RESCUE_API Deduplicator {
+
+	public:
+		explicit Deduplicator(const std::size_t n_max_bytes = 256 * 1024 * 1024);
+
+		//! @return true when n_candidate is new, false when it is a duplicate
+		bool insert(const std::string &n_candidate);
+
+		//! number of duplicates insert() has reported
+		std::uint64_t duplicates() const noexcept { return m_duplicates; }
+
+		//! true once the memory bound was hit and new candidates are no longer remembered
+		bool full() const noexcept { return m_bytes >= m_max_bytes; }
+
+	private:
+		std::unordered_set<std::string> m_seen;
+		const std::size_t               m_max_bytes;
+		std::size_t                     m_bytes;
+		std::uint64_t                   m_duplicates;
+};
+
 /*!
  * @brief generate all possible permutations out of an input string
  *
@@ -25,6 +230,8 @@ namespace rescue {
  *	 * nothing
  * Alternatives are [something|another] where also lower and upper case is permutated.
  *
+ * This holds all permutations in memory at once. Prefer PermutationGenerator for large inputs.
+ *
  * @param n_input as described
  * @param n_output
  * @return the number of generated values
@@ -33,6 +240,11 @@ namespace rescue {
  */
 std::size_t RESCUE_API generate_permutations(const std::string &n_input, std::vector<std::string> &n_output);
 
+/*! @brief count the permutations generate_permutations() would yield without generating them
+	@throw serialization_error, internal_error
+ */
+std::uint64_t RESCUE_API count_permutations(const std::string &n_input);
+
 /* Exposed for unit tests */
 void RESCUE_API case_permutations(const std::string &n_input, std::vector<std::string> &n_output);
 
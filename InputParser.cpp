@@ -83,6 +83,23 @@ struct input_parser : qi::grammar<Iterator, std::list<moose::rescue::token>()> {
 	qi::rule<Iterator, std::list<moose::rescue::token>()> start;
 };
 
+namespace {
+
+//! what text_parser accepts: ASCII but the brackets and space
+inline bool is_text(const char n_char) noexcept {
+
+	const unsigned char c = static_cast<unsigned char>(n_char);
+	return (c < 0x80) && (c != '[') && (c != ']') && (c != ' ');
+}
+
+//! what variant_parser accepts in an option: text but the pipe
+inline bool is_option(const char n_char) noexcept {
+
+	return is_text(n_char) && (n_char != '|');
+}
+
+} // anon namespace
+
 std::list<token> RESCUE_API parse_input_string(const std::string &n_input) {
 
 	std::list<token> ret;
@@ -98,5 +115,65 @@ std::list<token> RESCUE_API parse_input_string(const std::string &n_input) {
 	}
 }
 
+void parse_input_flat(const boost::string_view n_input, flat_pattern &n_result) {
+
+	n_result.m_tokens.clear();
+	n_result.m_options.clear();
+
+	const std::size_t size = n_input.size();
+	std::size_t pos = 0;
+
+	// The grammar needs no look ahead. The first character decides on the token
+	while (pos < size) {
+
+		if (n_input[pos] == ' ') {
+
+			n_result.m_tokens.push_back(flat_token{ flat_token::type::whitespace, input_span{ pos++, 1 } });
+
+		} else if (n_input[pos] == '[') {
+
+			flat_token variant{ flat_token::type::variant, input_span{ n_result.m_options.size(), 0 } };
+
+			// One or more options separated by pipes, closed by a bracket
+			do {
+				const std::size_t option = ++pos;
+				while ((pos < size) && is_option(n_input[pos])) {
+					pos++;
+				}
+
+				if (pos == option) {
+					BOOST_THROW_EXCEPTION(serialization_error() << error_message("Cannot parse input string")
+					            << error_argument(n_input.to_string()));
+				}
+
+				n_result.m_options.push_back(input_span{ option, pos - option });
+				variant.m_span.m_size++;
+
+			} while ((pos < size) && (n_input[pos] == '|'));
+
+			if ((pos >= size) || (n_input[pos] != ']')) {
+				BOOST_THROW_EXCEPTION(serialization_error() << error_message("Cannot parse input string")
+				            << error_argument(n_input.to_string()));
+			}
+
+			pos++;
+			n_result.m_tokens.push_back(variant);
+
+		} else if (is_text(n_input[pos])) {
+
+			const std::size_t begin = pos;
+			while ((pos < size) && is_text(n_input[pos])) {
+				pos++;
+			}
+
+			n_result.m_tokens.push_back(flat_token{ flat_token::type::text, input_span{ begin, pos - begin } });
+
+		} else {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Cannot parse input string")
+			            << error_argument(n_input.to_string()));
+		}
+	}
+}
+
 } // namespace rescue
 } // namespace moose
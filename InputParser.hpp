@@ -6,7 +6,11 @@
 #include "RescueConfig.hpp"
 #include "Types.hpp"
 
+#include <boost/utility/string_view.hpp>
+
+#include <cstdint>
 #include <list>
+#include <vector>
 
 namespace moose {
 namespace rescue {
@@ -14,5 +18,44 @@ namespace rescue {
 //! @throw serialization_error
 std::list<token> RESCUE_API parse_input_string(const std::string &n_input);
 
+//! A part of the input, by offset and length
+struct input_span {
+	std::size_t m_offset;
+	std::size_t m_size;
+};
+
+/*! @brief A token as parse_input_flat() yields it
+
+	Text and whitespace refer to the input directly, a variant to its
+	options, which are m_size spans in flat_pattern::m_options from m_offset on.
+ */
+struct flat_token {
+
+	enum class type : std::uint8_t {
+		text,
+		whitespace,
+		variant
+	};
+
+	type        m_type;
+	input_span  m_span;
+};
+
+//! All tokens of an input string, in order, and the options of all variants
+struct flat_pattern {
+	std::vector<flat_token> m_tokens;
+	std::vector<input_span> m_options;
+};
+
+/*! @brief parse like parse_input_string() does, only flat
+
+	Yields the same tokens in a single pass without building a grammar
+	or copying the input. n_result is overwritten and keeps its capacity,
+	so parsing many lines into the same one doesn't allocate after a while.
+
+	@throw serialization_error
+ */
+void RESCUE_API parse_input_flat(const boost::string_view n_input, flat_pattern &n_result);
+
 } // namespace rescue
 } // namespace moose
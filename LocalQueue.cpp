@@ -0,0 +1,144 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "LocalQueue.hpp"
+#include "InputGenerator.hpp"
+#include "Checkpoint.hpp"
+
+#include "tools/Assert.hpp"
+
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+
+namespace moose {
+namespace rescue {
+
+/* What a worker sees of the local queue. Chunks only, candidates
+ * are generated by the workers themselves.
+ */
+class LocalQueue::Worker final : public WorkQueue {
+
+	public:
+		explicit Worker(LocalQueue &n_queue)
+		        : m_queue(n_queue) {
+		}
+
+		bool next(std::string &) override {
+
+			return false;
+		}
+
+		void result(const std::string &, const bool) override {
+		}
+
+		bool next(work_chunk &n_chunk) override {
+
+			work_chunk *chunk = nullptr;
+			if (m_queue.m_stopped.load() || !m_queue.m_chunks.pop(chunk)) {
+				return false;
+			}
+
+			n_chunk = std::move(*chunk);
+			delete chunk;
+			return true;
+		}
+
+		void result(const work_chunk &n_chunk, const bool n_success) override {
+
+			m_queue.m_done++;
+
+			// Found ones are not recorded, a restart should find it again
+			if (!n_success && m_queue.m_checkpoint) {
+				m_queue.m_checkpoint->done(n_chunk.m_pattern, n_chunk.m_begin, n_chunk.m_end);
+			}
+
+			if (n_success) {
+				m_queue.m_found.store(true);
+				m_queue.stop();
+			}
+		}
+
+		bool exhausted() const override {
+
+			// Everything was pushed before close(), so an empty queue after that stays empty
+			return m_queue.m_stopped.load() || (m_queue.m_closed.load() && m_queue.m_chunks.empty());
+		}
+
+	private:
+		LocalQueue &m_queue;
+};
+
+LocalQueue::LocalQueue(const std::size_t n_capacity, Checkpoint *n_checkpoint)
+        : m_chunks{ n_capacity }
+        , m_checkpoint{ n_checkpoint }
+        , m_closed{ false }
+        , m_stopped{ false }
+        , m_found{ false }
+        , m_done{ 0 } {
+
+	MOOSE_ASSERT((n_capacity > 0) && (n_capacity < 65535))
+}
+
+LocalQueue::~LocalQueue() noexcept {
+
+	m_chunks.consume_all([](work_chunk *n_chunk) { delete n_chunk; });
+}
+
+std::size_t LocalQueue::queue_pattern(const std::string &n_pattern, const std::uint64_t n_chunk_size) {
+
+	MOOSE_ASSERT(n_chunk_size > 0)
+
+	if (m_checkpoint && m_checkpoint->complete(n_pattern)) {
+		return 0;
+	}
+
+	const std::uint64_t size = count_permutations(n_pattern);
+	std::size_t count = 0;
+
+	for (std::uint64_t begin = 0; begin < size; ) {
+
+		std::unique_ptr<work_chunk> chunk{ new work_chunk };
+		chunk->m_pattern = n_pattern;
+		chunk->m_begin = begin;
+		chunk->m_end = begin + std::min(n_chunk_size, size - begin);
+		begin = chunk->m_end;
+
+		if (m_checkpoint && m_checkpoint->is_done(n_pattern, chunk->m_begin, chunk->m_end)) {
+			continue;
+		}
+
+		// Full means the workers are busy. Wait for them rather than pile up
+		while (!m_chunks.bounded_push(chunk.get())) {
+			if (m_stopped.load()) {
+				return count;
+			}
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+		}
+
+		chunk.release();
+		count++;
+	}
+
+	return count;
+}
+
+void LocalQueue::close() noexcept {
+
+	m_closed.store(true);
+}
+
+void LocalQueue::stop() noexcept {
+
+	m_stopped.store(true);
+	m_chunks.consume_all([](work_chunk *n_chunk) { delete n_chunk; });
+}
+
+std::unique_ptr<WorkQueue> LocalQueue::worker() {
+
+	return std::unique_ptr<WorkQueue>{ new Worker{ *this } };
+}
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,80 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+#include "WorkQueue.hpp"
+
+#include <boost/lockfree/queue.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace moose {
+namespace rescue {
+
+class Checkpoint;
+
+/*! @brief in process work queue for a single machine, no redis involved
+
+	Patterns are cut into chunks as queue_pattern() does for redis and handed
+	to the workers through a bounded lock free queue. Feeding blocks while it
+	is full, so patterns of any size are streamed rather than held in memory.
+
+	With a Checkpoint, chunks it has as done are skipped and those
+	that workers finish without success are recorded there.
+ */
+class LocalQueue final {
+
+	public:
+		/*! @brief an empty queue
+			@param n_capacity how many chunks may wait for workers, below 65535
+			@param n_checkpoint progress to resume from and record, must outlive the queue
+		 */
+		RESCUE_API explicit LocalQueue(const std::size_t n_capacity = 1024, Checkpoint *n_checkpoint = nullptr);
+
+		RESCUE_API ~LocalQueue() noexcept;
+
+		LocalQueue(const LocalQueue &) = delete;
+		LocalQueue &operator=(const LocalQueue &) = delete;
+
+		/*! @brief enter all permutations of a pattern, n_chunk_size candidates per chunk
+
+			Blocks while the queue is full and returns early when stopped.
+
+			@return the number of chunks that were entered, not counting those done before
+			@throw serialization_error on bad pattern
+		 */
+		RESCUE_API std::size_t queue_pattern(const std::string &n_pattern, const std::uint64_t n_chunk_size);
+
+		//! no more patterns will come. Workers are exhausted once they took what is left
+		RESCUE_API void close() noexcept;
+
+		//! drop whatever is queued, workers are exhausted right away
+		RESCUE_API void stop() noexcept;
+
+		//! @return a queue for one worker to lease chunks from
+		RESCUE_API std::unique_ptr<WorkQueue> worker();
+
+		//! true when a worker reported success
+		bool found() const noexcept { return m_found.load(); }
+
+		//! number of chunks workers returned results for
+		std::uint64_t chunks_done() const noexcept { return m_done.load(); }
+
+	private:
+		class Worker;
+
+		boost::lockfree::queue<work_chunk *, boost::lockfree::fixed_sized<true> > m_chunks;
+		Checkpoint                *m_checkpoint;
+		std::atomic<bool>          m_closed;
+		std::atomic<bool>          m_stopped;
+		std::atomic<bool>          m_found;
+		std::atomic<std::uint64_t> m_done;
+};
+
+} // namespace rescue
+} // namespace moose
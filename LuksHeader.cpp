@@ -0,0 +1,385 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "LuksHeader.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/endian/conversion.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace {
+
+/* On-disk layout of the LUKS1 header, everything big endian
+ *
+ * offset  size  field
+ *      0     6  magic "LUKS\xba\xbe"
+ *      6     2  version
+ *      8    32  cipher name
+ *     40    32  cipher mode
+ *     72    32  hash spec
+ *    104     4  payload offset
+ *    108     4  key bytes
+ *    112    20  master key digest
+ *    132    32  master key digest salt
+ *    164     4  master key digest iterations
+ *    168    40  uuid
+ *    208  8*48  key slots
+ *
+ * key slot
+ *      0     4  active, 0x00AC71F3 enabled, 0x0000DEAD disabled
+ *      4     4  iterations
+ *      8    32  salt
+ *     40     4  key material offset in sectors
+ *     44     4  stripes
+ */
+const std::size_t     luks_header_size    = 592;
+const std::size_t     luks_keyslot_offset = 208;
+const std::size_t     luks_keyslot_size   = 48;
+const boost::uint32_t luks_key_enabled    = 0x00AC71F3;
+const char            luks_magic[]        = { 'L', 'U', 'K', 'S', '\xba', '\xbe' };
+
+/* LUKS2 starts with a binary header of its own, followed by the JSON area.
+ * Only the fields we need, see the LUKS2 on-disk format specification
+ *
+ * offset  size  field
+ *      0     6  magic, same as LUKS1
+ *      6     2  version
+ *      8     8  header size, binary and JSON
+ *    168    40  uuid
+ */
+const std::size_t     luks2_binary_size   = 4096;
+const boost::uint64_t luks2_max_size      = 4 * 1024 * 1024;
+
+boost::uint32_t read_u32(const unsigned char *n_src) {
+
+	boost::uint32_t ret;
+	std::memcpy(&ret, n_src, sizeof(ret));
+	return boost::endian::big_to_native(ret);
+}
+
+boost::uint64_t read_u64(const unsigned char *n_src) {
+
+	boost::uint64_t ret;
+	std::memcpy(&ret, n_src, sizeof(ret));
+	return boost::endian::big_to_native(ret);
+}
+
+boost::uint16_t read_u16(const unsigned char *n_src) {
+
+	boost::uint16_t ret;
+	std::memcpy(&ret, n_src, sizeof(ret));
+	return boost::endian::big_to_native(ret);
+}
+
+//! Fixed size, zero padded string fields
+std::string read_string(const unsigned char *n_src, const std::size_t n_max) {
+
+	const unsigned char *end = std::find(n_src, n_src + n_max, '\0');
+	return std::string(reinterpret_cast<const char *>(n_src), end - n_src);
+}
+
+//! @throw serialization_error
+std::vector<boost::uint8_t> base64_decode(const std::string &n_input) {
+
+	using namespace boost::archive::iterators;
+	using decoder = transform_width<binary_from_base64<std::string::const_iterator>, 8, 6>;
+
+	// The decoder doesn't know about padding
+	std::string input{ n_input };
+	input.erase(std::remove(input.begin(), input.end(), '='), input.end());
+
+	try {
+		return std::vector<boost::uint8_t>(decoder(input.cbegin()), decoder(input.cend()));
+	} catch (const dataflow_exception &) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Invalid base64 in LUKS2 header")
+		            << error_argument(n_input));
+	}
+}
+
+//! Key slot kdf or digest object of a LUKS2 header. @throw serialization_error, pt::ptree_error
+luks_kdf read_kdf(const pt::ptree &n_node) {
+
+	luks_kdf ret;
+	ret.m_type = n_node.get<std::string>("type");
+
+	if (ret.m_type == "pbkdf2") {
+		ret.m_hash        = n_node.get<std::string>("hash");
+		ret.m_iterations  = n_node.get<boost::uint32_t>("iterations");
+	} else if ((ret.m_type == "argon2i") || (ret.m_type == "argon2id")) {
+		ret.m_iterations  = n_node.get<boost::uint32_t>("time");
+		ret.m_memory_kb   = n_node.get<boost::uint32_t>("memory");
+		ret.m_parallelism = n_node.get<boost::uint32_t>("cpus");
+	} else {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported key derivation")
+		            << error_argument(ret.m_type));
+	}
+
+	ret.m_salt = base64_decode(n_node.get<std::string>("salt"));
+	return ret;
+}
+
+luks_volume luks1_volume(const luks_header &n_header) {
+
+	luks_volume ret;
+	ret.m_version = n_header.m_version;
+	ret.m_uuid    = n_header.m_uuid;
+
+	// All LUKS1 slots share the header's algorithms and digest
+	luks_kdf digest_kdf;
+	digest_kdf.m_type       = "pbkdf2";
+	digest_kdf.m_hash       = n_header.m_hash_spec;
+	digest_kdf.m_iterations = n_header.m_mk_digest_iterations;
+	digest_kdf.m_salt.assign(n_header.m_mk_digest_salt.begin(), n_header.m_mk_digest_salt.end());
+
+	for (std::size_t i = 0; i < n_header.m_keyslots.size(); i++) {
+		const luks_keyslot &keyslot = n_header.m_keyslots[i];
+		if (!keyslot.m_active) {
+			continue;
+		}
+
+		luks_slot slot;
+		slot.m_index             = i;
+		slot.m_kdf.m_type        = "pbkdf2";
+		slot.m_kdf.m_hash        = n_header.m_hash_spec;
+		slot.m_kdf.m_iterations  = keyslot.m_iterations;
+		slot.m_kdf.m_salt.assign(keyslot.m_salt.begin(), keyslot.m_salt.end());
+		slot.m_cipher            = n_header.m_cipher_name + "-" + n_header.m_cipher_mode;
+		slot.m_area_key_bytes    = n_header.m_key_bytes;
+		slot.m_area_offset       = static_cast<boost::uint64_t>(keyslot.m_key_material_offset) * 512;
+		slot.m_af_hash           = n_header.m_hash_spec;
+		slot.m_stripes           = keyslot.m_stripes;
+		slot.m_key_bytes         = n_header.m_key_bytes;
+		slot.m_digest_kdf        = digest_kdf;
+		slot.m_digest.assign(n_header.m_mk_digest.begin(), n_header.m_mk_digest.end());
+		ret.m_slots.push_back(std::move(slot));
+	}
+
+	return ret;
+}
+
+luks_volume read_luks2_volume(const fs::path &n_header_file) {
+
+	fs::ifstream ifile(n_header_file, std::ios::in | std::ios::binary);
+	if (!ifile) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot open LUKS header file")
+		            << error_argument(n_header_file.string()));
+	}
+
+	unsigned char raw[luks2_binary_size];
+	if (!ifile.read(reinterpret_cast<char *>(raw), luks2_binary_size)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("LUKS2 header file too short")
+		            << error_argument(n_header_file.string()));
+	}
+
+	const boost::uint64_t header_size = read_u64(raw + 8);
+	if ((header_size <= luks2_binary_size) || (header_size > luks2_max_size)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Invalid LUKS2 header size")
+		            << error_argument(header_size));
+	}
+
+	// The JSON area is zero padded
+	std::string json(static_cast<std::size_t>(header_size - luks2_binary_size), '\0');
+	if (!ifile.read(&json[0], json.size())) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("LUKS2 JSON area too short")
+		            << error_argument(n_header_file.string()));
+	}
+	json.resize(std::min(json.size(), json.find('\0')));
+
+	luks_volume ret;
+	ret.m_version = 2;
+	ret.m_uuid    = read_string(raw + 168, 40);
+
+	try {
+		pt::ptree tree;
+		std::istringstream is{ json };
+		pt::read_json(is, tree);
+
+		for (const pt::ptree::value_type &keyslot : tree.get_child("keyslots")) {
+
+			const pt::ptree &node = keyslot.second;
+			const std::string type = node.get<std::string>("type");
+			if (type != "luks2") {
+				BOOST_LOG_SEV(logger(), warning) << "Ignoring LUKS2 key slot " << keyslot.first << " of type " << type;
+				continue;
+			}
+
+			luks_slot slot;
+			slot.m_index     = boost::lexical_cast<std::size_t>(keyslot.first);
+			slot.m_key_bytes = node.get<boost::uint32_t>("key_size");
+			slot.m_kdf       = read_kdf(node.get_child("kdf"));
+
+			const pt::ptree &area = node.get_child("area");
+			const pt::ptree &af = node.get_child("af");
+			if ((area.get<std::string>("type") != "raw") || (af.get<std::string>("type") != "luks1")) {
+				BOOST_LOG_SEV(logger(), warning) << "Ignoring LUKS2 key slot " << keyslot.first << " with unsupported area or AF";
+				continue;
+			}
+
+			slot.m_cipher         = area.get<std::string>("encryption");
+			slot.m_area_key_bytes = area.get<boost::uint32_t>("key_size");
+			slot.m_area_offset    = area.get<boost::uint64_t>("offset");
+			slot.m_af_hash        = af.get<std::string>("hash");
+			slot.m_stripes        = af.get<boost::uint32_t>("stripes");
+
+			// The digest that covers this slot, there should be exactly one
+			bool has_digest = false;
+			for (const pt::ptree::value_type &digest : tree.get_child("digests")) {
+				for (const pt::ptree::value_type &ref : digest.second.get_child("keyslots")) {
+					if (ref.second.get_value<std::string>() == keyslot.first) {
+						slot.m_digest_kdf = read_kdf(digest.second);
+						slot.m_digest     = base64_decode(digest.second.get<std::string>("digest"));
+						has_digest = true;
+					}
+				}
+			}
+
+			if (!has_digest) {
+				BOOST_LOG_SEV(logger(), warning) << "Ignoring LUKS2 key slot " << keyslot.first << " without digest";
+				continue;
+			}
+
+			ret.m_slots.push_back(std::move(slot));
+		}
+
+	} catch (const pt::ptree_error &perr) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed LUKS2 header")
+		            << error_argument(perr.what()));
+	} catch (const boost::bad_lexical_cast &) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed LUKS2 key slot number"));
+	}
+
+	std::sort(ret.m_slots.begin(), ret.m_slots.end(), [](const luks_slot &n_lhs, const luks_slot &n_rhs) {
+		return n_lhs.m_index < n_rhs.m_index;
+	});
+
+	return ret;
+}
+
+} // anon namespace
+
+luks_header read_luks_header(const fs::path &n_header_file) {
+
+	fs::ifstream ifile(n_header_file, std::ios::in | std::ios::binary);
+	if (!ifile) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot open LUKS header file")
+		            << error_argument(n_header_file.string()));
+	}
+
+	unsigned char raw[luks_header_size];
+	if (!ifile.read(reinterpret_cast<char *>(raw), luks_header_size)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("LUKS header file too short")
+		            << error_argument(n_header_file.string()));
+	}
+
+	if (std::memcmp(raw, luks_magic, sizeof(luks_magic)) != 0) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Not a LUKS header")
+		            << error_argument(n_header_file.string()));
+	}
+
+	luks_header ret;
+	ret.m_version = read_u16(raw + 6);
+	if (ret.m_version != 1) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported LUKS version")
+		            << error_argument(ret.m_version));
+	}
+
+	ret.m_cipher_name          = read_string(raw + 8, 32);
+	ret.m_cipher_mode          = read_string(raw + 40, 32);
+	ret.m_hash_spec            = read_string(raw + 72, 32);
+	ret.m_payload_offset       = read_u32(raw + 104);
+	ret.m_key_bytes            = read_u32(raw + 108);
+	std::copy(raw + 112, raw + 132, ret.m_mk_digest.begin());
+	std::copy(raw + 132, raw + 164, ret.m_mk_digest_salt.begin());
+	ret.m_mk_digest_iterations = read_u32(raw + 164);
+	ret.m_uuid                 = read_string(raw + 168, 40);
+
+	for (std::size_t i = 0; i < ret.m_keyslots.size(); i++) {
+		const unsigned char *src = raw + luks_keyslot_offset + i * luks_keyslot_size;
+		luks_keyslot &slot = ret.m_keyslots[i];
+
+		slot.m_active              = (read_u32(src) == luks_key_enabled);
+		slot.m_iterations          = read_u32(src + 4);
+		std::copy(src + 8, src + 40, slot.m_salt.begin());
+		slot.m_key_material_offset = read_u32(src + 40);
+		slot.m_stripes             = read_u32(src + 44);
+	}
+
+	return ret;
+}
+
+luks_volume read_luks_volume(const fs::path &n_header_file) {
+
+	// Both versions start with the same magic and version
+	fs::ifstream ifile(n_header_file, std::ios::in | std::ios::binary);
+	if (!ifile) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot open LUKS header file")
+		            << error_argument(n_header_file.string()));
+	}
+
+	unsigned char raw[8];
+	if (!ifile.read(reinterpret_cast<char *>(raw), sizeof(raw)) || (std::memcmp(raw, luks_magic, sizeof(luks_magic)) != 0)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Not a LUKS header")
+		            << error_argument(n_header_file.string()));
+	}
+
+	const boost::uint16_t version = read_u16(raw + 6);
+	switch (version) {
+		case 1:
+			return luks1_volume(read_luks_header(n_header_file));
+		case 2:
+			return read_luks2_volume(n_header_file);
+		default:
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported LUKS version")
+			            << error_argument(version));
+	}
+}
+
+std::vector<boost::uint8_t> read_key_material(const fs::path &n_header_file, const luks_slot &n_slot) {
+
+	fs::ifstream ifile(n_header_file, std::ios::in | std::ios::binary);
+	if (!ifile) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot open LUKS header file")
+		            << error_argument(n_header_file.string()));
+	}
+
+	// Both come straight from the header. Don't let a broken one have us allocate gigabytes
+	if ((n_slot.m_key_bytes > luks_max_key_bytes) || (n_slot.m_stripes > luks_max_stripes)) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Key slot size beyond cryptsetup limits")
+		            << error_argument(n_slot.m_index));
+	}
+
+	// The key material is encrypted in whole sectors, so that's what we read
+	const std::size_t size = static_cast<std::size_t>(n_slot.m_key_bytes) * n_slot.m_stripes;
+	std::vector<boost::uint8_t> ret(((size + 511) / 512) * 512);
+
+	ifile.seekg(static_cast<std::streamoff>(n_slot.m_area_offset));
+	if (!ifile.read(reinterpret_cast<char *>(ret.data()), ret.size())) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot read key material")
+		            << error_argument(n_header_file.string()));
+	}
+
+	return ret;
+}
+
+} // namespace rescue
+} // namespace moose
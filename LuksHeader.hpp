@@ -0,0 +1,116 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+
+#include <array>
+#include <vector>
+#include <string>
+
+namespace moose {
+namespace rescue {
+
+/*! @brief One of the 8 key slots of a LUKS1 header
+	See the LUKS1 on-disk format specification for details
+ */
+struct luks_keyslot {
+	bool                            m_active = false;
+	boost::uint32_t                 m_iterations = 0;           //!< PBKDF2 iterations for this slot
+	std::array<boost::uint8_t, 32>  m_salt;
+	boost::uint32_t                 m_key_material_offset = 0;  //!< in 512 byte sectors from the start of the header
+	boost::uint32_t                 m_stripes = 0;              //!< AF stripes, usually 4000
+};
+
+/*! @brief The binary LUKS1 header, converted to host byte order
+ */
+struct luks_header {
+	boost::uint16_t                 m_version = 0;
+	std::string                     m_cipher_name;              //!< e.g. "aes"
+	std::string                     m_cipher_mode;              //!< e.g. "xts-plain64" or "cbc-essiv:sha256"
+	std::string                     m_hash_spec;                //!< e.g. "sha256"
+	boost::uint32_t                 m_payload_offset = 0;
+	boost::uint32_t                 m_key_bytes = 0;            //!< master key length
+	std::array<boost::uint8_t, 20>  m_mk_digest;
+	std::array<boost::uint8_t, 32>  m_mk_digest_salt;
+	boost::uint32_t                 m_mk_digest_iterations = 0;
+	std::string                     m_uuid;
+	std::array<luks_keyslot, 8>     m_keyslots;
+};
+
+/*! @brief How a key slot derives its key from the password.
+	Also used for the master key digest, which is always pbkdf2
+ */
+struct luks_kdf {
+	std::string                     m_type;                     //!< "pbkdf2", "argon2i" or "argon2id"
+	std::string                     m_hash;                     //!< pbkdf2 only, e.g. "sha256"
+	boost::uint32_t                 m_iterations = 0;           //!< pbkdf2 iterations or argon2 time cost
+	boost::uint32_t                 m_memory_kb = 0;            //!< argon2 only
+	boost::uint32_t                 m_parallelism = 0;          //!< argon2 only
+	std::vector<boost::uint8_t>     m_salt;
+};
+
+/*! @brief An active key slot of either LUKS version, with all it takes to open it
+ */
+struct luks_slot {
+	std::size_t                     m_index = 0;                //!< as numbered in the header
+	luks_kdf                        m_kdf;
+	std::string                     m_cipher;                   //!< for the key material, e.g. "aes-xts-plain64"
+	boost::uint32_t                 m_area_key_bytes = 0;       //!< key size for m_cipher, which is what m_kdf derives
+	boost::uint64_t                 m_area_offset = 0;          //!< key material, in bytes from the start of the header
+	std::string                     m_af_hash;
+	boost::uint32_t                 m_stripes = 0;
+	boost::uint32_t                 m_key_bytes = 0;            //!< master key length
+	luks_kdf                        m_digest_kdf;               //!< to check the master key
+	std::vector<boost::uint8_t>     m_digest;
+};
+
+//! cryptsetup always splits keys into 4000 stripes
+const boost::uint32_t luks_max_stripes   = 4000;
+
+//! the longest keys in use are 64 bytes (aes-xts-plain64 with 512 bits), this leaves plenty of room
+const boost::uint32_t luks_max_key_bytes = 512;
+
+/*! @brief What we need of a LUKS1 or LUKS2 header
+ */
+struct luks_volume {
+	boost::uint16_t                 m_version = 0;
+	std::string                     m_uuid;
+	std::vector<luks_slot>          m_slots;                    //!< active ones only, ordered by index
+};
+
+//! Key slot selection: try all active slots, cheapest first
+const int any_key_slot = -1;
+
+//! Key slot selection: only try the cheapest active slot
+const int cheapest_key_slot = -2;
+
+/*! @brief read and check a LUKS1 header from a file (or device)
+	@throw serialization_error when this is not a LUKS1 header
+	@throw internal_error when the file cannot be read
+ */
+luks_header RESCUE_API read_luks_header(const boost::filesystem::path &n_header_file);
+
+/*! @brief read a LUKS1 or LUKS2 header from a file (or device)
+
+	LUKS2 key slots we cannot open, like those used during reencryption
+	or such without a digest, are left out.
+
+	@throw serialization_error when this is no LUKS header we understand
+	@throw internal_error when the file cannot be read
+ */
+luks_volume RESCUE_API read_luks_volume(const boost::filesystem::path &n_header_file);
+
+/*! @brief read the encrypted, AF split key material of a key slot
+	The result is rounded up to whole 512 byte sectors
+	@throw serialization_error when the slot's key size or stripes are beyond the limits above
+	@throw internal_error when the file cannot be read
+ */
+std::vector<boost::uint8_t> RESCUE_API read_key_material(const boost::filesystem::path &n_header_file, const luks_slot &n_slot);
+
+} // namespace rescue
+} // namespace moose
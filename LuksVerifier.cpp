@@ -0,0 +1,527 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "LuksVerifier.hpp"
+#include "Pbkdf2.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#include <argon2.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::size_t sector_size = 512;
+
+enum class iv_mode {
+	none,      //!< ecb
+	plain,     //!< 32 bit little endian sector number
+	plain64,   //!< 64 bit little endian sector number
+	essiv      //!< sector number encrypted with the hash of the key
+};
+
+struct cipher_ctx_deleter {
+	void operator()(EVP_CIPHER_CTX *n_ctx) const noexcept { EVP_CIPHER_CTX_free(n_ctx); }
+};
+using cipher_ctx_ptr = std::unique_ptr<EVP_CIPHER_CTX, cipher_ctx_deleter>;
+
+//! @throw serialization_error
+const EVP_MD *lookup_digest(const std::string &n_name) {
+
+	const EVP_MD *ret = EVP_get_digestbyname(n_name.c_str());
+	if (!ret) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported hash")
+		            << error_argument(n_name));
+	}
+	return ret;
+}
+
+//! @throw serialization_error
+const EVP_CIPHER *lookup_cipher(const std::string &n_name, const std::size_t n_key_bits, const std::string &n_mode) {
+
+	const std::string name = n_name + "-" + boost::lexical_cast<std::string>(n_key_bits) + "-" + n_mode;
+	const EVP_CIPHER *ret = EVP_get_cipherbyname(name.c_str());
+	if (!ret) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported cipher")
+		            << error_argument(name));
+	}
+	return ret;
+}
+
+void hash(const EVP_MD *n_md, const boost::uint8_t *n_src, const std::size_t n_size, boost::uint8_t *n_digest) {
+
+	if (EVP_Digest(n_src, n_size, n_digest, nullptr, n_md, nullptr) != 1) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Hash calculation failed"));
+	}
+}
+
+void pbkdf2(const EVP_MD *n_md, const void *n_password, const std::size_t n_password_size,
+            const boost::uint8_t *n_salt, const std::size_t n_salt_size, const boost::uint32_t n_iterations,
+            boost::uint8_t *n_key, const std::size_t n_key_size) {
+
+	if (PKCS5_PBKDF2_HMAC(static_cast<const char *>(n_password), static_cast<int>(n_password_size),
+	                      n_salt, static_cast<int>(n_salt_size), static_cast<int>(n_iterations),
+	                      n_md, static_cast<int>(n_key_size), n_key) != 1) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("PBKDF2 failed"));
+	}
+}
+
+/* The AF diffuser as specified in LUKS1, hashes the block in digest sized
+ * pieces, each prefixed with its big endian index.
+ */
+void diffuse(const EVP_MD *n_md, boost::uint8_t *n_block, const std::size_t n_size) {
+
+	const std::size_t digest_size = static_cast<std::size_t>(EVP_MD_size(n_md));
+	boost::uint8_t digest[EVP_MAX_MD_SIZE];
+
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	for (std::size_t i = 0, offset = 0; offset < n_size; i++, offset += digest_size) {
+
+		const std::size_t piece = std::min(digest_size, n_size - offset);
+		const boost::uint8_t iv[4] = {
+			static_cast<boost::uint8_t>(i >> 24), static_cast<boost::uint8_t>(i >> 16),
+			static_cast<boost::uint8_t>(i >> 8),  static_cast<boost::uint8_t>(i)
+		};
+
+		EVP_DigestInit_ex(ctx, n_md, nullptr);
+		EVP_DigestUpdate(ctx, iv, sizeof(iv));
+		EVP_DigestUpdate(ctx, n_block + offset, piece);
+		EVP_DigestFinal_ex(ctx, digest, nullptr);
+
+		std::memcpy(n_block + offset, digest, piece);
+	}
+	EVP_MD_CTX_free(ctx);
+}
+
+/* AF merge as specified in LUKS1. n_split is n_stripes blocks of n_size bytes
+ */
+void af_merge(const EVP_MD *n_md, const boost::uint8_t *n_split, const std::size_t n_size,
+              const std::size_t n_stripes, boost::uint8_t *n_key) {
+
+	std::vector<boost::uint8_t> block(n_size, 0);
+
+	for (std::size_t s = 0; s < n_stripes - 1; s++) {
+		const boost::uint8_t *stripe = n_split + s * n_size;
+		for (std::size_t i = 0; i < n_size; i++) {
+			block[i] ^= stripe[i];
+		}
+		diffuse(n_md, block.data(), n_size);
+	}
+
+	const boost::uint8_t *last = n_split + (n_stripes - 1) * n_size;
+	for (std::size_t i = 0; i < n_size; i++) {
+		n_key[i] = block[i] ^ last[i];
+	}
+}
+
+/* Key material encryption as named in a key slot, e.g. "aes-xts-plain64"
+ * or "aes-cbc-essiv:sha256". Resolved once, used for every attempt.
+ */
+class Cipher {
+
+	public:
+		//! @throw serialization_error when we don't support it
+		Cipher(const std::string &n_spec, const std::size_t n_key_bytes);
+
+		//! decrypt whole sectors, numbered from 0
+		void decrypt(const boost::uint8_t *n_key, const boost::uint8_t *n_src, const std::size_t n_size, boost::uint8_t *n_dst) const;
+
+	private:
+		const EVP_CIPHER *m_cipher       = nullptr;
+		iv_mode           m_iv_mode      = iv_mode::none;
+		const EVP_MD     *m_essiv_hash   = nullptr;
+		const EVP_CIPHER *m_essiv_cipher = nullptr;
+};
+
+Cipher::Cipher(const std::string &n_spec, const std::size_t n_key_bytes) {
+
+	// cipher spec looks like "aes-xts-plain64" or "aes-cbc-essiv:sha256" or just "aes-ecb"
+	const std::string::size_type first_dash = n_spec.find('-');
+	if (first_dash == std::string::npos) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported cipher")
+		            << error_argument(n_spec));
+	}
+
+	const std::string name = n_spec.substr(0, first_dash);
+	const std::string::size_type dash = n_spec.find('-', first_dash + 1);
+	const std::string mode = n_spec.substr(first_dash + 1, dash - first_dash - 1);
+	const std::string iv_spec = (dash == std::string::npos) ? std::string{} : n_spec.substr(dash + 1);
+
+	// XTS keys are two keys of half the size
+	const std::size_t key_bits = n_key_bytes * 8 / ((mode == "xts") ? 2 : 1);
+	m_cipher = lookup_cipher(name, key_bits, mode);
+
+	if (static_cast<std::size_t>(EVP_CIPHER_key_length(m_cipher)) != n_key_bytes) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Key size doesn't match cipher")
+		            << error_argument(n_key_bytes));
+	}
+
+	if (iv_spec.empty()) {
+		m_iv_mode = iv_mode::none;
+	} else if (iv_spec == "plain") {
+		m_iv_mode = iv_mode::plain;
+	} else if (iv_spec == "plain64") {
+		m_iv_mode = iv_mode::plain64;
+	} else if (iv_spec.compare(0, 6, "essiv:") == 0) {
+		m_iv_mode = iv_mode::essiv;
+		m_essiv_hash = lookup_digest(iv_spec.substr(6));
+		m_essiv_cipher = lookup_cipher(name, static_cast<std::size_t>(EVP_MD_size(m_essiv_hash)) * 8, "ecb");
+	} else {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported IV mode")
+		            << error_argument(iv_spec));
+	}
+}
+
+void Cipher::decrypt(const boost::uint8_t *n_key, const boost::uint8_t *n_src, const std::size_t n_size, boost::uint8_t *n_dst) const {
+
+	MOOSE_ASSERT((n_size % sector_size) == 0)
+
+	cipher_ctx_ptr ctx{ EVP_CIPHER_CTX_new() };
+	cipher_ctx_ptr essiv_ctx;
+
+	if (m_iv_mode == iv_mode::essiv) {
+		// ESSIV encrypts the sector number with the hash of the key
+		boost::uint8_t salt[EVP_MAX_MD_SIZE];
+		hash(m_essiv_hash, n_key, static_cast<std::size_t>(EVP_CIPHER_key_length(m_cipher)), salt);
+
+		essiv_ctx.reset(EVP_CIPHER_CTX_new());
+		EVP_EncryptInit_ex(essiv_ctx.get(), m_essiv_cipher, nullptr, salt, nullptr);
+		EVP_CIPHER_CTX_set_padding(essiv_ctx.get(), 0);
+	}
+
+	// Key is set once, IV per sector
+	EVP_DecryptInit_ex(ctx.get(), m_cipher, nullptr, n_key, nullptr);
+	EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+
+	for (std::size_t offset = 0; offset < n_size; offset += sector_size) {
+
+		const boost::uint64_t sector = offset / sector_size;
+		boost::uint8_t iv[16] = { 0 };
+
+		const std::size_t iv_bytes = (m_iv_mode == iv_mode::plain) ? 4 : 8;
+		for (std::size_t i = 0; i < iv_bytes; i++) {
+			iv[i] = static_cast<boost::uint8_t>(sector >> (8 * i));
+		}
+
+		if (m_iv_mode == iv_mode::essiv) {
+			int len = 0;
+			boost::uint8_t encrypted_iv[16 + EVP_MAX_BLOCK_LENGTH];
+			EVP_EncryptUpdate(essiv_ctx.get(), encrypted_iv, &len, iv, EVP_CIPHER_block_size(m_essiv_cipher));
+			std::memcpy(iv, encrypted_iv, sizeof(iv));
+		}
+
+		int len = 0;
+		if ((EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, nullptr, (m_iv_mode == iv_mode::none) ? nullptr : iv) != 1)
+		        || (EVP_DecryptUpdate(ctx.get(), n_dst + offset, &len, n_src + offset, static_cast<int>(sector_size)) != 1)) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Key material decryption failed"));
+		}
+	}
+}
+
+/* A key derivation with its parameters, resolved once.
+ * PBKDF2 uses the SIMD kernels where we have them, libcrypto otherwise.
+ * Argon2 goes through libargon2, one password after the other.
+ */
+class Kdf {
+
+	public:
+		//! @throw serialization_error when we don't support it
+		explicit Kdf(const luks_kdf &n_kdf);
+
+		//! n_key_size bytes for each of n_passwords
+		void derive(const std::vector<std::string> &n_passwords, const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys) const;
+
+		std::size_t batch_size() const noexcept {
+
+			return m_pbkdf2 ? pbkdf2_lanes(*m_pbkdf2) : 1;
+		}
+
+		boost::uint64_t memory_cost() const noexcept {
+
+			return static_cast<boost::uint64_t>(m_params.m_memory_kb) * 1024;
+		}
+
+		//! @return seconds per password for keys of n_key_size, from a scaled down run
+		double estimate_seconds(const std::size_t n_key_size) const;
+
+	private:
+		const luks_kdf                m_params;
+		const EVP_MD                 *m_md = nullptr;   //!< pbkdf2 only
+		boost::optional<pbkdf2_hash>  m_pbkdf2;         //!< SIMD kernel for m_md, if we have one
+		argon2_type                   m_argon2_type = Argon2_id;
+};
+
+Kdf::Kdf(const luks_kdf &n_kdf)
+        : m_params{ n_kdf } {
+
+	if (m_params.m_type == "pbkdf2") {
+		m_md = lookup_digest(m_params.m_hash);
+		m_pbkdf2 = pbkdf2_hash_by_name(m_params.m_hash);
+	} else if (m_params.m_type == "argon2i") {
+		m_argon2_type = Argon2_i;
+	} else if (m_params.m_type == "argon2id") {
+		m_argon2_type = Argon2_id;
+	} else {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported key derivation")
+		            << error_argument(m_params.m_type));
+	}
+}
+
+void Kdf::derive(const std::vector<std::string> &n_passwords, const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys) const {
+
+	if (m_pbkdf2) {
+		pbkdf2_batch(*m_pbkdf2, n_passwords, m_params.m_salt.data(), m_params.m_salt.size(), m_params.m_iterations, n_key_size, n_keys);
+		return;
+	}
+
+	n_keys.resize(n_passwords.size() * n_key_size);
+	for (std::size_t i = 0; i < n_passwords.size(); i++) {
+
+		if (m_md) {
+			// Hashes we have no kernel for go through libcrypto one by one
+			pbkdf2(m_md, n_passwords[i].data(), n_passwords[i].size(), m_params.m_salt.data(), m_params.m_salt.size(),
+			       m_params.m_iterations, n_keys.data() + i * n_key_size, n_key_size);
+			continue;
+		}
+
+		// LUKS2 uses Argon2 version 1.3
+		const int ret = argon2_hash(m_params.m_iterations, m_params.m_memory_kb, m_params.m_parallelism,
+		                            n_passwords[i].data(), n_passwords[i].size(), m_params.m_salt.data(), m_params.m_salt.size(),
+		                            n_keys.data() + i * n_key_size, n_key_size, nullptr, 0, m_argon2_type, ARGON2_VERSION_13);
+		if (ret != ARGON2_OK) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Argon2 failed")
+			            << error_argument(argon2_error_message(ret)));
+		}
+	}
+}
+
+double Kdf::estimate_seconds(const std::size_t n_key_size) const {
+
+	// Small enough to take milliseconds, large enough to measure
+	const boost::uint32_t probe_iterations = 10000;
+	const boost::uint32_t probe_memory_kb  = 16 * 1024;
+
+	luks_kdf probe{ m_params };
+	double scale = 1.0;
+	if (m_md) {
+		probe.m_iterations = std::min(m_params.m_iterations, probe_iterations);
+		scale = static_cast<double>(m_params.m_iterations) / probe.m_iterations;
+	} else {
+		// Argon2 needs at least 8 KiB per thread
+		probe.m_iterations = 1;
+		probe.m_memory_kb  = std::max(std::min(m_params.m_memory_kb, probe_memory_kb), 8 * std::max(m_params.m_parallelism, 1u));
+		scale = static_cast<double>(m_params.m_iterations) * m_params.m_memory_kb / probe.m_memory_kb;
+	}
+
+	// A full batch, as the workers will do it
+	const std::vector<std::string> passwords(batch_size(), "estimate");
+	std::vector<boost::uint8_t> keys;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Kdf{ probe }.derive(passwords, n_key_size, keys);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	return elapsed.count() * scale / passwords.size();
+}
+
+} // anon namespace
+
+//! A key slot with its algorithms resolved and its key material loaded
+struct LuksVerifier::Slot {
+
+	Slot(const luks_slot &n_info, std::vector<boost::uint8_t> &&n_key_material)
+	        : m_info{ n_info }
+	        , m_kdf{ n_info.m_kdf }
+	        , m_cipher{ n_info.m_cipher, n_info.m_area_key_bytes }
+	        , m_af_hash{ lookup_digest(n_info.m_af_hash) }
+	        , m_digest_kdf{ n_info.m_digest_kdf }
+	        , m_key_material{ std::move(n_key_material) } {
+	}
+
+	const luks_slot                    &m_info;
+	const Kdf                           m_kdf;
+	const Cipher                        m_cipher;
+	const EVP_MD                       *m_af_hash;
+	const Kdf                           m_digest_kdf;
+	const std::vector<boost::uint8_t>   m_key_material;
+};
+
+LuksVerifier::LuksVerifier(const fs::path &n_header_file, const std::vector<std::size_t> &n_slots)
+        : m_volume{ read_luks_volume(n_header_file) } {
+
+	// The slots to try, in order
+	std::vector<const luks_slot *> selected;
+	if (n_slots.empty()) {
+		for (const luks_slot &slot : m_volume.m_slots) {
+			selected.push_back(&slot);
+		}
+	} else {
+		for (const std::size_t index : n_slots) {
+			const std::vector<luks_slot>::const_iterator i = std::find_if(m_volume.m_slots.cbegin(), m_volume.m_slots.cend(),
+			        [index](const luks_slot &n_slot) { return n_slot.m_index == index; });
+
+			if (i == m_volume.m_slots.cend()) {
+				BOOST_THROW_EXCEPTION(internal_error() << error_message("Key slot is not active")
+				            << error_argument(index));
+			}
+			selected.push_back(&*i);
+		}
+	}
+
+	// Resolve the algorithms and load the key material of those slots once
+	for (const luks_slot *selected_slot : selected) {
+
+		const luks_slot &slot = *selected_slot;
+
+		if ((slot.m_stripes == 0) || (slot.m_key_bytes == 0)) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Key slot without stripes")
+			            << error_argument(slot.m_index));
+		}
+
+		// We allocate by these for every batch of passwords
+		if ((slot.m_stripes > luks_max_stripes) || (slot.m_key_bytes > luks_max_key_bytes)
+		        || (slot.m_area_key_bytes == 0) || (slot.m_area_key_bytes > luks_max_key_bytes)) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Key slot size beyond cryptsetup limits")
+			            << error_argument(slot.m_index));
+		}
+
+		if (slot.m_digest.empty() || (slot.m_digest_kdf.m_type != "pbkdf2")) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Unsupported master key digest")
+			            << error_argument(slot.m_index));
+		}
+
+		m_slots.emplace_back(new Slot{ slot, read_key_material(n_header_file, slot) });
+	}
+
+	if (m_slots.empty()) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("LUKS header has no active key slot")
+		            << error_argument(n_header_file.string()));
+	}
+
+	BOOST_LOG_SEV(logger(), normal) << "Native verifier ready for LUKS" << m_volume.m_version << " with "
+	        << m_slots.size() << " key slots to try, " << batch_size() << " passwords at once using the "
+	        << to_string(cpu_simd_level()) << " PBKDF2 kernel";
+}
+
+LuksVerifier::~LuksVerifier() noexcept {
+}
+
+bool LuksVerifier::verify(const std::string &n_password) const {
+
+	return static_cast<bool>(verify(std::vector<std::string>{ n_password }));
+}
+
+boost::optional<std::size_t> LuksVerifier::verify(const std::vector<std::string> &n_passwords) const {
+
+	if (n_passwords.empty()) {
+		return boost::none;
+	}
+
+	for (const std::unique_ptr<Slot> &slot : m_slots) {
+		const boost::optional<std::size_t> found = verify_slot(*slot, n_passwords);
+		if (found) {
+			BOOST_LOG_SEV(logger(), normal) << "Key slot " << slot->m_info.m_index << " opened";
+			return found;
+		}
+	}
+
+	return boost::none;
+}
+
+std::size_t LuksVerifier::batch_size() const noexcept {
+
+	std::size_t ret = 1;
+	for (const std::unique_ptr<Slot> &slot : m_slots) {
+		ret = std::max(ret, slot->m_kdf.batch_size());
+	}
+	return ret;
+}
+
+boost::uint64_t LuksVerifier::memory_cost() const noexcept {
+
+	// Slots are tried one after the other, so the most expensive one counts
+	boost::uint64_t ret = 0;
+	for (const std::unique_ptr<Slot> &slot : m_slots) {
+		ret = std::max(ret, slot->m_kdf.memory_cost());
+	}
+	return ret;
+}
+
+boost::optional<std::size_t> LuksVerifier::verify_slot(const Slot &n_slot, const std::vector<std::string> &n_passwords) const {
+
+	const luks_slot &slot = n_slot.m_info;
+	const std::size_t area_key_size = slot.m_area_key_bytes;
+	const std::size_t key_size = slot.m_key_bytes;
+	const std::size_t digest_size = slot.m_digest.size();
+
+	// Derive the keys that unlock the slot's key material, all at once. This is where the time goes
+	std::vector<boost::uint8_t> derived_keys;
+	n_slot.m_kdf.derive(n_passwords, area_key_size, derived_keys);
+
+	// Decrypt and merge the stripes into candidate master keys
+	std::vector<boost::uint8_t> split(n_slot.m_key_material.size());
+	std::vector<std::string> master_keys(n_passwords.size(), std::string(key_size, '\0'));
+	for (std::size_t i = 0; i < n_passwords.size(); i++) {
+		n_slot.m_cipher.decrypt(derived_keys.data() + i * area_key_size, n_slot.m_key_material.data(), split.size(), split.data());
+		af_merge(n_slot.m_af_hash, split.data(), key_size, slot.m_stripes, reinterpret_cast<boost::uint8_t *>(&master_keys[i][0]));
+	}
+
+	// And check those against the digest, which is another PBKDF2 run
+	std::vector<boost::uint8_t> digests;
+	n_slot.m_digest_kdf.derive(master_keys, digest_size, digests);
+
+	boost::optional<std::size_t> ret;
+	for (std::size_t i = 0; i < n_passwords.size(); i++) {
+		if (CRYPTO_memcmp(digests.data() + i * digest_size, slot.m_digest.data(), digest_size) == 0) {
+			ret = i;
+			break;
+		}
+	}
+
+	OPENSSL_cleanse(derived_keys.data(), derived_keys.size());
+	OPENSSL_cleanse(split.data(), split.size());
+	for (std::string &master_key : master_keys) {
+		OPENSSL_cleanse(&master_key[0], master_key.size());
+	}
+
+	return ret;
+}
+
+std::vector<luks_slot_cost> estimate_slot_costs(const luks_volume &n_volume) {
+
+	std::vector<luks_slot_cost> ret;
+	for (const luks_slot &slot : n_volume.m_slots) {
+
+		// Every attempt also checks the master key digest
+		const double seconds = Kdf{ slot.m_kdf }.estimate_seconds(slot.m_area_key_bytes)
+		        + Kdf{ slot.m_digest_kdf }.estimate_seconds(slot.m_digest.size());
+
+		ret.push_back(luks_slot_cost{ slot.m_index, seconds });
+	}
+
+	std::stable_sort(ret.begin(), ret.end(), [](const luks_slot_cost &n_lhs, const luks_slot_cost &n_rhs) {
+		return n_lhs.m_seconds < n_rhs.m_seconds;
+	});
+
+	return ret;
+}
+
+} // namespace rescue
+} // namespace moose
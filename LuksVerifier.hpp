@@ -0,0 +1,90 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+#include "LuksHeader.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/optional.hpp>
+
+#include <memory>
+#include <vector>
+#include <string>
+
+namespace moose {
+namespace rescue {
+
+/*! @brief Check passwords against a LUKS1 or LUKS2 header without libcryptsetup
+
+	Does what libcryptsetup does when opening a key slot, minus the activation:
+	PBKDF2 or Argon2 on the slot's salt, decrypt the slot's key material, AF
+	merge it and compare the resulting master key's digest against the header.
+
+	Header and key material are read once on construction. After that
+	verify() is a pure CPU function which needs no privileges and may be
+	called from any number of threads at once.
+
+	For PBKDF2 with SHA-1, SHA-256 and SHA-512, batches of passwords are run
+	through it together in SIMD lanes, see pbkdf2_batch(). Argon2 is memory
+	hard and takes memory_cost() bytes for each attempt.
+ */
+class LuksVerifier final {
+
+	public:
+		/*! @brief read header and key material
+			@param n_slots key slots to try, in this order. All active ones if empty
+			@throw serialization_error when the header or its cipher is not supported
+			@throw internal_error when the file cannot be read or a slot in n_slots isn't active
+		 */
+		RESCUE_API explicit LuksVerifier(const boost::filesystem::path &n_header_file,
+		                                 const std::vector<std::size_t> &n_slots = std::vector<std::size_t>());
+		RESCUE_API ~LuksVerifier() noexcept;
+
+		LuksVerifier(const LuksVerifier &) = delete;
+		LuksVerifier &operator=(const LuksVerifier &) = delete;
+
+		//! @return true when n_password opens any of the active key slots
+		RESCUE_API bool verify(const std::string &n_password) const;
+
+		//! @return the index of a password that opens one of the active key slots
+		RESCUE_API boost::optional<std::size_t> verify(const std::vector<std::string> &n_passwords) const;
+
+		//! @return how many passwords verify() should be given at once for best throughput
+		RESCUE_API std::size_t batch_size() const noexcept;
+
+		//! @return bytes of memory the key derivation needs for one attempt, 0 if next to none
+		RESCUE_API boost::uint64_t memory_cost() const noexcept;
+
+		const luks_volume &volume() const noexcept { return m_volume; }
+
+	private:
+		struct Slot;
+
+		boost::optional<std::size_t> verify_slot(const Slot &n_slot, const std::vector<std::string> &n_passwords) const;
+
+		const luks_volume                   m_volume;
+		std::vector<std::unique_ptr<Slot> > m_slots;      //!< algorithms resolved and key material loaded
+};
+
+//! What an attempt on a key slot costs
+struct luks_slot_cost {
+	std::size_t   m_index;
+	double        m_seconds;   //!< per password on this machine, batched where we can
+};
+
+/*! @brief estimate how long an attempt on each active key slot takes
+
+	Runs each slot's key derivation and digest once with reduced cost and
+	extrapolates. Both PBKDF2 and Argon2 are linear in their cost parameters.
+	This takes well under a second per slot.
+
+	@return all active slots, cheapest first
+	@throw serialization_error when a slot's KDF isn't supported
+ */
+std::vector<luks_slot_cost> RESCUE_API estimate_slot_costs(const luks_volume &n_volume);
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,110 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "MappedInput.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/interprocess/exceptions.hpp>
+
+#include <cstring>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+namespace bip = boost::interprocess;
+
+MappedInput::MappedInput(const boost::filesystem::path &n_file)
+        : m_data{ nullptr }
+        , m_size{ 0 } {
+
+	try {
+		// Empty files can't be mapped, they just have no lines
+		if (boost::filesystem::file_size(n_file) == 0) {
+			return;
+		}
+
+		m_file = bip::file_mapping{ n_file.c_str(), bip::read_only };
+		m_region = bip::mapped_region{ m_file, bip::read_only };
+		m_region.advise(bip::mapped_region::advice_sequential);
+
+		m_data = static_cast<const char *>(m_region.get_address());
+		m_size = m_region.get_size();
+
+	} catch (const bip::interprocess_exception &iex) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message(std::string("Cannot map input file: ") + iex.what())
+		            << error_argument(n_file.string()));
+	} catch (const boost::filesystem::filesystem_error &fex) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message(std::string("Cannot map input file: ") + fex.what())
+		            << error_argument(n_file.string()));
+	}
+
+	BOOST_LOG_SEV(logger(), debug) << "Mapped " << m_size << " bytes of " << n_file;
+}
+
+std::vector<input_range> MappedInput::split(const std::size_t n_parts) const {
+
+	std::vector<input_range> ranges;
+
+	input_range range;
+	for (std::size_t i = 1; (i <= n_parts) && (range.m_begin < m_size); i++) {
+
+		// Move the end of each part behind the next line end
+		std::size_t end = m_size;
+		if (i < n_parts) {
+			const std::size_t target = std::max(range.m_begin, m_size / n_parts * i);
+			const void *newline = std::memchr(m_data + target, '\n', m_size - target);
+			end = newline ? static_cast<const char *>(newline) - m_data + 1 : m_size;
+		}
+
+		// The last line may have no end
+		range.m_end = end;
+		range.m_lines = count_lines(range.m_begin, range.m_end) + ((m_data[end - 1] != '\n') ? 1 : 0);
+		ranges.push_back(range);
+
+		range.m_first_line += range.m_lines;
+		range.m_begin = end;
+	}
+
+	return ranges;
+}
+
+bool MappedInput::next_line(std::size_t &n_offset, const std::size_t n_end, boost::string_view &n_line) const noexcept {
+
+	if (n_offset >= n_end) {
+		return false;
+	}
+
+	const char *begin = m_data + n_offset;
+	const char *newline = static_cast<const char *>(std::memchr(begin, '\n', n_end - n_offset));
+	const char *end = newline ? newline : m_data + n_end;
+
+	n_offset = (newline ? newline + 1 : end) - m_data;
+
+	if ((end > begin) && (end[-1] == '\r')) {
+		--end;
+	}
+
+	n_line = boost::string_view{ begin, static_cast<std::size_t>(end - begin) };
+	return true;
+}
+
+std::uint64_t MappedInput::count_lines(const std::size_t n_begin, const std::size_t n_end) const noexcept {
+
+	std::uint64_t count = 0;
+	for (const char *pos = m_data + n_begin, *end = m_data + n_end; pos < end; count++) {
+		pos = static_cast<const char *>(std::memchr(pos, '\n', end - pos));
+		if (!pos) {
+			break;
+		}
+		pos++;
+	}
+
+	return count;
+}
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,69 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace moose {
+namespace rescue {
+
+//! A part of an input file made of whole lines
+struct input_range {
+	std::size_t   m_begin = 0;         //!< byte offset of the first line
+	std::size_t   m_end = 0;           //!< one past the end of the last line
+	std::uint64_t m_first_line = 0;    //!< number of lines before m_begin
+	std::uint64_t m_lines = 0;         //!< number of lines in the range
+};
+
+/*! @brief a text file mapped into memory and read line by line without copying
+
+	Lines are views into the mapping and valid as long as this is.
+	Line ends are found with memchr(), which the C library vectorizes.
+	Lines end with "\n" or "\r\n", the last one may have no end.
+ */
+class MappedInput final {
+
+	public:
+		//! @throw internal_error when the file can't be mapped
+		RESCUE_API explicit MappedInput(const boost::filesystem::path &n_file);
+
+		MappedInput(const MappedInput &) = delete;
+		MappedInput &operator=(const MappedInput &) = delete;
+
+		//! size of the file in bytes
+		std::size_t size() const noexcept { return m_size; }
+
+		/*! @brief split the file into up to n_parts ranges of about the same size
+			Each starts at the beginning of a line and ends after the end of one.
+			They are in order and cover the whole file.
+		 */
+		RESCUE_API std::vector<input_range> split(const std::size_t n_parts) const;
+
+		/*! @brief the line at n_offset, without its end
+			@param n_offset is moved to the start of the next line
+			@param n_end where the range ends, see input_range::m_end
+			@return false when n_offset has reached n_end
+		 */
+		RESCUE_API bool next_line(std::size_t &n_offset, const std::size_t n_end, boost::string_view &n_line) const noexcept;
+
+	private:
+		//! number of line ends in [n_begin, n_end)
+		std::uint64_t count_lines(const std::size_t n_begin, const std::size_t n_end) const noexcept;
+
+		boost::interprocess::file_mapping  m_file;
+		boost::interprocess::mapped_region m_region;
+		const char                        *m_data;
+		std::size_t                        m_size;
+};
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,314 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Pbkdf2.hpp"
+#include "Pbkdf2Kernel.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+
+namespace detail {
+
+void pbkdf2_iterate_scalar(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                           void *n_u, void *n_t, const boost::uint32_t n_iterations) {
+
+	switch (n_hash) {
+		case pbkdf2_hash::sha1:
+			iterate_lanes<sha1_traits, boost::uint32_t>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+		case pbkdf2_hash::sha256:
+			iterate_lanes<sha256_traits, boost::uint32_t>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+		case pbkdf2_hash::sha512:
+			iterate_lanes<sha512_traits, boost::uint64_t>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+	}
+}
+
+} // namespace detail
+
+namespace {
+
+using namespace moose::rescue::detail;
+
+template <typename Word>
+Word load_be(const boost::uint8_t *n_src) noexcept {
+
+	Word ret = 0;
+	for (std::size_t i = 0; i < sizeof(Word); i++) {
+		ret = static_cast<Word>((ret << 8) | n_src[i]);
+	}
+	return ret;
+}
+
+template <typename Word>
+void store_be(const Word n_value, boost::uint8_t *n_dst) noexcept {
+
+	for (std::size_t i = 0; i < sizeof(Word); i++) {
+		n_dst[i] = static_cast<boost::uint8_t>(n_value >> (8 * (sizeof(Word) - 1 - i)));
+	}
+}
+
+/* Pad and hash n_message on top of n_state, which has already seen
+ * n_prefix_size bytes. This is plain scalar code, only used for the
+ * first iteration which is but a tiny fraction of the work.
+ */
+template <typename H>
+void finish(typename H::word *n_state, const boost::uint8_t *n_message, const std::size_t n_size, const std::size_t n_prefix_size) {
+
+	using word = typename H::word;
+
+	// SHA-1 and SHA-256 end in a 64 bit length, SHA-512 in a 128 bit one
+	const std::size_t length_bytes = 2 * sizeof(word);
+	const boost::uint64_t bits = static_cast<boost::uint64_t>(n_prefix_size + n_size) * 8;
+
+	std::vector<boost::uint8_t> data(n_message, n_message + n_size);
+	data.push_back(0x80);
+	while (((data.size() + length_bytes) % H::block_bytes) != 0) {
+		data.push_back(0);
+	}
+	data.resize(data.size() + length_bytes - 8, 0);
+	for (int i = 7; i >= 0; i--) {
+		data.push_back(static_cast<boost::uint8_t>(bits >> (8 * i)));
+	}
+
+	word block[16];
+	for (std::size_t offset = 0; offset < data.size(); offset += H::block_bytes) {
+		for (std::size_t w = 0; w < 16; w++) {
+			block[w] = load_be<word>(data.data() + offset + w * sizeof(word));
+		}
+		H::compress(n_state, block);
+	}
+}
+
+//! HMAC midstates after the padded key
+template <typename H>
+void hmac_key(const std::string &n_password, typename H::word *n_inner, typename H::word *n_outer) {
+
+	using word = typename H::word;
+
+	boost::uint8_t key[H::block_bytes] = { 0 };
+	if (n_password.size() > H::block_bytes) {
+		// Long keys are hashed first
+		word state[H::state_words];
+		std::copy(H::iv(), H::iv() + H::state_words, state);
+		finish<H>(state, reinterpret_cast<const boost::uint8_t *>(n_password.data()), n_password.size(), 0);
+		for (std::size_t w = 0; w < H::digest_words; w++) {
+			store_be(state[w], key + w * sizeof(word));
+		}
+	} else {
+		std::memcpy(key, n_password.data(), n_password.size());
+	}
+
+	word ipad[16];
+	word opad[16];
+	for (std::size_t w = 0; w < 16; w++) {
+		const word k = load_be<word>(key + w * sizeof(word));
+		ipad[w] = k ^ static_cast<word>(0x3636363636363636ULL);
+		opad[w] = k ^ static_cast<word>(0x5c5c5c5c5c5c5c5cULL);
+	}
+
+	std::copy(H::iv(), H::iv() + H::state_words, n_inner);
+	H::compress(n_inner, ipad);
+	std::copy(H::iv(), H::iv() + H::state_words, n_outer);
+	H::compress(n_outer, opad);
+
+	std::fill(std::begin(key), std::end(key), 0);
+	std::fill(std::begin(ipad), std::end(ipad), 0);
+	std::fill(std::begin(opad), std::end(opad), 0);
+}
+
+//! U1 = HMAC(password, salt || block index)
+template <typename H>
+void first_u(const typename H::word *n_inner, const typename H::word *n_outer,
+             const std::vector<boost::uint8_t> &n_salt_block, typename H::word *n_u) {
+
+	using word = typename H::word;
+
+	word state[H::state_words];
+	std::copy(n_inner, n_inner + H::state_words, state);
+	finish<H>(state, n_salt_block.data(), n_salt_block.size(), H::block_bytes);
+
+	boost::uint8_t digest[H::digest_words * sizeof(word)];
+	for (std::size_t w = 0; w < H::digest_words; w++) {
+		store_be(state[w], digest + w * sizeof(word));
+	}
+
+	std::copy(n_outer, n_outer + H::state_words, state);
+	finish<H>(state, digest, sizeof(digest), H::block_bytes);
+	std::copy(state, state + H::digest_words, n_u);
+}
+
+pbkdf2_iterate_fn kernel(const simd_level n_level) noexcept {
+
+	switch (n_level) {
+#if defined(RESCUE_SIMD_X86)
+		case simd_level::avx2:
+			return &pbkdf2_iterate_avx2;
+		case simd_level::avx512:
+			return &pbkdf2_iterate_avx512;
+#endif
+		default:
+			return &pbkdf2_iterate_scalar;
+	}
+}
+
+/* Run PBKDF2 for the passwords [n_first, n_first + n_count) in n_lanes lanes.
+ * Unused lanes get a copy of the first password and their result is dropped.
+ */
+template <typename H>
+void derive_lanes(const std::vector<std::string> &n_passwords, const std::size_t n_first, const std::size_t n_count,
+                  const std::size_t n_lanes, const pbkdf2_hash n_hash, const pbkdf2_iterate_fn n_kernel,
+                  const boost::uint8_t *n_salt, const std::size_t n_salt_size, const boost::uint32_t n_iterations,
+                  const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys) {
+
+	using word = typename H::word;
+	const std::size_t digest_bytes = H::digest_words * sizeof(word);
+
+	// Word major, as the kernels want them
+	std::vector<word> inner(H::state_words * n_lanes);
+	std::vector<word> outer(H::state_words * n_lanes);
+	std::vector<word> u(H::digest_words * n_lanes);
+	std::vector<word> t(H::digest_words * n_lanes);
+
+	// Per lane scratch
+	std::vector<word> lane_inner(H::state_words * n_lanes);
+	std::vector<word> lane_outer(H::state_words * n_lanes);
+	word lane_u[H::digest_words];
+
+	for (std::size_t l = 0; l < n_lanes; l++) {
+		const std::string &password = n_passwords[n_first + ((l < n_count) ? l : 0)];
+		hmac_key<H>(password, &lane_inner[l * H::state_words], &lane_outer[l * H::state_words]);
+		for (std::size_t s = 0; s < H::state_words; s++) {
+			inner[s * n_lanes + l] = lane_inner[l * H::state_words + s];
+			outer[s * n_lanes + l] = lane_outer[l * H::state_words + s];
+		}
+	}
+
+	std::vector<boost::uint8_t> salt_block(n_salt, n_salt + n_salt_size);
+	salt_block.resize(n_salt_size + 4);
+
+	for (std::size_t offset = 0, index = 1; offset < n_key_size; offset += digest_bytes, index++) {
+
+		store_be(static_cast<boost::uint32_t>(index), salt_block.data() + n_salt_size);
+		for (std::size_t l = 0; l < n_lanes; l++) {
+			first_u<H>(&lane_inner[l * H::state_words], &lane_outer[l * H::state_words], salt_block, lane_u);
+			for (std::size_t w = 0; w < H::digest_words; w++) {
+				u[w * n_lanes + l] = lane_u[w];
+				t[w * n_lanes + l] = lane_u[w];
+			}
+		}
+
+		// This is where the time goes
+		n_kernel(n_hash, inner.data(), outer.data(), u.data(), t.data(), n_iterations);
+
+		const std::size_t piece = std::min(digest_bytes, n_key_size - offset);
+		for (std::size_t l = 0; l < n_count; l++) {
+			boost::uint8_t digest[H::digest_words * sizeof(word)];
+			for (std::size_t w = 0; w < H::digest_words; w++) {
+				store_be(t[w * n_lanes + l], digest + w * sizeof(word));
+			}
+			std::memcpy(n_keys.data() + (n_first + l) * n_key_size + offset, digest, piece);
+		}
+	}
+
+	std::fill(inner.begin(), inner.end(), 0);
+	std::fill(outer.begin(), outer.end(), 0);
+	std::fill(lane_inner.begin(), lane_inner.end(), 0);
+	std::fill(lane_outer.begin(), lane_outer.end(), 0);
+	std::fill(u.begin(), u.end(), 0);
+	std::fill(t.begin(), t.end(), 0);
+}
+
+template <typename H>
+void derive(const pbkdf2_hash n_hash, const std::vector<std::string> &n_passwords,
+            const boost::uint8_t *n_salt, const std::size_t n_salt_size, const boost::uint32_t n_iterations,
+            const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys, const simd_level n_level) {
+
+	const std::size_t lanes = pbkdf2_lanes(n_hash, n_level);
+
+	for (std::size_t first = 0; first < n_passwords.size(); first += lanes) {
+		const std::size_t count = std::min(lanes, n_passwords.size() - first);
+
+		// A vector for only one password would be a waste
+		if (count == 1) {
+			derive_lanes<H>(n_passwords, first, 1, 1, n_hash, kernel(simd_level::scalar),
+			                n_salt, n_salt_size, n_iterations, n_key_size, n_keys);
+		} else {
+			derive_lanes<H>(n_passwords, first, count, lanes, n_hash, kernel(n_level),
+			                n_salt, n_salt_size, n_iterations, n_key_size, n_keys);
+		}
+	}
+}
+
+} // anon namespace
+
+boost::optional<pbkdf2_hash> pbkdf2_hash_by_name(const std::string &n_name) {
+
+	if (n_name == "sha1") {
+		return pbkdf2_hash::sha1;
+	} else if (n_name == "sha256") {
+		return pbkdf2_hash::sha256;
+	} else if (n_name == "sha512") {
+		return pbkdf2_hash::sha512;
+	}
+
+	return boost::none;
+}
+
+std::size_t pbkdf2_lanes(const pbkdf2_hash n_hash, const simd_level n_level) noexcept {
+
+	const std::size_t word_size = (n_hash == pbkdf2_hash::sha512) ? 8 : 4;
+
+	switch (n_level) {
+		case simd_level::avx2:
+			return 32 / word_size;
+		case simd_level::avx512:
+			return 64 / word_size;
+		default:
+		case simd_level::scalar:
+			return 1;
+	}
+}
+
+void pbkdf2_batch(const pbkdf2_hash n_hash, const std::vector<std::string> &n_passwords,
+                  const boost::uint8_t *n_salt, const std::size_t n_salt_size, const boost::uint32_t n_iterations,
+                  const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys, const simd_level n_level) {
+
+	if (!simd_supported(n_level)) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("PBKDF2 kernel not supported on this machine")
+		            << error_argument(to_string(n_level)));
+	}
+
+	if (n_iterations == 0) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("PBKDF2 needs at least one iteration"));
+	}
+
+	n_keys.assign(n_passwords.size() * n_key_size, 0);
+
+	switch (n_hash) {
+		case pbkdf2_hash::sha1:
+			derive<sha1_traits>(n_hash, n_passwords, n_salt, n_salt_size, n_iterations, n_key_size, n_keys, n_level);
+			break;
+		case pbkdf2_hash::sha256:
+			derive<sha256_traits>(n_hash, n_passwords, n_salt, n_salt_size, n_iterations, n_key_size, n_keys, n_level);
+			break;
+		case pbkdf2_hash::sha512:
+			derive<sha512_traits>(n_hash, n_passwords, n_salt, n_salt_size, n_iterations, n_key_size, n_keys, n_level);
+			break;
+	}
+}
+
+} // namespace rescue
+} // namespace moose
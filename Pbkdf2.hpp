@@ -0,0 +1,51 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+#include "Simd.hpp"
+
+#include <boost/cstdint.hpp>
+#include <boost/optional.hpp>
+
+#include <vector>
+#include <string>
+
+namespace moose {
+namespace rescue {
+
+//! The hashes we have multi-buffer PBKDF2-HMAC kernels for
+enum class pbkdf2_hash {
+	sha1,
+	sha256,
+	sha512
+};
+
+//! @return the hash for its cryptsetup name, e.g. "sha256", if we have a kernel for it
+boost::optional<pbkdf2_hash> RESCUE_API pbkdf2_hash_by_name(const std::string &n_name);
+
+/*! @brief how many passwords a kernel works on at once
+
+	This is 1 for scalar, 8 and 4 for AVX2 and 16 and 8 for AVX-512,
+	the latter for SHA-512 with its 64 bit words.
+	Batches of a multiple of this are the most efficient.
+ */
+std::size_t RESCUE_API pbkdf2_lanes(const pbkdf2_hash n_hash, const simd_level n_level = cpu_simd_level()) noexcept;
+
+/*! @brief PBKDF2-HMAC for many passwords with the same salt and iteration count
+
+	Passwords are spread across the SIMD lanes of the kernel for n_level,
+	so one batch costs about as much as a single password does in scalar code.
+	A single password left over at the end of the batch is done in scalar code.
+
+	@param n_keys will hold n_key_size bytes for each password, in the order of n_passwords
+	@throw internal_error when n_level isn't supported here or n_iterations is 0
+ */
+void RESCUE_API pbkdf2_batch(const pbkdf2_hash n_hash, const std::vector<std::string> &n_passwords,
+                             const boost::uint8_t *n_salt, const std::size_t n_salt_size, const boost::uint32_t n_iterations,
+                             const std::size_t n_key_size, std::vector<boost::uint8_t> &n_keys,
+                             const simd_level n_level = cpu_simd_level());
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,39 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// AVX2, 256 bit vectors. This file is compiled with -mavx2 and only
+// called after the CPU was found to support it.
+
+#include "Pbkdf2Kernel.hpp"
+
+namespace moose {
+namespace rescue {
+namespace detail {
+
+namespace {
+
+typedef boost::uint32_t u32x8 __attribute__((vector_size(32)));
+typedef boost::uint64_t u64x4 __attribute__((vector_size(32)));
+
+} // anon namespace
+
+void pbkdf2_iterate_avx2(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                         void *n_u, void *n_t, const boost::uint32_t n_iterations) {
+
+	switch (n_hash) {
+		case pbkdf2_hash::sha1:
+			iterate_lanes<sha1_traits, u32x8>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+		case pbkdf2_hash::sha256:
+			iterate_lanes<sha256_traits, u32x8>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+		case pbkdf2_hash::sha512:
+			iterate_lanes<sha512_traits, u64x4>(n_inner, n_outer, n_u, n_t, n_iterations);
+			break;
+	}
+}
+
+} // namespace detail
+} // namespace rescue
+} // namespace moose
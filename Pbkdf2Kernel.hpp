@@ -0,0 +1,350 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "Pbkdf2.hpp"
+
+#include <boost/cstdint.hpp>
+
+#include <cstring>
+
+// Internal to the PBKDF2 implementation, not installed.
+
+namespace moose {
+namespace rescue {
+namespace detail {
+
+/* Kernel entry points, one per instruction set. Each runs all PBKDF2 iterations
+ * after the first for as many passwords as pbkdf2_lanes() says.
+ *
+ * n_inner and n_outer are the HMAC midstates after the padded key, n_u is the
+ * first U and n_t the running XOR of all U, which also starts out as the first U.
+ * All of them are word major: word w of lane l is at [w * lanes + l].
+ */
+using pbkdf2_iterate_fn = void (*)(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                                   void *n_u, void *n_t, const boost::uint32_t n_iterations);
+
+void pbkdf2_iterate_scalar(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                           void *n_u, void *n_t, const boost::uint32_t n_iterations);
+
+#if defined(RESCUE_SIMD_X86)
+void pbkdf2_iterate_avx2(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                         void *n_u, void *n_t, const boost::uint32_t n_iterations);
+
+void pbkdf2_iterate_avx512(const pbkdf2_hash n_hash, const void *n_inner, const void *n_outer,
+                           void *n_u, void *n_t, const boost::uint32_t n_iterations);
+#endif
+
+/* Everything below is compiled once for each instruction set, with the
+ * kernel's translation unit's compiler flags. It has to stay in an anonymous
+ * namespace so the linker never picks an AVX-512 instantiation for scalar code.
+ *
+ * V is either the plain word type or a GCC vector of words, one per lane.
+ * Both support the same operators, so the hash code is written only once.
+ */
+namespace {
+
+const boost::uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+const boost::uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const boost::uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const boost::uint64_t sha512_iv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+const boost::uint64_t sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+template <int Bits, typename V>
+inline V rotr(const V n_x) {
+
+	return (n_x >> Bits) | (n_x << ((sizeof(n_x[0]) * 8) - Bits));
+}
+
+template <int Bits, typename V>
+inline V rotl(const V n_x) {
+
+	return (n_x << Bits) | (n_x >> ((sizeof(n_x[0]) * 8) - Bits));
+}
+
+// Scalar words can't be indexed like vectors, so they need their own
+template <int Bits>
+inline boost::uint32_t rotr(const boost::uint32_t n_x) {
+
+	return (n_x >> Bits) | (n_x << (32 - Bits));
+}
+
+template <int Bits>
+inline boost::uint64_t rotr(const boost::uint64_t n_x) {
+
+	return (n_x >> Bits) | (n_x << (64 - Bits));
+}
+
+template <int Bits>
+inline boost::uint32_t rotl(const boost::uint32_t n_x) {
+
+	return (n_x << Bits) | (n_x >> (32 - Bits));
+}
+
+struct sha1_traits {
+
+	using word = boost::uint32_t;
+	enum : std::size_t {
+		state_words  = 5,
+		digest_words = 5,
+		block_bytes  = 64
+	};
+
+	static const word *iv() noexcept { return sha1_iv; }
+
+	template <typename V>
+	static void compress(V *n_state, const V *n_block) {
+
+		V w[80];
+		for (std::size_t t = 0; t < 16; t++) {
+			w[t] = n_block[t];
+		}
+		for (std::size_t t = 16; t < 80; t++) {
+			w[t] = rotl<1>(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16]);
+		}
+
+		V a = n_state[0], b = n_state[1], c = n_state[2], d = n_state[3], e = n_state[4];
+
+		const auto round = [&](const V &n_f, const word n_k, const V &n_w) {
+			const V tmp = rotl<5>(a) + n_f + e + n_k + n_w;
+			e = d;
+			d = c;
+			c = rotl<30>(b);
+			b = a;
+			a = tmp;
+		};
+
+		for (std::size_t t = 0; t < 20; t++) {
+			round(d ^ (b & (c ^ d)), 0x5a827999, w[t]);
+		}
+		for (std::size_t t = 20; t < 40; t++) {
+			round(b ^ c ^ d, 0x6ed9eba1, w[t]);
+		}
+		for (std::size_t t = 40; t < 60; t++) {
+			round((b & c) | (d & (b | c)), 0x8f1bbcdc, w[t]);
+		}
+		for (std::size_t t = 60; t < 80; t++) {
+			round(b ^ c ^ d, 0xca62c1d6, w[t]);
+		}
+
+		n_state[0] += a;
+		n_state[1] += b;
+		n_state[2] += c;
+		n_state[3] += d;
+		n_state[4] += e;
+	}
+};
+
+struct sha256_traits {
+
+	using word = boost::uint32_t;
+	enum : std::size_t {
+		state_words  = 8,
+		digest_words = 8,
+		block_bytes  = 64
+	};
+
+	static const word *iv() noexcept { return sha256_iv; }
+
+	template <typename V>
+	static void compress(V *n_state, const V *n_block) {
+
+		V w[64];
+		for (std::size_t t = 0; t < 16; t++) {
+			w[t] = n_block[t];
+		}
+		for (std::size_t t = 16; t < 64; t++) {
+			const V s0 = rotr<7>(w[t - 15]) ^ rotr<18>(w[t - 15]) ^ (w[t - 15] >> 3);
+			const V s1 = rotr<17>(w[t - 2]) ^ rotr<19>(w[t - 2]) ^ (w[t - 2] >> 10);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+		}
+
+		V a = n_state[0], b = n_state[1], c = n_state[2], d = n_state[3];
+		V e = n_state[4], f = n_state[5], g = n_state[6], h = n_state[7];
+
+		for (std::size_t t = 0; t < 64; t++) {
+			const V t1 = h + (rotr<6>(e) ^ rotr<11>(e) ^ rotr<25>(e)) + (g ^ (e & (f ^ g))) + sha256_k[t] + w[t];
+			const V t2 = (rotr<2>(a) ^ rotr<13>(a) ^ rotr<22>(a)) + ((a & b) | (c & (a | b)));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		n_state[0] += a;
+		n_state[1] += b;
+		n_state[2] += c;
+		n_state[3] += d;
+		n_state[4] += e;
+		n_state[5] += f;
+		n_state[6] += g;
+		n_state[7] += h;
+	}
+};
+
+struct sha512_traits {
+
+	using word = boost::uint64_t;
+	enum : std::size_t {
+		state_words  = 8,
+		digest_words = 8,
+		block_bytes  = 128
+	};
+
+	static const word *iv() noexcept { return sha512_iv; }
+
+	template <typename V>
+	static void compress(V *n_state, const V *n_block) {
+
+		V w[80];
+		for (std::size_t t = 0; t < 16; t++) {
+			w[t] = n_block[t];
+		}
+		for (std::size_t t = 16; t < 80; t++) {
+			const V s0 = rotr<1>(w[t - 15]) ^ rotr<8>(w[t - 15]) ^ (w[t - 15] >> 7);
+			const V s1 = rotr<19>(w[t - 2]) ^ rotr<61>(w[t - 2]) ^ (w[t - 2] >> 6);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+		}
+
+		V a = n_state[0], b = n_state[1], c = n_state[2], d = n_state[3];
+		V e = n_state[4], f = n_state[5], g = n_state[6], h = n_state[7];
+
+		for (std::size_t t = 0; t < 80; t++) {
+			const V t1 = h + (rotr<14>(e) ^ rotr<18>(e) ^ rotr<41>(e)) + (g ^ (e & (f ^ g))) + sha512_k[t] + w[t];
+			const V t2 = (rotr<28>(a) ^ rotr<34>(a) ^ rotr<39>(a)) + ((a & b) | (c & (a | b)));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		n_state[0] += a;
+		n_state[1] += b;
+		n_state[2] += c;
+		n_state[3] += d;
+		n_state[4] += e;
+		n_state[5] += f;
+		n_state[6] += g;
+		n_state[7] += h;
+	}
+};
+
+/* PBKDF2 iterations 2..n for one vector of lanes.
+ * Each U is shorter than a block, so every compression after the midstates
+ * works on a single block whose padding never changes. Only the first
+ * digest_words of it are filled in each time.
+ */
+template <typename H, typename V>
+void iterate(const V *n_inner, const V *n_outer, V *n_u, V *n_t, const boost::uint32_t n_iterations) {
+
+	using word = typename H::word;
+	const std::size_t digest_bytes = H::digest_words * sizeof(word);
+
+	V block[16];
+	for (std::size_t i = H::digest_words; i < 16; i++) {
+		block[i] = V{};
+	}
+	block[H::digest_words] += static_cast<word>(word(0x80) << (sizeof(word) * 8 - 8));
+	block[15] += static_cast<word>((H::block_bytes + digest_bytes) * 8);
+
+	V state[H::state_words];
+	for (boost::uint32_t i = 1; i < n_iterations; i++) {
+
+		for (std::size_t w = 0; w < H::digest_words; w++) {
+			block[w] = n_u[w];
+		}
+		for (std::size_t s = 0; s < H::state_words; s++) {
+			state[s] = n_inner[s];
+		}
+		H::compress(state, block);
+
+		for (std::size_t w = 0; w < H::digest_words; w++) {
+			block[w] = state[w];
+		}
+		for (std::size_t s = 0; s < H::state_words; s++) {
+			state[s] = n_outer[s];
+		}
+		H::compress(state, block);
+
+		for (std::size_t w = 0; w < H::digest_words; w++) {
+			n_u[w] = state[w];
+			n_t[w] ^= state[w];
+		}
+	}
+}
+
+//! Load the word major lanes into vectors of type V, iterate and store them again
+template <typename H, typename V>
+void iterate_lanes(const void *n_inner, const void *n_outer, void *n_u, void *n_t, const boost::uint32_t n_iterations) {
+
+	V inner[H::state_words];
+	V outer[H::state_words];
+	V u[H::digest_words];
+	V t[H::digest_words];
+
+	std::memcpy(inner, n_inner, sizeof(inner));
+	std::memcpy(outer, n_outer, sizeof(outer));
+	std::memcpy(u, n_u, sizeof(u));
+	std::memcpy(t, n_t, sizeof(t));
+
+	iterate<H, V>(inner, outer, u, t, n_iterations);
+
+	std::memcpy(n_u, u, sizeof(u));
+	std::memcpy(n_t, t, sizeof(t));
+}
+
+} // anon namespace
+
+} // namespace detail
+} // namespace rescue
+} // namespace moose
@@ -3,8 +3,13 @@
 // LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "RescueServer.hpp"
+#include "InputGenerator.hpp"
 #include "WorkQueue.hpp"
+#include "LocalQueue.hpp"
+#include "Scheduler.hpp"
+#include "Checkpoint.hpp"
 #include "BruteForceLuks.hpp"
+#include "Sha512.hpp"
 
 #include "mredis/AsyncClient.hpp"
 
@@ -14,13 +19,21 @@
 
 #include <boost/cstdint.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/optional.hpp>
 
+#include <algorithm>
 #include <exception>
 #include <iostream>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
 
 namespace moose {
 namespace rescue {
@@ -41,50 +54,296 @@ RescueServer::~RescueServer() noexcept {
 }
 
 
-void worker(mredis::AsyncClientSPtr n_redis, std::atomic<bool> &n_continue, const fs::path &n_path) {
+namespace {
 
+/* Idle workers sleep on this until either their backoff runs out or another
+ * worker found work, which means the queue was filled again. Waking up everyone
+ * then is cheap compared to having all of them poll redis every second.
+ */
+class WorkSignal {
+
+	public:
+		//! wake up all waiting workers
+		void notify() {
+
+			{
+				boost::lock_guard<boost::mutex> lock(m_mutex);
+				m_generation++;
+			}
+			m_condition.notify_all();
+		}
+
+		//! wait until notify() or n_timeout
+		void wait(const boost::chrono::milliseconds n_timeout) {
+
+			boost::unique_lock<boost::mutex> lock(m_mutex);
+			const std::uint64_t generation = m_generation;
+			m_condition.wait_for(lock, n_timeout, [&] { return m_generation != generation; });
+		}
+
+	private:
+		boost::mutex              m_mutex;
+		boost::condition_variable m_condition;
+		std::uint64_t             m_generation = 0;
+};
+
+/* Exponential backoff with jitter for idle workers, so they don't all hit
+ * redis at the same time while there is nothing to do.
+ */
+class Backoff {
+
+	public:
+		Backoff()
+		        : m_delay{ min_delay }
+		        , m_random{ std::random_device{}() } {
+		}
+
+		//! work found, be eager again
+		void reset() noexcept {
+
+			m_delay = min_delay;
+		}
+
+		//! @return how long to wait this time, somewhere between half and all of the current delay
+		boost::chrono::milliseconds next() {
+
+			std::uniform_int_distribution<boost::chrono::milliseconds::rep> jitter{ m_delay.count() / 2, m_delay.count() };
+			const boost::chrono::milliseconds ret{ jitter(m_random) };
+
+			m_delay = std::min(m_delay * 2, max_delay);
+			return ret;
+		}
+
+	private:
+		static constexpr boost::chrono::milliseconds min_delay{ 50 };
+		static constexpr boost::chrono::milliseconds max_delay{ 10000 };
+
+		boost::chrono::milliseconds m_delay;
+		std::mt19937                m_random;
+};
+
+constexpr boost::chrono::milliseconds Backoff::min_delay;
+constexpr boost::chrono::milliseconds Backoff::max_delay;
+
+//! @return what the kernel says is available without swapping, if it says so
+boost::optional<boost::uint64_t> available_memory() {
+
+	fs::ifstream meminfo{ "/proc/meminfo" };
+	std::string key;
+	boost::uint64_t kb = 0;
+	std::string unit;
+
+	while (meminfo >> key >> kb >> unit) {
+		if (key == "MemAvailable:") {
+			return kb * 1024;
+		}
+	}
+
+	return boost::none;
+}
+
+/* As many workers as we have cores, unless the memory their KDF needs for
+ * each attempt doesn't fit in what is available. Argon2 is memory hard by
+ * design, we'd rather run fewer workers than swap or get OOM killed.
+ */
+unsigned int worker_count(const boost::uint64_t n_memory_cost) {
+
+	const unsigned int cores = std::max(1u, boost::thread::hardware_concurrency());
+	if (n_memory_cost == 0) {
+		return cores;
+	}
+
+	const boost::optional<boost::uint64_t> available = available_memory();
+	if (!available) {
+		BOOST_LOG_SEV(logger(), warning) << "Cannot determine available memory, using all " << cores << " cores";
+		return cores;
+	}
+
+	// Leave a quarter to everyone else
+	const boost::uint64_t fitting = (*available / 4 * 3) / n_memory_cost;
+	if (fitting == 0) {
+		BOOST_LOG_SEV(logger(), warning) << "Not even one KDF fits into available memory, expect swapping";
+	}
+
+	const unsigned int ret = static_cast<unsigned int>(std::max<boost::uint64_t>(1, std::min<boost::uint64_t>(cores, fitting)));
+	BOOST_LOG_SEV(logger(), normal) << "KDF needs " << (n_memory_cost >> 20) << " MiB per attempt, " << (*available >> 20)
+	        << " MiB available. Running " << ret << " workers on " << cores << " cores";
+
+	return ret;
+}
+
+/* What progress on a header is valid for: the volume, the key slots we try and
+ * how they derive their keys. A header that can't be read natively is known by its path
+ */
+std::string kdf_settings(const fs::path &n_luks_file, const std::vector<std::size_t> &n_slots) {
+
+	std::ostringstream os;
 	try {
+		const luks_volume volume = read_luks_volume(n_luks_file);
+		os << "LUKS" << volume.m_version << " " << volume.m_uuid;
 
-		while (n_continue.load()) {
+		for (const luks_slot &slot : volume.m_slots) {
+			if (!n_slots.empty() && (std::find(n_slots.begin(), n_slots.end(), slot.m_index) == n_slots.end())) {
+				continue;
+			}
+
+			std::string salt(2 * slot.m_kdf.m_salt.size(), '\0');
+			to_hex(slot.m_kdf.m_salt.data(), slot.m_kdf.m_salt.size(), &salt[0]);
+
+			os << " slot " << slot.m_index << " " << slot.m_kdf.m_type << " " << slot.m_kdf.m_hash
+			   << " " << slot.m_kdf.m_iterations << " " << slot.m_kdf.m_memory_kb << " " << slot.m_kdf.m_parallelism
+			   << " " << salt;
+		}
+	} catch (const serialization_error &) {
+		os << "header " << fs::absolute(n_luks_file).string();
+	}
+
+	return os.str();
+}
+
+} // anon namespace
+
+/* Expand a leased chunk locally and try every candidate in it.
+ * Returns true if one of them worked. Gives up without returning the lease
+ * when asked to stop, so the chunk will be picked up again when it expires.
+ */
+bool work_on_chunk(WorkQueue &n_queue, std::atomic<bool> &n_continue, LuksContext &n_luks, const work_chunk &n_chunk) {
+
+	BOOST_LOG_SEV(logger(), normal) << "Polled candidate chunk [" << n_chunk.m_begin << ", " << n_chunk.m_end << "), ready to work";
+
+	PermutationGenerator generator{ n_chunk.m_pattern };
+	generator.seek(n_chunk.m_begin);
+
+	// Candidates are tried a batch at a time, as many as the verifier does at once
+	const std::size_t batch_size = preferred_batch_size(n_luks);
+	std::vector<std::string> batch;
+	batch.reserve(batch_size);
+
+	std::uint64_t i = n_chunk.m_begin;
+	while (i < n_chunk.m_end) {
+
+		if (!n_continue.load()) {
+			return false;
+		}
+
+		const std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(batch_size, n_chunk.m_end - i));
+		if (generator.next(batch, count) < count) {
+			BOOST_LOG_SEV(logger(), error) << "Chunk exceeds its pattern at index " << i + batch.size();
+			i = n_chunk.m_end;
+		} else {
+			i += count;
+		}
+
+		const boost::optional<std::size_t> found = attempt_passwords(n_luks, batch);
+		if (found) {
+			n_queue.result(n_chunk, true);
+
+			// Make some noise!
+			BOOST_LOG_SEV(logger(), normal) << "YOU HAVE DONE IT!!: " << batch[*found];
+			std::cout << "YOU HAVE DONE IT!!: " << batch[*found] << std::endl;
+			n_continue.store(false);
+			return true;
+		}
+	}
+
+	n_queue.result(n_chunk, false);
+	return false;
+}
 
-			boost::this_thread::sleep_for(boost::chrono::seconds(1));
+/* Work on whatever the queue has until it is exhausted or n_continue is cleared.
+ * Returns false when an error ended it, in which case all other workers are stopped too.
+ */
+bool worker(WorkQueue &n_queue, std::atomic<bool> &n_continue, WorkSignal &n_signal, LuksContext &n_luks) {
 
+	try {
+		const std::size_t batch_size = preferred_batch_size(n_luks);
+		Backoff backoff;
+		bool idle = false;
+
+		// Work has arrived. Tell the others who might still be sleeping
+		const auto work_found = [&] {
+			if (idle) {
+				idle = false;
+				backoff.reset();
+				n_signal.notify();
+			}
+		};
+
+		std::vector<std::string> batch;
+		batch.reserve(batch_size);
+
+		while (n_continue.load()) {
+
+			// Leased candidates come in batches. Work through them first, the
+			// buffer fetches more in the background while we do
+			batch.clear();
 			std::string password_candidate;
-			if (!poll_candidate(n_redis, password_candidate)) {
-				BOOST_LOG_SEV(logger(), debug) << "No password candidates ready. Put some in! Gimme work!";
-				continue;
+			while ((batch.size() < batch_size) && n_queue.next(password_candidate)) {
+				batch.push_back(password_candidate);
 			}
 
-			BOOST_LOG_SEV(logger(), normal) << "Polled password candidate, ready to work";
-			bool result = attempt_password(n_path, password_candidate);
+			if (!batch.empty()) {
+
+				work_found();
 
-			return_candidate(n_redis, password_candidate, result);
+				BOOST_LOG_SEV(logger(), normal) << "Polled " << batch.size() << " password candidates, ready to work";
+				const boost::optional<std::size_t> found = attempt_passwords(n_luks, batch);
 
-			if (result) {
-				// Make some noise!
-				BOOST_LOG_SEV(logger(), normal) << "YOU HAVE DONE IT!!: " << password_candidate;
-				std::cout << "YOU HAVE DONE IT!!: " << password_candidate << std::endl;
-				n_continue.store(false);
+				for (std::size_t i = 0; i < batch.size(); i++) {
+					n_queue.result(batch[i], found && (*found == i));
+				}
+
+				if (found) {
+					// Make some noise!
+					BOOST_LOG_SEV(logger(), normal) << "YOU HAVE DONE IT!!: " << batch[*found];
+					std::cout << "YOU HAVE DONE IT!!: " << batch[*found] << std::endl;
+					n_continue.store(false);
+					n_signal.notify();
+				}
+				continue;
 			}
-		}
 
-	} catch (const moose_error &merr) {
+			work_chunk chunk;
+			if (n_queue.next(chunk)) {
+				work_found();
 
+				if (work_on_chunk(n_queue, n_continue, n_luks, chunk)) {
+					n_signal.notify();
+				}
+				continue;
+			}
 
-	} catch (const std::exception &sex) {
+			// Nothing left and nothing more to come
+			if (n_queue.exhausted()) {
+				break;
+			}
 
+			BOOST_LOG_SEV(logger(), debug) << "No password candidates ready. Put some in! Gimme work!";
 
-	} catch (...) {
+			// Only sleep when there's nothing to do
+			idle = true;
+			n_signal.wait(backoff.next());
+		}
 
+		return true;
 
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Worker terminated with an error: " << boost::diagnostic_information(merr);
+	} catch (const std::exception &sex) {
+		BOOST_LOG_SEV(logger(), error) << "Unexpected exception in worker: " << boost::diagnostic_information(sex);
+	} catch (...) {
+		BOOST_LOG_SEV(logger(), error) << "Unknown exception in worker";
 	}
 
-
+	// A worker less would go unnoticed and its leases only come back when they expire. Stop them all
+	n_continue.store(false);
+	n_signal.notify();
+	return false;
 }
 
 
 
-void RescueServer::run(const boost::filesystem::path &n_luks_file) {
+void RescueServer::run(const boost::filesystem::path &n_luks_file, const bool n_native, const int n_slot) {
 
 	BOOST_LOG_NAMED_SCOPE("run")
 	try {
@@ -92,14 +351,18 @@ void RescueServer::run(const boost::filesystem::path &n_luks_file) {
 
 		m_redis->connect();
 
-		std::atomic<bool> go_on{ true };
+		// Pick and order the key slots once, not for every worker
+		const std::vector<std::size_t> slots = select_key_slots(n_luks_file, n_slot);
 
-		// Add as many workers as we have cores and start crunching
-		for (unsigned int i = 0; i < boost::thread::hardware_concurrency(); i++) {
-			m_workers.add_thread(new boost::thread{[&] { worker(this->m_redis, go_on, n_luks_file); }});
-		}
+		const bool worked = work(n_luks_file, n_native, slots, [&](const unsigned int n_workers, const std::size_t n_batch_size) {
+			// Keep enough leased candidates around to fill a whole batch for everyone
+			const std::size_t lease_size = n_workers * std::max<std::size_t>(8, 2 * n_batch_size);
+			return std::unique_ptr<WorkQueue>{ new RedisWorkQueue{ m_redis, lease_size } };
+		});
 
-		m_workers.join_all();
+		if (!worked) {
+			BOOST_LOG_SEV(logger(), error) << "Rescue Server stopped after a worker failed";
+		}
 
 	} catch (const moose_error &merr) {
 		BOOST_LOG_SEV(logger(), error) << "Stage Server terminated with an error: " << boost::diagnostic_information(merr);
@@ -110,6 +373,147 @@ void RescueServer::run(const boost::filesystem::path &n_luks_file) {
 	return;
 }
 
+bool RescueServer::run_local(const boost::filesystem::path &n_luks_file, const boost::filesystem::path &n_input,
+                             const std::uint64_t n_chunk_size, const bool n_native, const int n_slot,
+                             const boost::filesystem::path &n_checkpoint) {
+
+	BOOST_LOG_NAMED_SCOPE("run_local")
+	try {
+		BOOST_LOG_SEV(logger(), normal) << "Rescue Server starting up without redis, input " << n_input;
+
+		fs::ifstream input{ n_input };
+		if (!input) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("Cannot open input file") << error_argument(n_input.string()));
+		}
+
+		const std::vector<std::size_t> slots = select_key_slots(n_luks_file, n_slot);
+
+		// Progress is only good for the same key slots with the same KDF
+		std::unique_ptr<Checkpoint> checkpoint;
+		if (!n_checkpoint.empty()) {
+			checkpoint.reset(new Checkpoint{ n_checkpoint, kdf_settings(n_luks_file, slots) });
+		}
+
+		LocalQueue queue{ 1024, checkpoint.get() };
+		std::uint64_t lines = 0;
+		std::uint64_t queued = 0;
+		bool fed = false;
+
+		// The patterns are fed while the workers already work on the first ones
+		boost::thread feeder{ [&] {
+			try {
+				const std::uint64_t done_lines = checkpoint ? checkpoint->input_position() : 0;
+				bool all_done = true;
+
+				for (std::string line; std::getline(input, line); lines++) {
+					if (line.empty() || (lines < done_lines)) {
+						continue;
+					}
+
+					// The same as rescue_client enters into the queue
+					std::size_t num = queue.queue_pattern(line, n_chunk_size);
+					num += queue.queue_pattern(line + " Master [1|2]", n_chunk_size);
+					queued += num;
+					BOOST_LOG_SEV(logger(), normal) << "Input '" << line << "' yielded " << num << " chunks";
+
+					// Lines done in an earlier run needn't even be looked at next time
+					all_done = all_done && checkpoint && checkpoint->complete(line) && checkpoint->complete(line + " Master [1|2]");
+					if (all_done) {
+						checkpoint->input_done(lines + 1);
+					}
+				}
+				fed = true;
+			} catch (const moose_error &merr) {
+				BOOST_LOG_SEV(logger(), error) << "Cannot queue input: " << boost::diagnostic_information(merr);
+			}
+			queue.close();
+		}};
+
+		bool worked = false;
+		try {
+			worked = work(n_luks_file, n_native, slots, [&](const unsigned int, const std::size_t) { return queue.worker(); });
+		} catch (...) {
+			queue.stop();
+			feeder.join();
+			throw;
+		}
+
+		// Workers that gave up early must not leave the feeder waiting for them
+		const bool exhausted = queue.worker()->exhausted();
+		queue.stop();
+		feeder.join();
+
+		BOOST_LOG_SEV(logger(), normal) << queue.chunks_done() << " of " << queued << " chunks done, "
+		        << (queue.found() ? "password found" : "password not found");
+
+		if (queue.found()) {
+			return true;
+		}
+
+		// Only when every chunk came back do we know it's not in there. A chunk still out
+		// when the queue was stopped is not in the checkpoint, so its line must be read again
+		const bool complete = worked && fed && exhausted && (queue.chunks_done() == queued);
+		if (checkpoint && complete && (lines > 0)) {
+			checkpoint->input_done(lines);
+		}
+
+		if (complete) {
+			std::cout << "All " << queue.chunks_done() << " chunks done, password not found" << std::endl;
+		} else {
+			std::cout << "Stopped after " << queue.chunks_done() << " of " << queued << " chunks, password not found" << std::endl;
+		}
+
+		return worked && fed;
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Stage Server terminated with an error: " << boost::diagnostic_information(merr);
+	} catch (const std::exception &sex) {
+		BOOST_LOG_SEV(logger(), error) << "Unexpected exception running Stage Server: " << boost::diagnostic_information(sex);
+	}
+
+	return false;
+}
+
+bool RescueServer::work(const boost::filesystem::path &n_luks_file, const bool n_native, const std::vector<std::size_t> &n_slots,
+                        const std::function<std::unique_ptr<WorkQueue>(const unsigned int, const std::size_t)> &n_make_queue) {
+
+	std::atomic<bool> go_on{ true };
+	WorkSignal signal;
+
+	// Every worker gets its own header to work on, loaded only once.
+	// Doing that here also means we fail early on a bad header.
+	// The first one tells us how many workers fit into memory
+	std::vector<std::unique_ptr<LuksContext> > contexts;
+	contexts.emplace_back(new LuksContext{ n_luks_file, n_native, n_slots });
+
+	const unsigned int num_workers = worker_count(contexts.front()->memory_cost());
+	for (unsigned int i = 1; i < num_workers; i++) {
+		contexts.emplace_back(new LuksContext{ n_luks_file, n_native, n_slots });
+	}
+
+	// One queue for all of them. The scheduler splits its chunks and deals them out.
+	// Pieces don't get smaller than a batch, or workers would wait for each other
+	const std::size_t batch_size = preferred_batch_size(*contexts.front());
+	Scheduler scheduler{ n_make_queue(num_workers, batch_size), num_workers, batch_size, [&signal] { signal.notify(); } };
+
+	// Add the workers and start crunching
+	std::atomic<bool> failed{ false };
+	for (unsigned int i = 0; i < num_workers; i++) {
+		LuksContext *context = contexts[i].get();
+		WorkQueue *queue = &scheduler.worker(i);
+		m_workers.add_thread(new boost::thread{[&, context, queue] {
+			if (!worker(*queue, go_on, signal, *context)) {
+				failed.store(true);
+			}
+		}});
+	}
+
+	m_workers.join_all();
+
+	BOOST_LOG_SEV(logger(), normal) << "Workers done, " << scheduler.steals() << " pieces were stolen";
+	return !failed.load();
+}
+
 void RescueServer::shutdown() {
 
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 #include "RescueConfig.hpp"
+#include "LuksHeader.hpp"
 
 #include "mredis/FwdDeclarations.hpp"
 
@@ -12,15 +13,20 @@
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace moose {
 namespace rescue {
 
+class WorkQueue;
+
 /*! @brief Primary rescue server component.
- * Spawns as many threads as cores are available and has them poll
- * the work queue and work upon extracted items
+ * Spawns as many threads as cores are available and has a Scheduler
+ * deal the work queue's items out to them
  */
 class RescueServer final {
 
@@ -33,13 +39,37 @@ class RescueServer final {
 		//! shut down everything
 		RESCUE_API ~RescueServer() noexcept;
 		
-		//! start server and block until signal is received
-		RESCUE_API void run(const boost::filesystem::path &n_luks_file);
+		/*! @brief start server and block until signal is received
+			@param n_native check passwords natively instead of activating through libcryptsetup
+			@param n_slot a key slot index to target, any_key_slot or cheapest_key_slot
+		 */
+		RESCUE_API void run(const boost::filesystem::path &n_luks_file, const bool n_native = true, const int n_slot = any_key_slot);
+
+		/*! @brief work on the patterns in n_input on this machine alone, without redis
+
+			Every line is a pattern, entered in chunks of n_chunk_size like rescue_client
+			does and streamed to the workers through a LocalQueue.
+			Returns when the password was found or all candidates were tried.
+
+			@param n_checkpoint directory to keep progress in and resume from, none if empty
+			@return false when it was cut short by an error, such as a worker that failed
+		 */
+		RESCUE_API bool run_local(const boost::filesystem::path &n_luks_file, const boost::filesystem::path &n_input,
+		                          const std::uint64_t n_chunk_size = 10000, const bool n_native = true,
+		                          const int n_slot = any_key_slot,
+		                          const boost::filesystem::path &n_checkpoint = boost::filesystem::path());
 
 		//! shut down anyway
 		RESCUE_API void shutdown();
 
 	private:
+		/*! @brief load the header and run the workers on the queue made by n_make_queue
+			It is given the number of workers and the batch size each of them tries at once
+			@return false when a worker failed, which stops all of them
+		 */
+		bool work(const boost::filesystem::path &n_luks_file, const bool n_native, const std::vector<std::size_t> &n_slots,
+		          const std::function<std::unique_ptr<WorkQueue>(const unsigned int, const std::size_t)> &n_make_queue);
+
 		boost::thread_group            m_workers;
 		moose::mredis::AsyncClientSPtr m_redis;    // globally used by all workers
 };
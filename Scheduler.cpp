@@ -0,0 +1,263 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Scheduler.hpp"
+
+#include "tools/Log.hpp"
+#include "tools/Assert.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/thread/lock_guard.hpp>
+
+#include <algorithm>
+#include <deque>
+
+namespace moose {
+namespace rescue {
+
+using namespace moose::tools;
+
+//! a chunk leased from the queue, done when all its pieces are
+struct Scheduler::Lease {
+
+	work_chunk               m_chunk;
+	std::atomic<std::size_t> m_pieces{ 0 };          //!< not done yet
+	std::atomic<bool>        m_returned{ false };    //!< to the queue
+};
+
+struct Scheduler::Piece {
+
+	work_chunk             m_chunk;
+	std::shared_ptr<Lease> m_lease;
+};
+
+//! a worker's deque of pieces and what it sees of the scheduler
+class Scheduler::Worker final : public WorkQueue {
+
+	public:
+		Worker(Scheduler &n_scheduler, const unsigned int n_index)
+		        : m_scheduler(n_scheduler)
+		        , m_index{ n_index } {
+		}
+
+		bool next(std::string &n_candidate) override {
+
+			boost::lock_guard<boost::mutex> lock(m_scheduler.m_candidate_mutex);
+			return m_scheduler.m_queue->next(n_candidate);
+		}
+
+		void result(const std::string &n_candidate, const bool n_success) override {
+
+			boost::lock_guard<boost::mutex> lock(m_scheduler.m_candidate_mutex);
+			m_scheduler.m_queue->result(n_candidate, n_success);
+		}
+
+		bool next(work_chunk &n_chunk) override {
+
+			Piece piece;
+			if (!m_scheduler.take(m_index, piece)) {
+				return false;
+			}
+
+			n_chunk = std::move(piece.m_chunk);
+			m_current = std::move(piece.m_lease);
+			return true;
+		}
+
+		void result(const work_chunk &, const bool n_success) override {
+
+			MOOSE_ASSERT(m_current)
+			m_scheduler.finish(*m_current, n_success);
+			m_current.reset();
+		}
+
+		void flush() override {
+
+			boost::lock_guard<boost::mutex> lock(m_scheduler.m_candidate_mutex);
+			m_scheduler.m_queue->flush();
+		}
+
+		bool exhausted() const override {
+
+			return m_scheduler.exhausted();
+		}
+
+		// The owner takes from the front, thieves from the back
+		boost::mutex      m_mutex;
+		std::deque<Piece> m_pieces;
+
+	private:
+		Scheduler             &m_scheduler;
+		const unsigned int     m_index;
+		std::shared_ptr<Lease> m_current;    //!< of the piece being worked on
+};
+
+Scheduler::Scheduler(std::unique_ptr<WorkQueue> n_queue, const unsigned int n_workers, const std::uint64_t n_min_piece,
+                     std::function<void()> n_on_work)
+        : m_queue{ std::move(n_queue) }
+        , m_min_piece{ std::max<std::uint64_t>(1, n_min_piece) }
+        , m_on_work{ std::move(n_on_work) }
+        , m_queued{ 0 }
+        , m_fetching{ false }
+        , m_steals{ 0 }
+        , m_next_deal{ 0 }
+        , m_stop{ false } {
+
+	MOOSE_ASSERT(m_queue)
+	MOOSE_ASSERT(n_workers > 0)
+
+	for (unsigned int i = 0; i < n_workers; i++) {
+		m_workers.emplace_back(new Worker{ *this, i });
+	}
+
+	m_fetcher = boost::thread{ [this] { fetch(); } };
+}
+
+Scheduler::~Scheduler() noexcept {
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_fetch_mutex);
+		m_stop.store(true);
+	}
+	m_fetch_condition.notify_all();
+	m_fetcher.join();
+}
+
+WorkQueue &Scheduler::worker(const unsigned int n_index) {
+
+	MOOSE_ASSERT(n_index < m_workers.size())
+	return *m_workers[n_index];
+}
+
+void Scheduler::fetch() {
+
+	// A piece for everyone in reserve is plenty, chunks are split anyway
+	const std::size_t low_water = m_workers.size();
+
+	const boost::chrono::milliseconds min_delay{ 50 };
+	const boost::chrono::milliseconds max_delay{ 5000 };
+	boost::chrono::milliseconds delay{ min_delay };
+
+	while (!m_stop.load()) {
+
+		boost::chrono::milliseconds wait{ 100 };
+		if (m_queued.load() < low_water) {
+			// Until the pieces are dealt, exhausted() must not take a chunk in between for the end of all work
+			bool fetched = false;
+			m_fetching.store(true);
+			try {
+				fetched = fetch_chunk();
+			} catch (const std::exception &sex) {
+				BOOST_LOG_SEV(logger(), error) << "Cannot fetch work: " << boost::diagnostic_information(sex);
+			}
+			m_fetching.store(false);
+
+			if (fetched) {
+				delay = min_delay;
+				if (m_on_work) {
+					m_on_work();
+				}
+				continue;
+			}
+
+			// Nothing there, ask less often the longer that lasts
+			wait = delay;
+			delay = std::min(delay * 2, max_delay);
+		}
+
+		boost::unique_lock<boost::mutex> lock(m_fetch_mutex);
+		m_fetch_condition.wait_for(lock, wait, [&] { return m_stop.load() || (m_queued.load() < low_water && delay == min_delay); });
+	}
+}
+
+bool Scheduler::fetch_chunk() {
+
+	std::shared_ptr<Lease> lease = std::make_shared<Lease>();
+
+	// Polling may take a round trip to redis, so no lock holds up the workers meanwhile
+	if (!m_queue->next(lease->m_chunk)) {
+		return false;
+	}
+
+	const work_chunk &chunk = lease->m_chunk;
+	if (chunk.m_end <= chunk.m_begin) {
+		m_queue->result(chunk, false);
+		return true;
+	}
+
+	// Enough pieces for everyone to have a few to steal
+	const std::uint64_t size = chunk.m_end - chunk.m_begin;
+	const std::uint64_t pieces = std::max<std::uint64_t>(1, std::min<std::uint64_t>(size / m_min_piece, 4 * m_workers.size()));
+	const std::uint64_t piece_size = (size + pieces - 1) / pieces;
+
+	lease->m_pieces.store(static_cast<std::size_t>((size + piece_size - 1) / piece_size));
+
+	for (std::uint64_t begin = chunk.m_begin; begin < chunk.m_end; begin += piece_size) {
+
+		Piece piece;
+		piece.m_chunk.m_pattern = chunk.m_pattern;
+		piece.m_chunk.m_begin = begin;
+		piece.m_chunk.m_end = std::min(begin + piece_size, chunk.m_end);
+		piece.m_lease = lease;
+
+		Worker &worker = *m_workers[m_next_deal];
+		m_next_deal = (m_next_deal + 1) % m_workers.size();
+
+		boost::lock_guard<boost::mutex> worker_lock(worker.m_mutex);
+		worker.m_pieces.push_back(std::move(piece));
+		m_queued++;
+	}
+
+	BOOST_LOG_SEV(logger(), debug) << "Dealt chunk [" << chunk.m_begin << ", " << chunk.m_end << ") in "
+	        << lease->m_pieces.load() << " pieces";
+	return true;
+}
+
+bool Scheduler::take(const unsigned int n_index, Piece &n_piece) {
+
+	const std::size_t count = m_workers.size();
+	for (std::size_t i = 0; i < count; i++) {
+		Worker &worker = *m_workers[(n_index + i) % count];
+
+		boost::unique_lock<boost::mutex> lock(worker.m_mutex);
+		if (worker.m_pieces.empty()) {
+			continue;
+		}
+
+		if (i == 0) {
+			n_piece = std::move(worker.m_pieces.front());
+			worker.m_pieces.pop_front();
+		} else {
+			n_piece = std::move(worker.m_pieces.back());
+			worker.m_pieces.pop_back();
+			m_steals++;
+		}
+		lock.unlock();
+
+		// Running low, have the fetcher get more
+		if (--m_queued < count) {
+			m_fetch_condition.notify_one();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void Scheduler::finish(Lease &n_lease, const bool n_success) {
+
+	const bool last = (--n_lease.m_pieces == 0);
+	if ((n_success || last) && !n_lease.m_returned.exchange(true)) {
+		m_queue->result(n_lease.m_chunk, n_success);
+	}
+}
+
+bool Scheduler::exhausted() {
+
+	// In this order. A chunk taken out of an exhausted queue was either still being fetched or is dealt
+	return m_queue->exhausted() && !m_fetching.load() && (m_queued.load() == 0);
+}
+
+} // namespace rescue
+} // namespace moose
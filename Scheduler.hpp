@@ -0,0 +1,97 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+#include "WorkQueue.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace moose {
+namespace rescue {
+
+/*! @brief spreads the work of one queue across all workers of this machine
+
+	A fetcher thread leases chunks from the queue, splits them into pieces and
+	deals those out to a deque per worker. Workers take from the front of their
+	own and steal from the back of the others' when theirs runs dry, so all of
+	them stay busy no matter how uneven chunks are.
+	A chunk is returned to the queue once all of its pieces are done, or right
+	away when one of them was successful.
+
+	The queue only ever sees the fetcher and calls for candidates, which are
+	passed through. How often it is asked does not depend on the number of workers.
+ */
+class Scheduler final {
+
+	public:
+		/*! @brief start fetching
+
+			@param n_queue where the work comes from. The scheduler serializes calls for candidates, see WorkQueue
+			@param n_workers number of workers, each gets a queue by worker()
+			@param n_min_piece chunks are not split into pieces smaller than this
+			@param n_on_work called by the fetcher when it dealt out new work, to wake up idle workers
+		 */
+		RESCUE_API Scheduler(std::unique_ptr<WorkQueue> n_queue, const unsigned int n_workers, const std::uint64_t n_min_piece = 1,
+		                     std::function<void()> n_on_work = std::function<void()>());
+
+		//! stops the fetcher. Chunks with pieces left are not returned, their leases expire
+		RESCUE_API ~Scheduler() noexcept;
+
+		Scheduler(const Scheduler &) = delete;
+		Scheduler &operator=(const Scheduler &) = delete;
+
+		//! @return the queue for worker n_index, valid as long as the scheduler is
+		RESCUE_API WorkQueue &worker(const unsigned int n_index);
+
+		//! number of pieces workers took from others
+		std::uint64_t steals() const noexcept { return m_steals.load(); }
+
+	private:
+		struct Lease;
+		struct Piece;
+		class Worker;
+
+		//! the fetcher thread
+		void fetch();
+
+		//! lease one chunk and deal its pieces. @return false when there was none
+		bool fetch_chunk();
+
+		//! the next piece for worker n_index, its own or a stolen one
+		bool take(const unsigned int n_index, Piece &n_piece);
+
+		//! a piece of n_lease is done
+		void finish(Lease &n_lease, const bool n_success);
+
+		bool exhausted();
+
+		std::unique_ptr<WorkQueue>             m_queue;
+		boost::mutex                           m_candidate_mutex;    //!< serializes calls for candidates
+		const std::uint64_t                    m_min_piece;
+		const std::function<void()>            m_on_work;
+
+		std::vector<std::unique_ptr<Worker> >  m_workers;
+		std::atomic<std::size_t>               m_queued;             //!< pieces in all deques
+		std::atomic<bool>                      m_fetching;           //!< a chunk may be out of the queue but not dealt yet
+		std::atomic<std::uint64_t>             m_steals;
+		unsigned int                           m_next_deal;          //!< fetcher only
+
+		std::atomic<bool>                      m_stop;
+		boost::mutex                           m_fetch_mutex;
+		boost::condition_variable              m_fetch_condition;    //!< wakes the fetcher when running low
+		boost::thread                          m_fetcher;
+};
+
+} // namespace rescue
+} // namespace moose
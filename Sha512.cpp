@@ -1,271 +1,260 @@
+// Copyright 2018 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
 #include "Sha512.hpp"
+#include "Sha512Kernel.hpp"
+
+#include "tools/Error.hpp"
 
 #include <boost/cstdint.hpp>
+#include <boost/endian/conversion.hpp>
 
+#include <algorithm>
 #include <cstring>
 
 namespace moose {
 namespace rescue {
 
-/*! @brief this implementation was found here:
- * http://www.zedwood.com/article/cpp-sha512-function
- * All credits go to Dave McKellar
- *
- *
- * Updated to C++, zedwood.com 2012
- * Based on Olivier Gay's version
- * See Modified BSD License below:
- *
- * FIPS 180-2 SHA-224/256/384/512 implementation
- * Issue date:  04/30/2005
- * http://www.ouah.org/ogay/sha2/
- *
- * Copyright (C) 2005, 2007 Olivier Gay <olivier.gay@a3.epfl.ch>
- * All rights reserved.
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- * 1. Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- * 2. Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- * 3. Neither the name of the project nor the names of its contributors
- *    may be used to endorse or promote products derived from this software
- *    without specific prior written permission.
- *
- * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
- * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
- * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
- * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
- * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
- * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
- * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
- * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
- * SUCH DAMAGE.
- */
-
-class SHA512 {
-
-	protected:
-		const static boost::uint64_t sha512_k[];
-		static constexpr const unsigned int SHA384_512_BLOCK_SIZE = (1024/8);
-
-	public:
-		void init();
-		void update(const unsigned char *n_message, unsigned int n_len);
-		void final(unsigned char *n_digest);
-		static constexpr const unsigned int DIGEST_SIZE = ( 512 / 8);
-
-	protected:
-		void transform(const unsigned char *n_message, unsigned int n_block_nb);
-		unsigned int m_tot_len;
-		unsigned int m_len;
-		unsigned char m_block[2 * SHA384_512_BLOCK_SIZE];
-		boost::uint64_t m_h[8];
-};
-
-#define SHA2_SHFR(x, n)    (x >> n)
-#define SHA2_ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
-#define SHA2_ROTL(x, n)   ((x << n) | (x >> ((sizeof(x) << 3) - n)))
-#define SHA2_CH(x, y, z)  ((x & y) ^ (~x & z))
-#define SHA2_MAJ(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
-#define SHA512_F1(x) (SHA2_ROTR(x, 28) ^ SHA2_ROTR(x, 34) ^ SHA2_ROTR(x, 39))
-#define SHA512_F2(x) (SHA2_ROTR(x, 14) ^ SHA2_ROTR(x, 18) ^ SHA2_ROTR(x, 41))
-#define SHA512_F3(x) (SHA2_ROTR(x,  1) ^ SHA2_ROTR(x,  8) ^ SHA2_SHFR(x,  7))
-#define SHA512_F4(x) (SHA2_ROTR(x, 19) ^ SHA2_ROTR(x, 61) ^ SHA2_SHFR(x,  6))
-
-#define SHA2_UNPACK32(x, str)                                \
-{                                                            \
-	*((str) + 3) = static_cast<boost::uint8_t>((x)      );   \
-	*((str) + 2) = static_cast<boost::uint8_t>((x) >>  8);   \
-	*((str) + 1) = static_cast<boost::uint8_t>((x) >> 16);   \
-	*((str) + 0) = static_cast<boost::uint8_t>((x) >> 24);   \
-}
+using namespace moose::tools;
+
+namespace {
+
+//! SHA-512 is big endian throughout, whatever the host is
+inline boost::uint64_t load_big(const boost::uint8_t *n_src) noexcept {
 
-#define SHA2_UNPACK64(x, str)                                \
-{                                                            \
-	*((str) + 7) = static_cast<boost::uint8_t>((x)      );   \
-	*((str) + 6) = static_cast<boost::uint8_t>((x) >>  8);   \
-	*((str) + 5) = static_cast<boost::uint8_t>((x) >> 16);   \
-	*((str) + 4) = static_cast<boost::uint8_t>((x) >> 24);   \
-	*((str) + 3) = static_cast<boost::uint8_t>((x) >> 32);   \
-	*((str) + 2) = static_cast<boost::uint8_t>((x) >> 40);   \
-	*((str) + 1) = static_cast<boost::uint8_t>((x) >> 48);   \
-	*((str) + 0) = static_cast<boost::uint8_t>((x) >> 56);   \
+	boost::uint64_t word;
+	std::memcpy(&word, n_src, sizeof(word));
+	return boost::endian::big_to_native(word);
 }
 
-#define SHA2_PACK64(str, x)                            \
-{                                                      \
-	*(x) =   ((boost::uint64_t) *((str) + 7)      )    \
-	       | ((boost::uint64_t) *((str) + 6) <<  8)    \
-	       | ((boost::uint64_t) *((str) + 5) << 16)    \
-	       | ((boost::uint64_t) *((str) + 4) << 24)    \
-	       | ((boost::uint64_t) *((str) + 3) << 32)    \
-	       | ((boost::uint64_t) *((str) + 2) << 40)    \
-	       | ((boost::uint64_t) *((str) + 1) << 48)    \
-	       | ((boost::uint64_t) *((str) + 0) << 56);   \
+inline void store_big(boost::uint8_t *n_dst, const boost::uint64_t n_word) noexcept {
+
+	const boost::uint64_t word = boost::endian::native_to_big(n_word);
+	std::memcpy(n_dst, &word, sizeof(word));
 }
 
-const boost::uint64_t SHA512::sha512_k[80] = //ULL = uint64
-            {0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
-             0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
-             0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
-             0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
-             0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
-             0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
-             0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
-             0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
-             0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
-             0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
-             0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
-             0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
-             0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
-             0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
-             0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
-             0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
-             0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
-             0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
-             0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
-             0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
-             0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
-             0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
-             0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
-             0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
-             0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
-             0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
-             0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
-             0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
-             0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
-             0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
-             0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
-             0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
-             0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
-             0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
-             0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
-             0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
-             0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
-             0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
-             0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
-             0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
-
-void SHA512::transform(const unsigned char *n_message, unsigned int n_block_nb) {
+} // anon namespace
+
+namespace detail {
+
+void sha512_compress_scalar(boost::uint64_t *n_state, const boost::uint8_t *n_blocks, const std::size_t n_blocks_count) {
 
 	boost::uint64_t w[80];
-	boost::uint64_t wv[8];
-	boost::uint64_t t1, t2;
-	const unsigned char *sub_block;
-
-	int i, j;
-	for (i = 0; i < static_cast<int>(n_block_nb); i++) {
-		sub_block = n_message + (i << 7);
-		for (j = 0; j < 16; j++) {
-			SHA2_PACK64(&sub_block[j << 3], &w[j])
-		}
-		for (j = 16; j < 80; j++) {
-			w[j] =  SHA512_F4(w[j -  2]) + w[j -  7] + SHA512_F3(w[j - 15]) + w[j - 16];
-		}
-		for (j = 0; j < 8; j++) {
-			wv[j] = m_h[j];
+	for (std::size_t i = 0; i < n_blocks_count; i++) {
+		const boost::uint8_t *block = n_blocks + i * 128;
+
+		for (std::size_t t = 0; t < 16; t++) {
+			w[t] = load_big(block + t * 8);
 		}
-		for (j = 0; j < 80; j++) {
-			t1 = wv[7] + SHA512_F2(wv[4]) + SHA2_CH(wv[4], wv[5], wv[6])
-			    + sha512_k[j] + w[j];
-			t2 = SHA512_F1(wv[0]) + SHA2_MAJ(wv[0], wv[1], wv[2]);
-			wv[7] = wv[6];
-			wv[6] = wv[5];
-			wv[5] = wv[4];
-			wv[4] = wv[3] + t1;
-			wv[3] = wv[2];
-			wv[2] = wv[1];
-			wv[1] = wv[0];
-			wv[0] = t1 + t2;
+		for (std::size_t t = 16; t < 80; t++) {
+			const boost::uint64_t s0 = rotr<1>(w[t - 15]) ^ rotr<8>(w[t - 15]) ^ (w[t - 15] >> 7);
+			const boost::uint64_t s1 = rotr<19>(w[t - 2]) ^ rotr<61>(w[t - 2]) ^ (w[t - 2] >> 6);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
 		}
-		for (j = 0; j < 8; j++) {
-			m_h[j] += wv[j];
+		for (std::size_t t = 0; t < 80; t++) {
+			w[t] += sha512_k[t];
 		}
 
+		sha512_rounds(n_state, w);
 	}
 }
 
-void SHA512::init() {
-
-	m_h[0] = 0x6a09e667f3bcc908ULL;
-	m_h[1] = 0xbb67ae8584caa73bULL;
-	m_h[2] = 0x3c6ef372fe94f82bULL;
-	m_h[3] = 0xa54ff53a5f1d36f1ULL;
-	m_h[4] = 0x510e527fade682d1ULL;
-	m_h[5] = 0x9b05688c2b3e6c1fULL;
-	m_h[6] = 0x1f83d9abfb41bd6bULL;
-	m_h[7] = 0x5be0cd19137e2179ULL;
-	m_len = 0;
-	m_tot_len = 0;
+} // namespace detail
+
+namespace {
+
+detail::sha512_compress_fn compress_function(const simd_level n_level) {
+
+	if (!simd_supported(n_level)) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("SHA-512 kernel not supported on this machine")
+		            << error_argument(to_string(n_level)));
+	}
+
+	switch (n_level) {
+#if defined(RESCUE_SIMD_X86)
+		// There is nothing to gain from wider vectors in a single message schedule
+		case simd_level::avx2:
+		case simd_level::avx512:
+			return detail::sha512_compress_avx2;
+#endif
+		default:
+			return detail::sha512_compress_scalar;
+	}
 }
 
-void SHA512::update(const unsigned char *n_message, unsigned int n_len) {
-
-	unsigned int block_nb;
-	unsigned int new_len, rem_len, tmp_len;
-	const unsigned char *shifted_message;
-	tmp_len = SHA384_512_BLOCK_SIZE - m_len;
-	rem_len = n_len < tmp_len ? n_len : tmp_len;
-	memcpy(&m_block[m_len], n_message, rem_len);
-	if (m_len + n_len < SHA384_512_BLOCK_SIZE) {
-		m_len += n_len;
-		return;
+detail::sha512_compress_lanes_fn compress_lanes_function(const simd_level n_level) {
+
+	switch (n_level) {
+#if defined(RESCUE_SIMD_X86)
+		case simd_level::avx2:
+			return detail::sha512_compress_lanes_avx2;
+		case simd_level::avx512:
+			return detail::sha512_compress_lanes_avx512;
+#endif
+		default:
+			return nullptr;
 	}
-	new_len = n_len - rem_len;
-	block_nb = new_len / SHA384_512_BLOCK_SIZE;
-	shifted_message = n_message + rem_len;
-	transform(m_block, 1);
-	transform(shifted_message, block_nb);
-	rem_len = new_len % SHA384_512_BLOCK_SIZE;
-	memcpy(m_block, &shifted_message[block_nb << 7], rem_len);
-	m_len = rem_len;
-	m_tot_len += (block_nb + 1) << 7;
 }
 
-void SHA512::final(unsigned char *n_digest) {
-
-	unsigned int block_nb;
-	unsigned int pm_len;
-	unsigned int len_b;
-	int i;
-	block_nb = 1 + ((SHA384_512_BLOCK_SIZE - 17)
-	                 < (m_len % SHA384_512_BLOCK_SIZE));
-	len_b = (m_tot_len + m_len) << 3;
-	pm_len = block_nb << 7;
-	memset(m_block + m_len, 0, pm_len - m_len);
-	m_block[m_len] = 0x80;
-	SHA2_UNPACK32(len_b, m_block + pm_len - 4)
-	transform(m_block, block_nb);
-	for (i = 0 ; i < 8; i++) {
-		SHA2_UNPACK64(m_h[i], &n_digest[i << 3])
+//! @return how many blocks n_size bytes take with padding and length
+inline std::size_t padded_blocks(const std::size_t n_size) noexcept {
+
+	return (n_size + 16) / 128 + 1;
+}
+
+//! write block n_index of the padded message n_input as big endian words, word w to n_words[w * n_stride]
+void load_padded_block(const std::string &n_input, const std::size_t n_index, boost::uint64_t *n_words, const std::size_t n_stride) {
+
+	boost::uint8_t block[128] = {};
+
+	const std::size_t offset = n_index * 128;
+	if (offset < n_input.size()) {
+		std::memcpy(block, n_input.data() + offset, std::min<std::size_t>(128, n_input.size() - offset));
+	}
+	if (offset <= n_input.size() && n_input.size() < offset + 128) {
+		block[n_input.size() - offset] = 0x80;
+	}
+	if (n_index + 1 == padded_blocks(n_input.size())) {
+		store_big(block + 112, static_cast<boost::uint64_t>(n_input.size()) >> 61);
+		store_big(block + 120, static_cast<boost::uint64_t>(n_input.size()) << 3);
+	}
+
+	for (std::size_t w = 0; w < 16; w++) {
+		n_words[w * n_stride] = load_big(block + w * 8);
 	}
 }
 
+const char hex_digits[] = "0123456789abcdef";
 
-std::string sha512(const std::string &n_input) {
+} // anon namespace
+
+sha512_digest sha512_raw(const boost::uint8_t *n_data, const std::size_t n_size, const simd_level n_level) {
+
+	const detail::sha512_compress_fn compress = compress_function(n_level);
+
+	boost::uint64_t state[8];
+	std::memcpy(state, detail::sha512_iv, sizeof(state));
 
-	unsigned char digest[SHA512::DIGEST_SIZE];
-	memset(digest, 0, SHA512::DIGEST_SIZE);
-	SHA512 ctx = SHA512();
+	// All complete blocks straight from the input
+	const std::size_t full_blocks = n_size / 128;
+	compress(state, n_data, full_blocks);
 
-	ctx.init();
-	ctx.update((unsigned const char *)n_input.c_str(), n_input.length());
-	ctx.final(digest);
+	// The rest and the padding take one or two more blocks
+	boost::uint8_t tail[256] = {};
+	const std::size_t rest = n_size % 128;
+	if (rest) {
+		std::memcpy(tail, n_data + full_blocks * 128, rest);
+	}
+	tail[rest] = 0x80;
+
+	const std::size_t tail_size = (rest < 112) ? 128 : 256;
+	store_big(tail + tail_size - 16, static_cast<boost::uint64_t>(n_size) >> 61);
+	store_big(tail + tail_size - 8, static_cast<boost::uint64_t>(n_size) << 3);
+	compress(state, tail, tail_size / 128);
 
-	char buf[2*SHA512::DIGEST_SIZE+1];
-	buf[2*SHA512::DIGEST_SIZE] = 0;
-	for (unsigned int i = 0; i < SHA512::DIGEST_SIZE; i++) {
-		sprintf(buf+i*2, "%02x", digest[i]);
+	sha512_digest digest;
+	for (std::size_t i = 0; i < 8; i++) {
+		store_big(digest.data() + i * 8, state[i]);
 	}
-	return std::string(buf);
+	return digest;
 }
 
+sha512_digest sha512_raw(const std::string &n_input) {
 
+	return sha512_raw(reinterpret_cast<const boost::uint8_t *>(n_input.data()), n_input.size());
 }
+
+std::size_t sha512_lanes(const simd_level n_level) noexcept {
+
+	switch (n_level) {
+		case simd_level::avx2:
+			return 4;
+		case simd_level::avx512:
+			return 8;
+		default:
+		case simd_level::scalar:
+			return 1;
+	}
+}
+
+void sha512_batch(const std::vector<std::string> &n_inputs, std::vector<sha512_digest> &n_digests, const simd_level n_level) {
+
+	if (!simd_supported(n_level)) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("SHA-512 kernel not supported on this machine")
+		            << error_argument(to_string(n_level)));
+	}
+
+	n_digests.resize(n_inputs.size());
+
+	const std::size_t lanes = sha512_lanes(n_level);
+	const detail::sha512_compress_lanes_fn compress = compress_lanes_function(n_level);
+
+	// Lanes without a message or whose message is done hash whatever is left in there
+	boost::uint64_t state[8 * 8];
+	boost::uint64_t block[16 * 8] = {};
+
+	std::size_t i = 0;
+	for (; compress && (i + 1 < n_inputs.size()); i += lanes) {
+
+		const std::size_t count = std::min(lanes, n_inputs.size() - i);
+
+		std::size_t blocks = 0;
+		for (std::size_t l = 0; l < count; l++) {
+			blocks = std::max(blocks, padded_blocks(n_inputs[i + l].size()));
+		}
+
+		for (std::size_t w = 0; w < 8; w++) {
+			for (std::size_t l = 0; l < lanes; l++) {
+				state[w * lanes + l] = detail::sha512_iv[w];
+			}
+		}
+
+		for (std::size_t b = 0; b < blocks; b++) {
+
+			for (std::size_t l = 0; l < count; l++) {
+				if (b < padded_blocks(n_inputs[i + l].size())) {
+					load_padded_block(n_inputs[i + l], b, block + l, lanes);
+				}
+			}
+
+			compress(state, block);
+
+			for (std::size_t l = 0; l < count; l++) {
+				if (b + 1 == padded_blocks(n_inputs[i + l].size())) {
+					for (std::size_t w = 0; w < 8; w++) {
+						store_big(n_digests[i + l].data() + w * 8, state[w * lanes + l]);
+					}
+				}
+			}
+		}
+	}
+
+	// Scalar and a single message left over need no lanes
+	for (; i < n_inputs.size(); i++) {
+		n_digests[i] = sha512_raw(reinterpret_cast<const boost::uint8_t *>(n_inputs[i].data()), n_inputs[i].size(), simd_level::scalar);
+	}
+}
+
+std::string sha512(const std::string &n_input) {
+
+	return to_hex(sha512_raw(n_input));
 }
+
+void to_hex(const boost::uint8_t *n_data, const std::size_t n_size, char *n_out) noexcept {
+
+	for (std::size_t i = 0; i < n_size; i++) {
+		n_out[2 * i]     = hex_digits[n_data[i] >> 4];
+		n_out[2 * i + 1] = hex_digits[n_data[i] & 0x0f];
+	}
+}
+
+std::string to_hex(const sha512_digest &n_digest) {
+
+	std::string hex(2 * n_digest.size(), '\0');
+	to_hex(n_digest.data(), n_digest.size(), &hex[0]);
+	return hex;
+}
+
+} // namespace rescue
+} // namespace moose
@@ -4,13 +4,56 @@
 
 #pragma once
 #include "RescueConfig.hpp"
+#include "Simd.hpp"
 
+#include <boost/cstdint.hpp>
+
+#include <array>
 #include <string>
+#include <vector>
 
 namespace moose {
 namespace rescue {
 
+//! A binary SHA-512 digest
+using sha512_digest = std::array<boost::uint8_t, 64>;
+
+/*! @brief SHA-512 of n_size bytes at n_data, without allocating
+
+	AVX2 and up vectorize the message schedule, scalar does it all word by word.
+
+	@throw internal_error when n_level isn't supported here
+ */
+RESCUE_API sha512_digest sha512_raw(const boost::uint8_t *n_data, const std::size_t n_size,
+                                    const simd_level n_level = cpu_simd_level());
+
+//! @return SHA-512 of n_input as 64 bytes
+RESCUE_API sha512_digest sha512_raw(const std::string &n_input);
+
+//! how many messages sha512_batch() hashes at once: 1 for scalar, 4 for AVX2 and 8 for AVX-512
+RESCUE_API std::size_t sha512_lanes(const simd_level n_level = cpu_simd_level()) noexcept;
+
+/*! @brief SHA-512 of many messages at once, each giving the same digest as sha512_raw()
+
+	Messages are spread across the SIMD lanes, so sha512_lanes() short
+	messages cost about as much as a single one does in scalar code.
+	Lanes whose message is shorter idle while the longest one finishes,
+	which makes this best for many messages of similar length, like candidates.
+
+	@param n_digests will hold one digest per input, in the order of n_inputs
+	@throw internal_error when n_level isn't supported here
+ */
+RESCUE_API void sha512_batch(const std::vector<std::string> &n_inputs, std::vector<sha512_digest> &n_digests,
+                             const simd_level n_level = cpu_simd_level());
+
+//! @return SHA-512 of n_input as 128 lowercase hex digits
 RESCUE_API std::string sha512(const std::string &n_input);
 
+//! write 2 * n_size lowercase hex digits for n_data to n_out, no terminator
+RESCUE_API void to_hex(const boost::uint8_t *n_data, const std::size_t n_size, char *n_out) noexcept;
+
+//! @return the digest as 128 lowercase hex digits
+RESCUE_API std::string to_hex(const sha512_digest &n_digest);
+
 } // namespace rescue
 } // namespace moose
@@ -0,0 +1,97 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// AVX2 message schedule for single buffer SHA-512 and four lane multi buffer
+// SHA-512. This file is compiled with -mavx2 and only called after the CPU
+// was found to support it.
+
+#include "Sha512Kernel.hpp"
+
+#include <immintrin.h>
+
+namespace moose {
+namespace rescue {
+namespace detail {
+
+namespace {
+
+typedef boost::uint64_t u64x4 __attribute__((vector_size(32)));
+
+template <int Bits>
+inline __m256i rotr256(const __m256i n_x) {
+
+	return _mm256_or_si256(_mm256_srli_epi64(n_x, Bits), _mm256_slli_epi64(n_x, 64 - Bits));
+}
+
+template <int Bits>
+inline __m128i rotr128(const __m128i n_x) {
+
+	return _mm_or_si128(_mm_srli_epi64(n_x, Bits), _mm_slli_epi64(n_x, 64 - Bits));
+}
+
+inline __m256i sigma0(const __m256i n_x) {
+
+	return _mm256_xor_si256(_mm256_xor_si256(rotr256<1>(n_x), rotr256<8>(n_x)), _mm256_srli_epi64(n_x, 7));
+}
+
+inline __m128i sigma1(const __m128i n_x) {
+
+	return _mm_xor_si128(_mm_xor_si128(rotr128<19>(n_x), rotr128<61>(n_x)), _mm_srli_epi64(n_x, 6));
+}
+
+inline __m256i load(const boost::uint64_t *n_words) {
+
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(n_words));
+}
+
+} // anon namespace
+
+void sha512_compress_avx2(boost::uint64_t *n_state, const boost::uint8_t *n_blocks, const std::size_t n_blocks_count) {
+
+	// Reverses the bytes of each 64 bit word
+	const __m256i bswap = _mm256_set_epi8(
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+	alignas(32) boost::uint64_t w[80];
+	alignas(32) boost::uint64_t wk[80];
+
+	for (std::size_t i = 0; i < n_blocks_count; i++) {
+		const boost::uint8_t *block = n_blocks + i * 128;
+
+		for (std::size_t t = 0; t < 16; t += 4) {
+			const __m256i words = _mm256_shuffle_epi8(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + t * 8)), bswap);
+			_mm256_store_si256(reinterpret_cast<__m256i *>(w + t), words);
+			_mm256_store_si256(reinterpret_cast<__m256i *>(wk + t), _mm256_add_epi64(words, load(sha512_k + t)));
+		}
+
+		/* Four words at a time. The upper two of them depend on the lower two
+		 * through sigma1, so those are finished first and then fed back.
+		 */
+		for (std::size_t t = 16; t < 80; t += 4) {
+			const __m256i partial = _mm256_add_epi64(
+				_mm256_add_epi64(load(w + t - 16), sigma0(load(w + t - 15))), load(w + t - 7));
+
+			const __m128i low = _mm_add_epi64(_mm256_castsi256_si128(partial),
+				sigma1(_mm_load_si128(reinterpret_cast<const __m128i *>(w + t - 2))));
+			const __m128i high = _mm_add_epi64(_mm256_extracti128_si256(partial, 1), sigma1(low));
+
+			const __m256i words = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+			_mm256_store_si256(reinterpret_cast<__m256i *>(w + t), words);
+			_mm256_store_si256(reinterpret_cast<__m256i *>(wk + t), _mm256_add_epi64(words, load(sha512_k + t)));
+		}
+
+		sha512_rounds(n_state, wk);
+	}
+}
+
+void sha512_compress_lanes_avx2(boost::uint64_t *n_state, const boost::uint64_t *n_block) {
+
+	sha512_compress_lanes<u64x4>(n_state, n_block);
+}
+
+} // namespace detail
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,27 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Eight lane multi buffer SHA-512. This file is compiled with -mavx512f
+// and only called after the CPU was found to support it.
+
+#include "Sha512Kernel.hpp"
+
+namespace moose {
+namespace rescue {
+namespace detail {
+
+namespace {
+
+typedef boost::uint64_t u64x8 __attribute__((vector_size(64)));
+
+} // anon namespace
+
+void sha512_compress_lanes_avx512(boost::uint64_t *n_state, const boost::uint64_t *n_block) {
+
+	sha512_compress_lanes<u64x8>(n_state, n_block);
+}
+
+} // namespace detail
+} // namespace rescue
+} // namespace moose
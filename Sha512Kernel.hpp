@@ -0,0 +1,102 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "Pbkdf2Kernel.hpp"
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+// Internal to the SHA-512 implementation, not installed.
+// Constants and the lane-generic compression come from the PBKDF2 kernels.
+
+namespace moose {
+namespace rescue {
+namespace detail {
+
+/* Single buffer compression entry points, one per instruction set.
+ * They run n_blocks consecutive 128 byte blocks of big endian message
+ * through the eight state words.
+ */
+using sha512_compress_fn = void (*)(boost::uint64_t *n_state, const boost::uint8_t *n_blocks, const std::size_t n_blocks_count);
+
+void sha512_compress_scalar(boost::uint64_t *n_state, const boost::uint8_t *n_blocks, const std::size_t n_blocks_count);
+
+/* Multi buffer compression of one block per lane, as many lanes as sha512_lanes() says.
+ * State and block are word major like the PBKDF2 kernels: word w of lane l is at [w * lanes + l].
+ */
+using sha512_compress_lanes_fn = void (*)(boost::uint64_t *n_state, const boost::uint64_t *n_block);
+
+#if defined(RESCUE_SIMD_X86)
+void sha512_compress_avx2(boost::uint64_t *n_state, const boost::uint8_t *n_blocks, const std::size_t n_blocks_count);
+
+void sha512_compress_lanes_avx2(boost::uint64_t *n_state, const boost::uint64_t *n_block);
+
+void sha512_compress_lanes_avx512(boost::uint64_t *n_state, const boost::uint64_t *n_block);
+#endif
+
+namespace {
+
+//! One round, with the roles of the working variables passed in rotated instead of moving them
+inline void sha512_round(const boost::uint64_t n_a, const boost::uint64_t n_b, const boost::uint64_t n_c, boost::uint64_t &n_d,
+                         const boost::uint64_t n_e, const boost::uint64_t n_f, const boost::uint64_t n_g, boost::uint64_t &n_h,
+                         const boost::uint64_t n_wk) {
+
+	const boost::uint64_t t1 = n_h + (rotr<14>(n_e) ^ rotr<18>(n_e) ^ rotr<41>(n_e)) + (n_g ^ (n_e & (n_f ^ n_g))) + n_wk;
+	const boost::uint64_t t2 = (rotr<28>(n_a) ^ rotr<34>(n_a) ^ rotr<39>(n_a)) + ((n_a & n_b) | (n_c & (n_a | n_b)));
+	n_d += t1;
+	n_h = t1 + t2;
+}
+
+/* The 80 rounds on a message schedule that already has the round constants
+ * added in, as both the scalar and the vectorized schedule produce it.
+ */
+inline void sha512_rounds(boost::uint64_t *n_state, const boost::uint64_t *n_wk) {
+
+	boost::uint64_t a = n_state[0], b = n_state[1], c = n_state[2], d = n_state[3];
+	boost::uint64_t e = n_state[4], f = n_state[5], g = n_state[6], h = n_state[7];
+
+	for (std::size_t t = 0; t < 80; t += 8) {
+		sha512_round(a, b, c, d, e, f, g, h, n_wk[t]);
+		sha512_round(h, a, b, c, d, e, f, g, n_wk[t + 1]);
+		sha512_round(g, h, a, b, c, d, e, f, n_wk[t + 2]);
+		sha512_round(f, g, h, a, b, c, d, e, n_wk[t + 3]);
+		sha512_round(e, f, g, h, a, b, c, d, n_wk[t + 4]);
+		sha512_round(d, e, f, g, h, a, b, c, n_wk[t + 5]);
+		sha512_round(c, d, e, f, g, h, a, b, n_wk[t + 6]);
+		sha512_round(b, c, d, e, f, g, h, a, n_wk[t + 7]);
+	}
+
+	n_state[0] += a;
+	n_state[1] += b;
+	n_state[2] += c;
+	n_state[3] += d;
+	n_state[4] += e;
+	n_state[5] += f;
+	n_state[6] += g;
+	n_state[7] += h;
+}
+
+//! Load the word major lanes into vectors of type V, compress and store the state again
+template <typename V>
+void sha512_compress_lanes(boost::uint64_t *n_state, const boost::uint64_t *n_block) {
+
+	V state[8];
+	V block[16];
+
+	std::memcpy(state, n_state, sizeof(state));
+	std::memcpy(block, n_block, sizeof(block));
+
+	sha512_traits::compress<V>(state, block);
+
+	std::memcpy(n_state, state, sizeof(state));
+}
+
+} // anon namespace
+
+} // namespace detail
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,53 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "Simd.hpp"
+
+namespace moose {
+namespace rescue {
+
+namespace {
+
+simd_level detect_simd_level() noexcept {
+
+#if defined(RESCUE_SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return simd_level::avx512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return simd_level::avx2;
+	}
+#endif
+	return simd_level::scalar;
+}
+
+} // anon namespace
+
+simd_level cpu_simd_level() noexcept {
+
+	static const simd_level level = detect_simd_level();
+	return level;
+}
+
+bool simd_supported(const simd_level n_level) noexcept {
+
+	return static_cast<int>(n_level) <= static_cast<int>(cpu_simd_level());
+}
+
+const char *to_string(const simd_level n_level) noexcept {
+
+	switch (n_level) {
+		case simd_level::avx2:
+			return "avx2";
+		case simd_level::avx512:
+			return "avx512";
+		default:
+		case simd_level::scalar:
+			return "scalar";
+	}
+}
+
+} // namespace rescue
+} // namespace moose
@@ -0,0 +1,31 @@
+// Copyright 2019 Stephan Menzel. Distributed under the Boost
+// Software License, Version 1.0. (See accompanying file
+// LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "RescueConfig.hpp"
+
+namespace moose {
+namespace rescue {
+
+/*! @brief Instruction sets our hash kernels are built for
+
+	Kernels for anything but scalar are only built on x86 with GCC or Clang
+	and only used when the CPU we run on supports them.
+ */
+enum class simd_level {
+	scalar,
+	avx2,
+	avx512
+};
+
+//! @return the best level this build and CPU support, detected once
+simd_level RESCUE_API cpu_simd_level() noexcept;
+
+//! @return true when kernels for n_level are built in and the CPU can run them
+bool RESCUE_API simd_supported(const simd_level n_level) noexcept;
+
+RESCUE_API const char *to_string(const simd_level n_level) noexcept;
+
+} // namespace rescue
+} // namespace moose
@@ -3,6 +3,7 @@
 // LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "WorkQueue.hpp"
+#include "InputGenerator.hpp"
 #include "XorEnc.hpp"
 #include "Sha512.hpp"
 
@@ -14,7 +15,13 @@
 #include "tools/Error.hpp"
 
 #include <boost/variant.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <locale>
 #include <list>
 
@@ -27,18 +34,49 @@
 	rsc:passwords       hash of string to string      possible candidates for password
 													  key is the hash and value is the xor encrypted password
 
-	rsc:candidates      set of strings                set of hashes, which are keys to
-													  passwords that have not been processed yet.
-													  When one is processed, it is removed from here
-													  and put into failed (or success ;-)
+	rsc:pending         list of strings               hashes, which are keys to passwords that wait
+													  to be processed. Polling pops from the front.
 
-	rsc:lease:$HASH     string                        value is the xor encrypted password. Expire time is one minute.
-													  As long as this exists, the candidate is considered locked
+	rsc:leases          sorted set of strings         hashes currently being worked on, scored by the
+													  unix time their lease expires. Expired ones are moved
+													  back to the front of rsc:pending in bulk by the next poll.
+													  The score doubles as proof of the lease: returning a hash
+													  with the expiry it was polled with removes it from here.
+													  The result goes into failed (or success ;-) either way
 
 	rsc:failed          set of strings                failed attempts as hash
 
 	rsc:success         set of strings                successful attempt(s?) as hash
 
+	Alternatively the queue can hold chunks of candidates. Those are identified by the hash
+	of their range and pattern and live in a parallel set of keys:
+
+	rsc:chunks          hash of string to string      chunks of candidates, value is
+													  "$BEGIN $END $XOR_ENCRYPTED_PATTERN"
+
+	rsc:chunk_pending   list of strings               chunk hashes waiting to be processed
+
+	rsc:chunk_leases    sorted set of strings         chunk hashes being worked on, scored by lease expiry,
+													  returned like rsc:leases
+
+	rsc:chunk_failed    set of strings                failed chunks as hash
+
+	rsc:chunk_success   set of strings                chunks containing the password as hash
+
+	Earlier versions kept the unprocessed hashes in the sets rsc:candidates and rsc:chunk_candidates
+	and searched them for one without a lease key on every poll. Those sets are drained into
+	the pending lists by polling, so old queues keep working.
+
+	rsc:keyformat       string                        how items are keyed, "hex" or "binary".
+													  Clients always send the SHA-512 as hex digits.
+													  With binary, the scripts key by its first 16 bytes
+													  instead, which cuts the memory used for keys in all of
+													  the above several-fold. Queues without this are hex.
+
+	rsc:queueid         string                        random identity of the queue, chosen anew whenever
+													  it is empty. Files kept next to a queue, like the
+													  client's candidate filter, record it to tell a queue
+													  that was reset and filled again from the one they belong to.
  */
 
 
@@ -48,35 +86,184 @@ namespace rescue {
 
 using namespace moose::tools;
 
+namespace {
+
+/* All scripts operate on either of these. Order matters, the scripts refer to them as
+ * KEYS[1]  items
+ * KEYS[2]  pending
+ * KEYS[3]  leases
+ * KEYS[4]  failed
+ * KEYS[5]  success
+ * KEYS[6]  legacy candidates set
+ * KEYS[7]  key format, shared by both
+ */
+const std::vector<std::string> candidate_keys{
+	"rsc:passwords", "rsc:pending", "rsc:leases", "rsc:failed", "rsc:success", "rsc:candidates", "rsc:keyformat"
+};
+
+const std::vector<std::string> chunk_keys{
+	"rsc:chunks", "rsc:chunk_pending", "rsc:chunk_leases", "rsc:chunk_failed", "rsc:chunk_success", "rsc:chunk_candidates", "rsc:keyformat"
+};
+
+const std::string queue_id_key{ "rsc:queueid" };
+
+} // anon namespace
+
+/* Common head of all scripts that get hashes from us. Defines item_key(),
+ * which turns the hex hash we send into the key used in this queue
+ *
+ * KEYS         as described above
+ */
+const std::string item_key{
+
+	"local binary_keys = (redis.call('get', KEYS[7]) == 'binary') "
+	"local function item_key(hash) "
+	    "if not binary_keys then "
+	        "return hash "
+	    "end "
+	    "return (string.gsub(string.sub(hash, 1, 32), '..', function(h) return string.char(tonumber(h, 16)) end)) "
+	"end "
+};
+
+/* Record the key format for a new queue or tell the one of the existing queue
+ *
+ * KEYS[1]      candidate items
+ * KEYS[2]      chunk items
+ * KEYS[3]      key format
+ *
+ * ARGV[1]      requested format, "hex" or "binary"
+ *
+ * returns the format in use
+ */
+const std::string establish_format{
+
+	// Every item ever queued stays in the items. Without any, the queue is new
+	"if (redis.call('exists', KEYS[1]) == 0) and (redis.call('exists', KEYS[2]) == 0) then "
+	    "redis.call('set', KEYS[3], ARGV[1]) "
+	    "return ARGV[1] "
+	"end "
+
+	// Anything queued before the format was recorded is hex
+	"local format = redis.call('get', KEYS[3]) "
+	"if not format then "
+	    "format = 'hex' "
+	    "redis.call('set', KEYS[3], format) "
+	"end "
+	"return format "
+};
+
+/* Give a new queue a new identity or tell the one of the existing queue
+ *
+ * KEYS[1]      candidate items
+ * KEYS[2]      chunk items
+ * KEYS[3]      queue identity
+ *
+ * ARGV[1]      identity to use if a new one is needed
+ *
+ * returns the identity in use
+ */
+const std::string establish_identity{
+
+	// An empty queue is a new one, even if it had an identity before it was reset
+	"if (redis.call('exists', KEYS[1]) == 0) and (redis.call('exists', KEYS[2]) == 0) then "
+	    "redis.call('set', KEYS[3], ARGV[1]) "
+	    "return ARGV[1] "
+	"end "
+
+	// Queues from before identities were kept get one now
+	"redis.call('setnx', KEYS[3], ARGV[1]) "
+	"return redis.call('get', KEYS[3]) "
+};
+
+std::string queue_identity(mredis::AsyncClientSPtr n_redis) {
+
+	MOOSE_ASSERT(n_redis)
+
+	const std::vector<std::string> keys{
+		candidate_keys[0], chunk_keys[0], queue_id_key
+	};
+
+	// Scripts can't make up random numbers, so we offer one
+	const std::vector<std::string> args{
+		boost::uuids::to_string(boost::uuids::random_generator()())
+	};
+
+	mredis::BlockingRetriever<std::string> retriever{ 15 };
+	n_redis->eval(establish_identity, keys, args, retriever.responder());
+	const boost::optional<std::string> result = retriever.wait_for_response();
+
+	if (!result || result->empty()) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from queue identity script"));
+	}
+
+	BOOST_LOG_SEV(logger(), debug) << "Queue identity is " << *result;
+	return *result;
+}
+
+const char *to_string(const key_format n_format) noexcept {
+
+	return (n_format == key_format::binary) ? "binary" : "hex";
+}
+
+key_format establish_key_format(mredis::AsyncClientSPtr n_redis, const key_format n_requested) {
+
+	MOOSE_ASSERT(n_redis)
+
+	const std::vector<std::string> keys{
+		candidate_keys[0], chunk_keys[0], candidate_keys[6]
+	};
+
+	const std::vector<std::string> args{
+		to_string(n_requested)
+	};
+
+	mredis::BlockingRetriever<std::string> retriever{ 15 };
+	n_redis->eval(establish_format, keys, args, retriever.responder());
+	const boost::optional<std::string> result = retriever.wait_for_response();
+
+	if (!result) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from key format script"));
+	}
+
+	if ((*result != "hex") && (*result != "binary")) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("Unknown queue key format") << error_argument(*result));
+	}
+
+	const key_format format = (*result == "binary") ? key_format::binary : key_format::hex;
+	if (format != n_requested) {
+		BOOST_LOG_SEV(logger(), warning) << "Queue already holds items with " << *result << " keys, staying with those";
+	} else {
+		BOOST_LOG_SEV(logger(), normal) << "Queue uses " << *result << " keys";
+	}
+
+	return format;
+}
+
 /* Add the entry if not already done so
  *
- * KEYS[1]      rsc:lease:$HASH
+ * KEYS         as described above
  *
- * ARGV[1]      password
+ * ARGV[1]      password or serialized chunk
  * ARGV[2]      hash
  *
  * returns:
  *     0 on success
  *    -1 on password already known
  */
-const std::string enter_candidate{
+const std::string enter_candidate{ item_key +
 
-	// If a lease already exists, the candidate and everything else must exist as well.
-	// this means the passwd is already known. Cheap check early
-	"if redis.call('exists', KEYS[1]) == 1 then "
-	    "return -1 "
-	"end "
+	"local key = item_key(ARGV[2]) "
 
-	// The same is true is the entry is already added. Expensive check later
-	"if redis.call('hexists', 'rsc:passwords', ARGV[2]) == 1 then "
+	// Every item that was ever queued stays in here, no matter if it has been processed
+	"if redis.call('hexists', KEYS[1], key) == 1 then "
 	    "return -1 "
 	"end "
 
 	// If we are here, we can safely insert the value. Into the hash -> value map first
-	"redis.call('hset', 'rsc:passwords', ARGV[2], ARGV[1]) "
+	"redis.call('hset', KEYS[1], key, ARGV[1]) "
 
-	// and into the set of candidates
-	"redis.call('sadd', 'rsc:candidates', ARGV[2]) "
+	// and to the end of the pending list
+	"redis.call('rpush', KEYS[2], key) "
 	"return 0"
 };
 
@@ -92,10 +279,6 @@ bool queue_candidate(mredis::AsyncClientSPtr n_redis, const std::string &n_candi
 	try {
 		const std::string hash = sha512(n_candidate);
 
-		const std::vector<std::string> keys{
-			"rsc:lease:" + hash
-		};
-
 		const std::vector<std::string> args{
 			encrypt_decrypt(n_candidate),
 			hash
@@ -104,7 +287,7 @@ bool queue_candidate(mredis::AsyncClientSPtr n_redis, const std::string &n_candi
 		BOOST_LOG_SEV(logger(), normal) << "Inserting hash for password candidate: " << hash;
 
 		mredis::BlockingRetriever<boost::int64_t> inserter{ 15 };
-		n_redis->eval(enter_candidate, keys, args, inserter.responder());
+		n_redis->eval(enter_candidate, candidate_keys, args, inserter.responder());
 		const boost::optional<boost::int64_t> result = inserter.wait_for_response();
 
 		if (!result) {
@@ -134,145 +317,1049 @@ bool queue_candidate(mredis::AsyncClientSPtr n_redis, const std::string &n_candi
 	return false;
 }
 
-/* Poll an entry from the work queue
+/* Add a batch of entries, skipping those already known
+ *
+ * KEYS         as described above
+ *
+ * ARGV[2n-1]   password
+ * ARGV[2n]     hash
  *
  * returns:
- *     xor encrypted password when lease is established (for 1 minute)
- *     nil when no work item is available
+ *     number of entries inserted
  */
-const std::string poll_queue{
-
-	// Iterate the set of candidates until we either find one that doesn't have a lease
-	// or end of the set
-	"local keys = {} "
-	"local done = false "
-	"local cursor = '0' "
-	"repeat "
-	    "local result = redis.call('sscan', 'rsc:candidates', cursor) "
-	    "cursor = result[1] "
-	    "keys = result[2] "
-	    "for i, hash in ipairs(keys) do "
-	        "local lease_key = 'rsc:lease:' .. hash "
-
-	        "if redis.call('exists', lease_key) == 0 then "
-
-	            // This is the candidate we are looking for. Get the password associated with
-	            // it and create a lease
-
-	            "local enc_password = redis.call('hget', 'rsc:passwords', hash) "
-	            "redis.call('set', lease_key, enc_password, 'EX', '60') "
-	            "return enc_password "
-	        "end "
-	    "end "
-	    "if cursor == '0' then "
-	        "done = true "
+const std::string enter_candidates{ item_key +
+
+	"local inserted = 0 "
+	"for i = 1, #ARGV, 2 do "
+	    "local key = item_key(ARGV[i + 1]) "
+	    "if redis.call('hsetnx', KEYS[1], key, ARGV[i]) == 1 then "
+	        "redis.call('rpush', KEYS[2], key) "
+	        "inserted = inserted + 1 "
 	    "end "
-	"until done "
-	"return nil "
+	"end "
+	"return inserted"
 };
 
-bool poll_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate) {
+struct BatchInserter::Batch {
 
-	MOOSE_ASSERT(n_redis)
+	explicit Batch(const std::size_t n_size)
+	        : m_size{ n_size }
+	        , m_retriever{ 60 } {
+	}
 
-	try {
-		const std::vector<std::string> keys;
-		const std::vector<std::string> args;
+	const std::size_t                         m_size;
+	mredis::BlockingRetriever<boost::int64_t> m_retriever;
+};
 
-		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for password candidate...";
+BatchInserter::BatchInserter(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size, const std::size_t n_max_in_flight,
+                             BloomFilter *n_filter)
+        : m_redis{ n_redis }
+        , m_batch_size{ std::max<std::size_t>(n_batch_size, 1) }
+        , m_max_in_flight{ std::max<std::size_t>(n_max_in_flight, 1) }
+        , m_filter{ n_filter }
+        , m_inserted{ 0 }
+        , m_skipped{ 0 } {
 
-		mredis::BlockingRetriever<std::string> poller{ 15 };
-		n_redis->eval(poll_queue, keys, args, poller.responder());
-		const boost::optional<std::string> result = poller.wait_for_response();
+	MOOSE_ASSERT(m_redis)
 
-		if (!result || result->empty()) {
-			// we have no item in the Q that isn't already leased
-			return false;
-		} else {
-			// Decrypt and return. Caller now has 60 seconds to work on it.
-			n_candidate = encrypt_decrypt(*result);
-			return true;
+	m_candidates.reserve(m_batch_size);
+	m_args.reserve(2 * m_batch_size);
+}
+
+BatchInserter::~BatchInserter() noexcept {
+
+	// The retrievers must not go away before their responses came in
+	while (!m_in_flight.empty()) {
+		try {
+			wait_for_oldest();
+		} catch (const std::exception &sex) {
+			BOOST_LOG_SEV(logger(), error) << "Failed to insert candidate batch: " << sex.what();
 		}
+	}
+}
 
-	} catch (const moose_error &merr) {
-		BOOST_LOG_SEV(logger(), error) << "Failed to to poll password candidate: "
-		        << boost::diagnostic_information(merr);
+void BatchInserter::add(const std::string &n_candidate) {
+
+	if (n_candidate.empty()) {
+		BOOST_LOG_SEV(logger(), warning) << "Empty candidate could not be queued";
+		return;
 	}
 
-	return false;
+	m_candidates.push_back(n_candidate);
+
+	if (m_candidates.size() >= m_batch_size) {
+		send();
+	}
+}
+
+void BatchInserter::add(const prepared_batch &n_batch) {
+
+	MOOSE_ASSERT(n_batch.m_items.size() == n_batch.m_digests.size())
+
+	for (std::size_t begin = 0; begin < n_batch.m_items.size(); begin += m_batch_size) {
+		send(n_batch, begin, std::min(begin + m_batch_size, n_batch.m_items.size()));
+	}
+}
+
+std::size_t BatchInserter::flush() {
+
+	if (!m_candidates.empty()) {
+		send();
+	}
+
+	while (!m_in_flight.empty()) {
+		wait_for_oldest();
+	}
+
+	return m_inserted;
+}
+
+void BatchInserter::send() {
+
+	prepare_batch(m_candidates, m_prepared);
+	m_candidates.clear();
+
+	send(m_prepared, 0, m_prepared.m_items.size());
+}
+
+void BatchInserter::send(const prepared_batch &n_batch, const std::size_t n_begin, const std::size_t n_end) {
+
+	// Those the filter knows have been queued before. Once it is over capacity
+	// it would skip too many new ones, so it is only kept up to date then
+	const bool use_filter = m_filter && !m_filter->saturated();
+
+	m_args.clear();
+	for (std::size_t i = n_begin; i < n_end; i++) {
+		if (m_filter && m_filter->insert(n_batch.m_digests[i]) && use_filter) {
+			m_skipped++;
+			continue;
+		}
+		m_args.push_back(n_batch.m_items[i]);
+		m_args.push_back(to_hex(n_batch.m_digests[i]));
+	}
+
+	const std::size_t count = m_args.size() / 2;
+	if (count < n_end - n_begin) {
+		BOOST_LOG_SEV(logger(), debug) << (n_end - n_begin - count) << " candidates of batch known to the filter";
+	}
+
+	if (count == 0) {
+		return;
+	}
+
+	// Make room first so we never have more than allowed on the wire
+	while (m_in_flight.size() >= m_max_in_flight) {
+		wait_for_oldest();
+	}
+
+	BOOST_LOG_SEV(logger(), normal) << "Inserting batch of " << count << " password candidates";
+
+	std::unique_ptr<Batch> batch{ new Batch{ count } };
+	m_redis->eval(enter_candidates, candidate_keys, m_args, batch->m_retriever.responder());
+	m_in_flight.push_back(std::move(batch));
+}
+
+void BatchInserter::wait_for_oldest() {
+
+	MOOSE_ASSERT(!m_in_flight.empty())
+
+	const std::unique_ptr<Batch> batch = std::move(m_in_flight.front());
+	m_in_flight.pop_front();
+
+	const boost::optional<boost::int64_t> result = batch->m_retriever.wait_for_response();
+	if (!result) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from batch insertion script"));
+	}
+
+	if (*result < static_cast<boost::int64_t>(batch->m_size)) {
+		BOOST_LOG_SEV(logger(), normal) << (batch->m_size - *result) << " candidates of batch were already present";
+	}
+
+	m_inserted += static_cast<std::size_t>(*result);
+}
+
+void prepare_batch(const std::vector<std::string> &n_candidates, prepared_batch &n_batch) {
+
+	// Hashing the whole batch at once lets the candidates share SIMD lanes
+	sha512_batch(n_candidates, n_batch.m_digests);
+
+	n_batch.m_items.resize(n_candidates.size());
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < n_candidates.size(); i++) {
+		if (n_candidates[i].empty()) {
+			continue;
+		}
+		n_batch.m_items[count] = encrypt_decrypt(n_candidates[i]);
+		n_batch.m_digests[count] = n_batch.m_digests[i];
+		count++;
+	}
+
+	n_batch.m_items.resize(count);
+	n_batch.m_digests.resize(count);
+}
+
+std::size_t queue_candidates(mredis::AsyncClientSPtr n_redis, const std::vector<std::string> &n_candidates, const std::size_t n_batch_size) {
+
+	BatchInserter inserter{ n_redis, n_batch_size };
+
+	for (const std::string &candidate : n_candidates) {
+		inserter.add(candidate);
+	}
+
+	return inserter.flush();
 }
 
-/* Return a lease and remove the item from the work queue
+/* Count the items
  *
- * KEYS[1]      rsc:lease:$HASH
+ * KEYS[1]      items
+ */
+const std::string count_items{
+
+	"return redis.call('hlen', KEYS[1]) "
+};
+
+/* Scan the keys of all items
  *
- * ARGV[1]      hash
- * ARGV[2]      "0" on no success, "1" on success
+ * KEYS[1]      items
+ *
+ * ARGV[1]      cursor, "0" to start
+ * ARGV[2]      about how many items to return
  *
  * returns:
- *     0 on everything OK
- *    -1 when item was not leased (or lease expired)
+ *     the next cursor and the keys, each preceded by its length and a ':'.
+ *     The cursor is "0" when done
+ */
+const std::string scan_items{
+
+	"local reply = redis.call('hscan', KEYS[1], ARGV[1], 'COUNT', ARGV[2]) "
+	"local out = { string.len(reply[1]) .. ':' .. reply[1] } "
+	"for i = 1, #reply[2], 2 do "
+	    "table.insert(out, string.len(reply[2][i]) .. ':' .. reply[2][i]) "
+	"end "
+	"return table.concat(out) "
+};
+
+boost::uint64_t queue_items(mredis::AsyncClientSPtr n_redis) {
+
+	MOOSE_ASSERT(n_redis)
+
+	const std::vector<std::string> keys{ candidate_keys[0] };
+
+	mredis::BlockingRetriever<boost::int64_t> counter{ 15 };
+	n_redis->eval(count_items, keys, std::vector<std::string>{}, counter.responder());
+	const boost::optional<boost::int64_t> result = counter.wait_for_response();
+
+	if (!result || (*result < 0)) {
+		BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from item count script"));
+	}
+
+	return static_cast<boost::uint64_t>(*result);
+}
+
+/* Common head of the poll scripts. Defines 'now' and puts expired leases back
+ *
+ * KEYS         as described above
  */
-const std::string return_lease{
+const std::string reclaim_leases{
 
-	// If a lease doesn't exist, I will return false but still mark success
-	"if redis.call('exists', KEYS[1]) == 0 then "
-	    "if ARGV[2] == '1' then "
-	        "redis.call('sadd', 'rsc:success', ARGV[1]) "
+	// We need the server time, which makes this script non-deterministic
+	"redis.replicate_commands() "
+	"local now = tonumber(redis.call('time')[1]) "
+
+	// Drain queues of the old layout a bit on every poll
+	"if redis.call('exists', KEYS[6]) == 1 then "
+	    "local legacy = redis.call('spop', KEYS[6], 1000) "
+	    "if #legacy > 0 then "
+	        "redis.call('rpush', KEYS[2], unpack(legacy)) "
 	    "end "
-	    "return -1 "
 	"end "
 
-	// Otherwise remove the lease and the candidates entry
-	"redis.call('del', KEYS[1]) "
-	"redis.call('srem', 'rsc:candidates', ARGV[1]) "
+	// Reclaim expired leases in bulk. They go to the front of the queue
+	"local expired = redis.call('zrangebyscore', KEYS[3], '-inf', now, 'LIMIT', 0, 1000) "
+	"if #expired > 0 then "
+	    "redis.call('zrem', KEYS[3], unpack(expired)) "
+	    "redis.call('lpush', KEYS[2], unpack(expired)) "
+	"end "
+};
 
-	"if ARGV[2] == '1' then "
-	    "redis.call('sadd', 'rsc:success', ARGV[1]) "    // YYYYYEEEEEAAAAAAAHHHHHHH!!!!!
-	"else "
-	    "redis.call('sadd', 'rsc:failed', ARGV[1]) "
+/* Lease the next item. Expects 'now' to be defined and defines 'lease', the
+ * expiry of all leases handed out by this call. Returning one takes it as proof of ownership
+ *
+ * KEYS         as described above
+ *
+ * ARGV[1]      lease time in seconds
+ *
+ * returns the hash of the leased item, false when the queue is empty
+ */
+const std::string lease_next{
+
+	"local lease = now + tonumber(ARGV[1]) "
+	"local function lease_next() "
+	    // Pop the next item. Those that were finished after their lease expired
+	    // may still be in the list. Drop them here
+	    "while true do "
+	        "local hash = redis.call('lpop', KEYS[2]) "
+	        "if not hash then "
+	            "return false "
+	        "end "
+	        "if (redis.call('sismember', KEYS[4], hash) == 0) and (redis.call('sismember', KEYS[5], hash) == 0) then "
+	            "redis.call('zadd', KEYS[3], lease, hash) "
+	            "return hash "
+	        "end "
+	    "end "
 	"end "
-	"return 0 "
 };
 
-void return_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, const bool n_success) {
+/* Poll an entry from the work queue
+ *
+ * KEYS         as described above
+ *
+ * ARGV[1]      lease time in seconds
+ *
+ * returns:
+ *     the lease expiry followed by the xor encrypted password or serialized chunk
+ *     when lease is established, each preceded by its length and a ':'
+ *     nil when no work item is available
+ */
+const std::string poll_queue{ reclaim_leases + lease_next +
 
-	MOOSE_ASSERT(n_redis)
+	"local hash = lease_next() "
+	"if not hash then "
+	    "return nil "
+	"end "
+	"local value = redis.call('hget', KEYS[1], hash) "
+	"local expiry = string.format('%d', lease) "
+	"return string.len(expiry) .. ':' .. expiry .. string.len(value) .. ':' .. value "
+};
 
-	try {
-		const std::string hash = sha512(n_candidate);
+/* Poll many entries from the work queue
+ *
+ * KEYS         as described above
+ *
+ * ARGV[1]      lease time in seconds
+ * ARGV[2]      max number of entries
+ *
+ * returns:
+ *     the lease expiry followed by the xor encrypted passwords, each preceded by its length and a ':'
+ *     empty string when no work item is available
+ */
+const std::string poll_queue_batch{ reclaim_leases + lease_next +
 
-		const std::vector<std::string> keys {
-			"rsc:lease:" + hash
-		};
+	"local expiry = string.format('%d', lease) "
+	"local out = { string.len(expiry) .. ':' .. expiry } "
+	"for i = 1, tonumber(ARGV[2]) do "
+	    "local hash = lease_next() "
+	    "if not hash then "
+	        "break "
+	    "end "
+	    "local value = redis.call('hget', KEYS[1], hash) "
+	    "table.insert(out, string.len(value) .. ':' .. value) "
+	"end "
+	"if #out == 1 then "
+	    "return '' "
+	"end "
+	"return table.concat(out) "
+};
 
-		const std::vector<std::string> args {
-			hash,
-			n_success ? "1" : "0"
-		};
+namespace {
 
-		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for password candidate...";
+/* Split the result of poll_queue_batch. Values may contain any character,
+ * hence the length prefix.
+ * @throw serialization_error
+ */
+void decode_batch(const std::string &n_batch, std::vector<std::string> &n_values) {
 
-		mredis::BlockingRetriever<boost::int64_t> returner{ 15 };
-		n_redis->eval(return_lease, keys, args, returner.responder());
-		const boost::optional<boost::int64_t> result = returner.wait_for_response();
+	std::string::size_type pos = 0;
+	while (pos < n_batch.size()) {
+		const std::string::size_type colon = n_batch.find(':', pos);
+		if (colon == std::string::npos) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed candidate batch"));
+		}
 
-		if (!result) {
-			// we have no item in the Q that isn't already leased
-			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from return lease script"));
-		} else {
-			if (*result != 0) {
-				BOOST_LOG_SEV(logger(), warning) << "Return lease script returned " << *result << ". Maybe you should check that out";
-			}
+		std::size_t length = 0;
+		try {
+			length = boost::lexical_cast<std::size_t>(n_batch.substr(pos, colon - pos));
+		} catch (const boost::bad_lexical_cast &) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed candidate batch length"));
 		}
 
-	} catch (const moose_error &merr) {
-		BOOST_LOG_SEV(logger(), error) << "Failed to return lease: "
-		        << boost::diagnostic_information(merr);
+		if (length > n_batch.size() - colon - 1) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Truncated candidate batch"));
+		}
+
+		n_values.push_back(n_batch.substr(colon + 1, length));
+		pos = colon + 1 + length;
+	}
+}
+
+/* Split the result of poll_queue or poll_queue_batch. The lease expiry comes first
+ * and is not appended to n_values.
+ * @return the lease expiry
+ * @throw serialization_error
+ */
+std::uint64_t decode_leased(const std::string &n_batch, std::vector<std::string> &n_values) {
+
+	const std::size_t previous_size = n_values.size();
+	decode_batch(n_batch, n_values);
+	if (n_values.size() == previous_size) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Poll result without lease"));
+	}
+
+	std::uint64_t lease = 0;
+	try {
+		lease = boost::lexical_cast<std::uint64_t>(n_values[previous_size]);
+	} catch (const boost::bad_lexical_cast &) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed lease expiry")
+		            << error_argument(n_values[previous_size]));
 	}
+
+	n_values.erase(n_values.begin() + previous_size);
+	return lease;
 }
 
+/* The first 16 bytes of the digest an item is keyed by, no matter the key format.
+ * @return false for keys that are neither
+ */
+bool key_prefix(const std::string &n_key, boost::uint8_t *n_prefix) {
+
+	if (n_key.size() == 16) {
+		std::memcpy(n_prefix, n_key.data(), 16);
+		return true;
+	}
 
+	if (n_key.size() != 128) {
+		return false;
+	}
+
+	const auto nibble = [](const char n_c) -> int {
+		if ((n_c >= '0') && (n_c <= '9')) {
+			return n_c - '0';
+		} else if ((n_c >= 'a') && (n_c <= 'f')) {
+			return n_c - 'a' + 10;
+		}
+		return -1;
+	};
+
+	for (std::size_t i = 0; i < 16; i++) {
+		const int high = nibble(n_key[2 * i]);
+		const int low = nibble(n_key[2 * i + 1]);
+		if ((high < 0) || (low < 0)) {
+			return false;
+		}
+		n_prefix[i] = static_cast<boost::uint8_t>((high << 4) | low);
+	}
+
+	return true;
+}
+
+} // anon namespace
+
+boost::uint64_t seed_filter(mredis::AsyncClientSPtr n_redis, BloomFilter &n_filter, const std::size_t n_scan_count) {
+
+	MOOSE_ASSERT(n_redis)
+
+	const std::vector<std::string> keys{ candidate_keys[0] };
+
+	boost::uint64_t count = 0;
+	std::string cursor = "0";
+	std::vector<std::string> values;
+	boost::uint8_t prefix[16];
+
+	do {
+		const std::vector<std::string> args{
+			cursor,
+			boost::lexical_cast<std::string>(std::max<std::size_t>(n_scan_count, 1))
+		};
+
+		mredis::BlockingRetriever<std::string> scanner{ 60 };
+		n_redis->eval(scan_items, keys, args, scanner.responder());
+		const boost::optional<std::string> result = scanner.wait_for_response();
+
+		if (!result) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from item scan script"));
+		}
+
+		values.clear();
+		decode_batch(*result, values);
+		if (values.empty()) {
+			BOOST_THROW_EXCEPTION(serialization_error() << error_message("Item scan without cursor"));
+		}
+
+		cursor = values.front();
+		for (std::size_t i = 1; i < values.size(); i++) {
+			if (key_prefix(values[i], prefix)) {
+				n_filter.insert(prefix);
+				count++;
+			} else {
+				BOOST_LOG_SEV(logger(), warning) << "Ignoring queue item with unknown key format";
+			}
+		}
+
+	} while (cursor != "0");
+
+	BOOST_LOG_SEV(logger(), normal) << "Seeded candidate filter with " << count << " queued candidates";
+	return count;
+}
+
+bool poll_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, std::uint64_t &n_lease) {
+
+	MOOSE_ASSERT(n_redis)
+
+	try {
+		const std::vector<std::string> args{
+			"60"
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for password candidate...";
+
+		mredis::BlockingRetriever<std::string> poller{ 15 };
+		n_redis->eval(poll_queue, candidate_keys, args, poller.responder());
+		const boost::optional<std::string> result = poller.wait_for_response();
+
+		if (!result || result->empty()) {
+			// we have no item in the Q that isn't already leased
+			return false;
+		} else {
+			std::vector<std::string> values;
+			n_lease = decode_leased(*result, values);
+			if (values.size() != 1) {
+				BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed poll result"));
+			}
+
+			// Decrypt and return. Caller now has 60 seconds to work on it.
+			n_candidate = encrypt_decrypt(values.front());
+			return true;
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to to poll password candidate: "
+		        << boost::diagnostic_information(merr);
+	}
+
+	return false;
+}
+
+/* Return a lease and record the result
+ *
+ * KEYS         as described above
+ *
+ * ARGV[1]      hash
+ * ARGV[2]      "0" on no success, "1" on success
+ * ARGV[3]      lease expiry as handed out by the poll
+ *
+ * returns:
+ *     0 on everything OK
+ *    -1 when item was not leased (or lease expired)
+ */
+const std::string return_lease{ item_key +
+
+	"local key = item_key(ARGV[1]) "
+
+	// Only the holder may end a lease. Once it ran out, the item may have been leased
+	// to someone else, whose lease has a different expiry and must stay
+	"local leased = 0 "
+	"local score = redis.call('zscore', KEYS[3], key) "
+	"if score and (tonumber(score) == tonumber(ARGV[3])) then "
+	    "leased = redis.call('zrem', KEYS[3], key) "
+	"end "
+
+	// The work has been done, even if the lease ran out in the meantime. So the result
+	// is always recorded. Should the item have been re-queued, poll will skip it
+	"if ARGV[2] == '1' then "
+	    "redis.call('sadd', KEYS[5], key) "    // YYYYYEEEEEAAAAAAAHHHHHHH!!!!!
+	"else "
+	    "redis.call('sadd', KEYS[4], key) "
+	"end "
+
+	"if leased == 0 then "
+	    "return -1 "
+	"end "
+	"return 0 "
+};
+
+void return_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, const std::uint64_t n_lease, const bool n_success) {
+
+	MOOSE_ASSERT(n_redis)
+
+	try {
+		const std::string hash = sha512(n_candidate);
+
+		const std::vector<std::string> args {
+			hash,
+			n_success ? "1" : "0",
+			boost::lexical_cast<std::string>(n_lease)
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for password candidate...";
+
+		mredis::BlockingRetriever<boost::int64_t> returner{ 15 };
+		n_redis->eval(return_lease, candidate_keys, args, returner.responder());
+		const boost::optional<boost::int64_t> result = returner.wait_for_response();
+
+		if (!result) {
+			// we have no item in the Q that isn't already leased
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from return lease script"));
+		} else {
+			if (*result != 0) {
+				BOOST_LOG_SEV(logger(), warning) << "Return lease script returned " << *result << ". Maybe you should check that out";
+			}
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to return lease: "
+		        << boost::diagnostic_information(merr);
+	}
+}
+
+
+
+/* Return many leases and record the results
+ *
+ * KEYS         as described above
+ *
+ * ARGV[3n-2]   hash
+ * ARGV[3n-1]   "0" on no success, "1" on success
+ * ARGV[3n]     lease expiry as handed out by the poll
+ *
+ * returns:
+ *     number of items whose lease had expired
+ */
+const std::string return_leases{ item_key +
+
+	"local expired = 0 "
+	"for i = 1, #ARGV, 3 do "
+	    "local key = item_key(ARGV[i]) "
+	    // Same as return_lease, leave leases of others alone
+	    "local score = redis.call('zscore', KEYS[3], key) "
+	    "if score and (tonumber(score) == tonumber(ARGV[i + 2])) then "
+	        "redis.call('zrem', KEYS[3], key) "
+	    "else "
+	        "expired = expired + 1 "
+	    "end "
+	    "if ARGV[i + 1] == '1' then "
+	        "redis.call('sadd', KEYS[5], key) "
+	    "else "
+	        "redis.call('sadd', KEYS[4], key) "
+	    "end "
+	"end "
+	"return expired "
+};
+
+std::size_t poll_candidates(mredis::AsyncClientSPtr n_redis, const std::size_t n_count,
+                            std::vector<std::string> &n_candidates, std::uint64_t &n_lease,
+                            const unsigned int n_lease_seconds) {
+
+	MOOSE_ASSERT(n_redis)
+
+	try {
+		const std::vector<std::string> args{
+			boost::lexical_cast<std::string>(n_lease_seconds),
+			boost::lexical_cast<std::string>(n_count)
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for " << n_count << " password candidates...";
+
+		mredis::BlockingRetriever<std::string> poller{ 15 };
+		n_redis->eval(poll_queue_batch, candidate_keys, args, poller.responder());
+		const boost::optional<std::string> result = poller.wait_for_response();
+
+		if (!result || result->empty()) {
+			return 0;
+		}
+
+		const std::size_t previous_size = n_candidates.size();
+		n_lease = decode_leased(*result, n_candidates);
+
+		for (std::size_t i = previous_size; i < n_candidates.size(); i++) {
+			n_candidates[i] = encrypt_decrypt(n_candidates[i]);
+		}
+
+		return n_candidates.size() - previous_size;
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to to poll password candidates: "
+		        << boost::diagnostic_information(merr);
+	}
+
+	return 0;
+}
+
+void return_candidates(mredis::AsyncClientSPtr n_redis, const std::vector<candidate_result> &n_results) {
+
+	MOOSE_ASSERT(n_redis)
+
+	if (n_results.empty()) {
+		return;
+	}
+
+	try {
+		std::vector<std::string> candidates;
+		candidates.reserve(n_results.size());
+		for (const candidate_result &r : n_results) {
+			candidates.push_back(r.m_candidate);
+		}
+
+		std::vector<sha512_digest> digests;
+		sha512_batch(candidates, digests);
+
+		std::vector<std::string> args;
+		args.reserve(3 * n_results.size());
+
+		for (std::size_t i = 0; i < n_results.size(); i++) {
+			args.push_back(to_hex(digests[i]));
+			args.push_back(n_results[i].m_success ? "1" : "0");
+			args.push_back(boost::lexical_cast<std::string>(n_results[i].m_lease));
+		}
+
+		BOOST_LOG_SEV(logger(), normal) << "Returning " << n_results.size() << " leases";
+
+		mredis::BlockingRetriever<boost::int64_t> returner{ 15 };
+		n_redis->eval(return_leases, candidate_keys, args, returner.responder());
+		const boost::optional<boost::int64_t> result = returner.wait_for_response();
+
+		if (!result) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from return leases script"));
+		} else {
+			if (*result != 0) {
+				BOOST_LOG_SEV(logger(), warning) << *result << " leases had expired when returned. Consider a longer lease time or smaller batches";
+			}
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to return leases: "
+		        << boost::diagnostic_information(merr);
+	}
+}
+
+struct LeaseBuffer::Request {
+
+	Request()
+	        : m_retriever{ 15 } {
+	}
+
+	mredis::BlockingRetriever<std::string> m_retriever;
+};
+
+LeaseBuffer::LeaseBuffer(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size, const unsigned int n_lease_seconds)
+        : m_redis{ n_redis }
+        , m_batch_size{ std::max<std::size_t>(n_batch_size, 1) }
+        , m_lease_seconds{ n_lease_seconds } {
+
+	MOOSE_ASSERT(m_redis)
+}
+
+LeaseBuffer::~LeaseBuffer() noexcept {
+
+	try {
+		// A poll in flight must be waited for. What it brings in stays leased until it expires
+		if (m_request) {
+			collect();
+		}
+		flush();
+	} catch (const std::exception &sex) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to return leases: " << sex.what();
+	}
+}
+
+bool LeaseBuffer::next(std::string &n_candidate) {
+
+	if (m_buffer.empty()) {
+		if (!m_request) {
+			request();
+		}
+		collect();
+	}
+
+	if (m_buffer.empty()) {
+		return false;
+	}
+
+	n_candidate = std::move(m_buffer.front().first);
+	m_leased[n_candidate] = m_buffer.front().second;
+	m_buffer.pop_front();
+
+	// Running low. Have the next batch on its way while we work
+	if (!m_request && (m_buffer.size() <= m_batch_size / 2)) {
+		request();
+	}
+
+	return true;
+}
+
+void LeaseBuffer::result(const std::string &n_candidate, const bool n_success) {
+
+	candidate_result r;
+	r.m_candidate = n_candidate;
+	r.m_success = n_success;
+
+	// Candidates we never handed out have no lease to end. The result counts anyway
+	const std::unordered_map<std::string, std::uint64_t>::iterator leased = m_leased.find(n_candidate);
+	if (leased != m_leased.end()) {
+		r.m_lease = leased->second;
+		m_leased.erase(leased);
+	}
+
+	m_results.push_back(std::move(r));
+
+	// Success must not wait for anything
+	if (n_success || (m_results.size() >= m_batch_size)) {
+		flush();
+	}
+}
+
+void LeaseBuffer::flush() {
+
+	return_candidates(m_redis, m_results);
+	m_results.clear();
+}
+
+void LeaseBuffer::request() {
+
+	MOOSE_ASSERT(!m_request)
+
+	const std::vector<std::string> args{
+		boost::lexical_cast<std::string>(m_lease_seconds),
+		boost::lexical_cast<std::string>(m_batch_size)
+	};
+
+	m_request.reset(new Request);
+	m_redis->eval(poll_queue_batch, candidate_keys, args, m_request->m_retriever.responder());
+}
+
+void LeaseBuffer::collect() {
+
+	MOOSE_ASSERT(m_request)
+
+	const std::unique_ptr<Request> request = std::move(m_request);
+
+	try {
+		const boost::optional<std::string> result = request->m_retriever.wait_for_response();
+		if (!result || result->empty()) {
+			return;
+		}
+
+		std::vector<std::string> values;
+		const std::uint64_t lease = decode_leased(*result, values);
+		for (const std::string &value : values) {
+			m_buffer.emplace_back(encrypt_decrypt(value), lease);
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to to poll password candidates: "
+		        << boost::diagnostic_information(merr);
+	}
+}
+
+namespace {
+
+std::string serialize_chunk(const work_chunk &n_chunk) {
+
+	return boost::lexical_cast<std::string>(n_chunk.m_begin) + " "
+	        + boost::lexical_cast<std::string>(n_chunk.m_end) + " "
+	        + encrypt_decrypt(n_chunk.m_pattern);
+}
+
+//! @throw serialization_error
+work_chunk deserialize_chunk(const std::string &n_value) {
+
+	const std::string::size_type first = n_value.find(' ');
+	const std::string::size_type second = (first == std::string::npos) ? std::string::npos : n_value.find(' ', first + 1);
+
+	if (second == std::string::npos) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed work chunk") << error_argument(n_value));
+	}
+
+	work_chunk ret;
+	try {
+		ret.m_begin = boost::lexical_cast<std::uint64_t>(n_value.substr(0, first));
+		ret.m_end = boost::lexical_cast<std::uint64_t>(n_value.substr(first + 1, second - first - 1));
+	} catch (const boost::bad_lexical_cast &) {
+		BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed work chunk range") << error_argument(n_value));
+	}
+	ret.m_pattern = encrypt_decrypt(n_value.substr(second + 1));
+
+	return ret;
+}
+
+//! The chunk's identity is its range and clear text pattern, just like a candidate's is its clear text
+std::string chunk_hash(const work_chunk &n_chunk) {
+
+	return sha512(boost::lexical_cast<std::string>(n_chunk.m_begin) + " "
+	        + boost::lexical_cast<std::string>(n_chunk.m_end) + " " + n_chunk.m_pattern);
+}
+
+} // anon namespace
+
+bool queue_candidate(mredis::AsyncClientSPtr n_redis, const work_chunk &n_chunk) {
+
+	MOOSE_ASSERT(n_redis)
+
+	if (n_chunk.m_pattern.empty() || (n_chunk.m_begin >= n_chunk.m_end)) {
+		BOOST_LOG_SEV(logger(), warning) << "Empty chunk could not be queued";
+		return false;
+	}
+
+	try {
+		const std::string hash = chunk_hash(n_chunk);
+
+		const std::vector<std::string> args{
+			serialize_chunk(n_chunk),
+			hash
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Inserting hash for candidate chunk: " << hash;
+
+		mredis::BlockingRetriever<boost::int64_t> inserter{ 15 };
+		n_redis->eval(enter_candidate, chunk_keys, args, inserter.responder());
+		const boost::optional<boost::int64_t> result = inserter.wait_for_response();
+
+		if (!result) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from chunk insertion script"));
+		} else {
+			switch (*result) {
+				case 0:
+					BOOST_LOG_SEV(logger(), normal) << "Chunk inserted successfully";
+					break;
+				case -1:
+					BOOST_LOG_SEV(logger(), warning) << "Chunk not inserted, already present";
+					return false;
+				default:
+					BOOST_THROW_EXCEPTION(internal_error()
+					            << error_message("Unexpected result from chunk insertion script")
+					            << error_argument(*result));
+			}
+		}
+
+		return true;
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to insert candidate chunk:"
+		        << boost::diagnostic_information(merr);
+	}
+
+	return false;
+}
+
+std::size_t queue_pattern(mredis::AsyncClientSPtr n_redis, const std::string &n_pattern, const std::uint64_t n_chunk_size) {
+
+	MOOSE_ASSERT(n_chunk_size > 0)
+
+	const std::uint64_t size = count_permutations(n_pattern);
+	std::size_t count = 0;
+
+	work_chunk chunk;
+	chunk.m_pattern = n_pattern;
+
+	for (std::uint64_t begin = 0; begin < size; begin = chunk.m_end) {
+		chunk.m_begin = begin;
+		chunk.m_end = begin + std::min(n_chunk_size, size - begin);
+		if (queue_candidate(n_redis, chunk)) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+bool poll_candidate(mredis::AsyncClientSPtr n_redis, work_chunk &n_chunk, const unsigned int n_lease_seconds) {
+
+	MOOSE_ASSERT(n_redis)
+
+	try {
+		const std::vector<std::string> args{
+			boost::lexical_cast<std::string>(n_lease_seconds)
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Polling work queue for candidate chunk...";
+
+		mredis::BlockingRetriever<std::string> poller{ 15 };
+		n_redis->eval(poll_queue, chunk_keys, args, poller.responder());
+		const boost::optional<std::string> result = poller.wait_for_response();
+
+		if (!result || result->empty()) {
+			return false;
+		} else {
+			std::vector<std::string> values;
+			const std::uint64_t lease = decode_leased(*result, values);
+			if (values.size() != 1) {
+				BOOST_THROW_EXCEPTION(serialization_error() << error_message("Malformed chunk poll result"));
+			}
+
+			n_chunk = deserialize_chunk(values.front());
+			n_chunk.m_lease = lease;
+			return true;
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to to poll candidate chunk: "
+		        << boost::diagnostic_information(merr);
+	}
+
+	return false;
+}
+
+void return_candidate(mredis::AsyncClientSPtr n_redis, const work_chunk &n_chunk, const bool n_success) {
+
+	MOOSE_ASSERT(n_redis)
+
+	try {
+		const std::string hash = chunk_hash(n_chunk);
+
+		const std::vector<std::string> args {
+			hash,
+			n_success ? "1" : "0",
+			boost::lexical_cast<std::string>(n_chunk.m_lease)
+		};
+
+		BOOST_LOG_SEV(logger(), normal) << "Returning candidate chunk " << hash;
+
+		mredis::BlockingRetriever<boost::int64_t> returner{ 15 };
+		n_redis->eval(return_lease, chunk_keys, args, returner.responder());
+		const boost::optional<boost::int64_t> result = returner.wait_for_response();
+
+		if (!result) {
+			BOOST_THROW_EXCEPTION(internal_error() << error_message("No response from return chunk lease script"));
+		} else {
+			if (*result != 0) {
+				BOOST_LOG_SEV(logger(), warning) << "Return chunk lease script returned " << *result << ". Maybe you should check that out";
+			}
+		}
+
+	} catch (const moose_error &merr) {
+		BOOST_LOG_SEV(logger(), error) << "Failed to return chunk lease: "
+		        << boost::diagnostic_information(merr);
+	}
+}
+
+RedisWorkQueue::RedisWorkQueue(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size)
+        : m_redis{ n_redis }
+        , m_candidates{ n_redis, n_batch_size } {
+}
+
+bool RedisWorkQueue::next(std::string &n_candidate) {
+
+	return m_candidates.next(n_candidate);
+}
+
+void RedisWorkQueue::result(const std::string &n_candidate, const bool n_success) {
+
+	m_candidates.result(n_candidate, n_success);
+}
+
+bool RedisWorkQueue::next(work_chunk &n_chunk) {
+
+	return poll_candidate(m_redis, n_chunk);
+}
+
+void RedisWorkQueue::result(const work_chunk &n_chunk, const bool n_success) {
+
+	return_candidate(m_redis, n_chunk, n_success);
+}
+
+void RedisWorkQueue::flush() {
+
+	m_candidates.flush();
+}
 
 } // namespace rescue
 } // namespace moose
@@ -5,9 +5,16 @@
 #pragma once
 #include "RescueConfig.hpp"
 #include "Types.hpp"
+#include "Sha512.hpp"
+#include "BloomFilter.hpp"
 
 #include "mredis/FwdDeclarations.hpp"
 
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <memory>
 #include <vector>
 #include <string>
 #include <list>
@@ -15,6 +22,51 @@
 namespace moose {
 namespace rescue {
 
+/*! @brief A range of candidates of one input pattern.
+	Rather than storing every candidate, the queue may hold the pattern
+	and an index range [m_begin, m_end) into its permutations as generated by
+	PermutationGenerator. The server expands them locally.
+ */
+struct work_chunk {
+	std::string   m_pattern;
+	std::uint64_t m_begin = 0;
+	std::uint64_t m_end   = 0;
+	std::uint64_t m_lease = 0;  //!< expiry of the lease, as handed out by poll_candidate()
+};
+
+/*! @brief how items are keyed in the queue on redis
+
+	We always send the SHA-512 of an item as hex digits and the queue's scripts
+	derive the actual key from that. hex keys by all 128 digits, as queues always did.
+	binary keys by the first 16 bytes, which takes a fraction of the memory.
+ */
+enum class key_format {
+	hex,
+	binary
+};
+
+RESCUE_API const char *to_string(const key_format n_format) noexcept;
+
+/*! @brief record the key format for a new queue or learn the one of an existing queue
+
+	The format is kept in rsc:keyformat. n_requested is only used when nothing
+	was ever queued, queues from before the format was recorded stay hex.
+	Servers don't need to know, the scripts take care of it.
+
+	@return the format the queue uses from now on
+	@throw internal_error
+ */
+key_format RESCUE_API establish_key_format(mredis::AsyncClientSPtr n_redis, const key_format n_requested);
+
+/*! @brief the random identity of the queue, kept in rsc:queueid
+
+	A queue that is empty gets a new one, so after a reset it differs from
+	what state saved for it before says, even when it is filled up again.
+
+	@throw internal_error
+ */
+std::string RESCUE_API queue_identity(mredis::AsyncClientSPtr n_redis);
+
 /*! @brief enter a candidate into the work queue on redis
 
 	@param n_input as described
@@ -24,19 +76,266 @@ namespace rescue {
  */
 bool RESCUE_API queue_candidate(mredis::AsyncClientSPtr n_redis, const std::string &n_candidate);
 
+/*! @brief candidates hashed and encrypted for the queue
+
+	That is most of the work of inserting them. prepare_batch() does it and can
+	run on any thread, BatchInserter::add() then only does the rest.
+ */
+struct prepared_batch {
+	std::vector<std::string>   m_items;      //!< the candidates, encrypted
+	std::vector<sha512_digest> m_digests;    //!< of the candidates in clear text
+};
+
+//! hash and encrypt n_candidates into n_batch, replacing what it held. Empty candidates are left out
+void RESCUE_API prepare_batch(const std::vector<std::string> &n_candidates, prepared_batch &n_batch);
+
+/*! @brief enter candidates into the work queue on redis in batches
+
+	Candidates are collected, hashed together and sent n_batch_size at a time in one script call.
+	Up to n_max_in_flight of those calls are pipelined without waiting for a response,
+	the oldest one is only waited for when that limit is reached.
+	Call flush() when done to send the rest and collect all responses.
+ */
+class BatchInserter final {
+
+	public:
+		/*! @param n_filter when given, candidates it knows are skipped and new ones added to it.
+				Must outlive the inserter
+		 */
+		RESCUE_API BatchInserter(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size = 1000, const std::size_t n_max_in_flight = 64,
+		                         BloomFilter *n_filter = nullptr);
+
+		//! waits for outstanding batches but does not send an incomplete one. Call flush() for that
+		RESCUE_API ~BatchInserter() noexcept;
+
+		BatchInserter(const BatchInserter &) = delete;
+		BatchInserter &operator=(const BatchInserter &) = delete;
+
+		/*! @brief add one candidate, send the batch if full
+			@throw redis_error, internal_error
+		 */
+		RESCUE_API void add(const std::string &n_candidate);
+
+		/*! @brief add candidates prepared before, sent in batches of this inserter's size
+			@throw redis_error, internal_error
+		 */
+		RESCUE_API void add(const prepared_batch &n_batch);
+
+		/*! @brief send the incomplete batch and wait for all outstanding responses
+			@return number of candidates inserted so far, not counting those already present
+			@throw redis_error, internal_error
+		 */
+		RESCUE_API std::size_t flush();
+
+		//! number of candidates confirmed inserted so far
+		std::size_t inserted() const noexcept { return m_inserted; }
+
+		//! number of candidates the filter knew, which were never sent
+		std::size_t skipped() const noexcept { return m_skipped; }
+
+	private:
+		struct Batch;
+
+		void send();
+
+		//! send [n_begin, n_end) of n_batch
+		void send(const prepared_batch &n_batch, const std::size_t n_begin, const std::size_t n_end);
+
+		void wait_for_oldest();
+
+		mredis::AsyncClientSPtr              m_redis;
+		const std::size_t                    m_batch_size;
+		const std::size_t                    m_max_in_flight;
+		std::vector<std::string>             m_candidates;  //!< the batch being filled, in clear text
+		prepared_batch                       m_prepared;    //!< hashed all at once when sending
+		std::vector<std::string>             m_args;
+		std::deque<std::unique_ptr<Batch> >  m_in_flight;   //!< sent but not answered yet, oldest first
+		BloomFilter                         *m_filter;
+		std::size_t                          m_inserted;
+		std::size_t                          m_skipped;
+};
+
+/*! @brief number of candidates ever queued, no matter if they have been tried
+	@throw internal_error
+ */
+boost::uint64_t RESCUE_API queue_items(mredis::AsyncClientSPtr n_redis);
+
+/*! @brief add every candidate ever queued to n_filter
+
+	Scans the queue in bulk, n_scan_count per round trip.
+	@return the number of candidates seen
+	@throw internal_error, serialization_error
+ */
+boost::uint64_t RESCUE_API seed_filter(mredis::AsyncClientSPtr n_redis, BloomFilter &n_filter, const std::size_t n_scan_count = 10000);
+
+/*! @brief enter many candidates into the work queue on redis, pipelined in batches
+	@return number of candidates inserted, not counting those already present
+	@throw redis_error, internal_error
+ */
+std::size_t RESCUE_API queue_candidates(mredis::AsyncClientSPtr n_redis, const std::vector<std::string> &n_candidates, const std::size_t n_batch_size = 1000);
+
 /*! @brief poll the work queue for candidates
 
+	@param n_lease expiry of the lease, to be handed back with the result
 	@return true on candidate available and lease established otherwise false
  */
-bool RESCUE_API poll_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate);
+bool RESCUE_API poll_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, std::uint64_t &n_lease);
 
 /*! @brief return a lease to the work queue with results
 	@param n_candidate the clear text candidate to return
+	@param n_lease as given by poll_candidate(). The lease is only ended when it is still this one
 	@param n_success set to true when the actually worked out (lucky you!), otherwise false
 
 	@return true on candidate available and lease established otherwise false
  */
-void RESCUE_API return_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, const bool n_success);
+void RESCUE_API return_candidate(mredis::AsyncClientSPtr n_redis, std::string &n_candidate, const std::uint64_t n_lease, const bool n_success);
+
+//! the outcome of one attempt, to be returned in batches
+struct candidate_result {
+	std::string   m_candidate;
+	std::uint64_t m_lease = 0;      //!< as given by the poll
+	bool          m_success = false;
+};
+
+/*! @brief poll the work queue for up to n_count candidates in one round trip
+
+	@param n_candidates leased candidates are appended to this
+	@param n_lease expiry of the leases, the same for all of the batch
+	@param n_lease_seconds how long the leases last. Leave enough time to work on all of them
+	@return number of candidates leased, 0 when the queue is empty
+ */
+std::size_t RESCUE_API poll_candidates(mredis::AsyncClientSPtr n_redis, const std::size_t n_count,
+                                       std::vector<std::string> &n_candidates, std::uint64_t &n_lease,
+                                       const unsigned int n_lease_seconds = 600);
+
+/*! @brief return many leases to the work queue with results in one round trip
+ */
+void RESCUE_API return_candidates(mredis::AsyncClientSPtr n_redis, const std::vector<candidate_result> &n_results);
+
+/*! @brief per thread buffer of leased candidates
+
+	Leases candidates in batches and requests the next batch in the background
+	while the buffer is still half full, so the worker hardly ever waits for redis.
+	Results are collected and returned in batches as well.
+ */
+class LeaseBuffer final {
+
+	public:
+		RESCUE_API LeaseBuffer(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size = 8, const unsigned int n_lease_seconds = 600);
+
+		//! returns collected results
+		RESCUE_API ~LeaseBuffer() noexcept;
+
+		LeaseBuffer(const LeaseBuffer &) = delete;
+		LeaseBuffer &operator=(const LeaseBuffer &) = delete;
+
+		/*! @brief get the next leased candidate
+			@return false when the queue is empty
+		 */
+		RESCUE_API bool next(std::string &n_candidate);
+
+		//! record the result of an attempt, returned with the next full batch
+		RESCUE_API void result(const std::string &n_candidate, const bool n_success);
+
+		//! return all recorded results now
+		RESCUE_API void flush();
+
+	private:
+		struct Request;
+
+		void request();
+		void collect();
+
+		mredis::AsyncClientSPtr                            m_redis;
+		const std::size_t                                  m_batch_size;
+		const unsigned int                                 m_lease_seconds;
+		std::deque<std::pair<std::string, std::uint64_t> > m_buffer;     //!< leased, not yet handed out
+		std::unordered_map<std::string, std::uint64_t>     m_leased;     //!< handed out, lease by candidate
+		std::unique_ptr<Request>                           m_request;    //!< poll in flight, if any
+		std::vector<candidate_result>                      m_results;    //!< not yet returned
+};
+
+/*! @brief enter a chunk of candidates into the work queue on redis
+
+	@return true when entered, false when the same chunk was already tried or already queued
+
+	@throw redis_error
+ */
+bool RESCUE_API queue_candidate(mredis::AsyncClientSPtr n_redis, const work_chunk &n_chunk);
+
+/*! @brief enter all permutations of a pattern into the queue, n_chunk_size candidates per work item
+
+	@return the number of chunks that were entered
+
+	@throw serialization_error on bad pattern
+ */
+std::size_t RESCUE_API queue_pattern(mredis::AsyncClientSPtr n_redis, const std::string &n_pattern, const std::uint64_t n_chunk_size);
+
+/*! @brief poll the work queue for a chunk of candidates
+
+	@param n_lease_seconds how long the lease lasts. Leave enough time to work on the whole chunk
+
+	@return true on chunk available and lease established otherwise false
+ */
+bool RESCUE_API poll_candidate(mredis::AsyncClientSPtr n_redis, work_chunk &n_chunk, const unsigned int n_lease_seconds = 3600);
+
+/*! @brief return a chunk lease to the work queue with results
+	@param n_success set to true when one of the candidates in the chunk worked
+ */
+void RESCUE_API return_candidate(mredis::AsyncClientSPtr n_redis, const work_chunk &n_chunk, const bool n_success);
+
+/*! @brief where a worker gets its work from and returns the results to
+
+	Calls for candidates, which are next(), result() and flush() on strings,
+	must not overlap. Calls for chunks and exhausted() may come from many
+	threads at once, also while candidates are being handled. Workers share
+	one through a Scheduler, which serializes the calls for candidates.
+	There is one for the queue on redis and LocalQueue for single machine runs.
+ */
+class WorkQueue {
+
+	public:
+		virtual ~WorkQueue() noexcept = default;
+
+		//! @return false when there is no candidate right now
+		virtual bool next(std::string &n_candidate) = 0;
+
+		//! record the result of an attempt
+		virtual void result(const std::string &n_candidate, const bool n_success) = 0;
+
+		//! @return false when there is no chunk right now
+		virtual bool next(work_chunk &n_chunk) = 0;
+
+		//! record the result of a whole chunk
+		virtual void result(const work_chunk &n_chunk, const bool n_success) = 0;
+
+		//! return results that may have been held back
+		virtual void flush() {}
+
+		//! @return true when no work will ever come again and the worker can stop
+		virtual bool exhausted() const { return false; }
+};
+
+/*! @brief the work queue on redis, as shared by all clients and servers
+
+	Candidates are leased through a LeaseBuffer of n_batch_size.
+	The queue is never exhausted, clients may always add more.
+ */
+class RedisWorkQueue final : public WorkQueue {
+
+	public:
+		RESCUE_API RedisWorkQueue(mredis::AsyncClientSPtr n_redis, const std::size_t n_batch_size = 8);
+
+		RESCUE_API bool next(std::string &n_candidate) override;
+		RESCUE_API void result(const std::string &n_candidate, const bool n_success) override;
+		RESCUE_API bool next(work_chunk &n_chunk) override;
+		RESCUE_API void result(const work_chunk &n_chunk, const bool n_success) override;
+		RESCUE_API void flush() override;
+
+	private:
+		mredis::AsyncClientSPtr m_redis;
+		LeaseBuffer             m_candidates;
+};
 
 } // namespace rescue
 } // namespace moose
@@ -5,6 +5,8 @@
 
 #include "InputGenerator.hpp"
 #include "WorkQueue.hpp"
+#include "Checkpoint.hpp"
+#include "MappedInput.hpp"
 
 #include "mredis/AsyncClient.hpp"
 
@@ -14,15 +16,27 @@
 #include <boost/config.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
 
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
 #include <cstdlib>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
 using namespace moose::mredis;
 using namespace moose::tools;
@@ -30,7 +44,225 @@ using namespace moose::rescue;
 
 namespace fs = boost::filesystem;
 
+namespace {
+
+/* Load the filter of known candidates from n_file or build it from the queue.
+ * A saved filter of another queue identity, or that knows of more items than
+ * the queue has, belongs to a queue that has since been reset. It would skip
+ * candidates that were never tried
+ */
+std::unique_ptr<BloomFilter> open_filter(AsyncClientSPtr n_redis, const fs::path &n_file, const std::uint64_t n_capacity,
+                                         const std::string &n_queue_id) {
+
+	const std::uint64_t items = queue_items(n_redis);
+
+	boost::system::error_code errc;
+	if (fs::exists(n_file, errc)) {
+		try {
+			std::unique_ptr<BloomFilter> filter{ new BloomFilter{ n_file } };
+			if ((filter->queue_id() == n_queue_id) && (filter->queue_items() <= items)) {
+				std::cout << "Loaded filter of " << filter->size() << " known candidates from " << n_file << std::endl;
+				return filter;
+			}
+			std::cout << "Filter " << n_file << " is from another queue, rebuilding it" << std::endl;
+		} catch (const moose_error &merr) {
+			std::cerr << "Could not load filter " << n_file << ", rebuilding it: " << boost::diagnostic_information(merr) << std::endl;
+		}
+	}
+
+	// Leave some room to grow
+	std::unique_ptr<BloomFilter> filter{ new BloomFilter{ std::max(n_capacity, 2 * items) } };
+	std::cout << "Seeding filter with " << items << " queued candidates..." << std::endl;
+	seed_filter(n_redis, *filter);
+	return filter;
+}
+
+/* A bounded queue between two stages of the pipeline. push() blocks while
+ * it is full and pop() while it is empty. Once closed, pushing fails and
+ * popping only drains what is left, so no stage waits for one that is gone.
+ */
+template <typename T>
+class Channel {
+
+	public:
+		explicit Channel(const std::size_t n_capacity)
+		        : m_capacity{ std::max<std::size_t>(1, n_capacity) } {
+		}
+
+		//! @return false when closed
+		bool push(T &&n_item) {
+
+			boost::unique_lock<boost::mutex> lock(m_mutex);
+			m_not_full.wait(lock, [&] { return m_closed || (m_items.size() < m_capacity); });
+			if (m_closed) {
+				return false;
+			}
+
+			m_items.push_back(std::move(n_item));
+			lock.unlock();
+			m_not_empty.notify_one();
+			return true;
+		}
+
+		//! @return false when closed and empty
+		bool pop(T &n_item) {
+
+			boost::unique_lock<boost::mutex> lock(m_mutex);
+			m_not_empty.wait(lock, [&] { return m_closed || !m_items.empty(); });
+			if (m_items.empty()) {
+				return false;
+			}
+
+			n_item = std::move(m_items.front());
+			m_items.pop_front();
+			lock.unlock();
+			m_not_full.notify_one();
+			return true;
+		}
+
+		void close() {
+
+			{
+				boost::lock_guard<boost::mutex> lock(m_mutex);
+				m_closed = true;
+			}
+			m_not_full.notify_all();
+			m_not_empty.notify_all();
+		}
+
+	private:
+		const std::size_t         m_capacity;
+		boost::mutex              m_mutex;
+		boost::condition_variable m_not_full;
+		boost::condition_variable m_not_empty;
+		std::deque<T>             m_items;
+		bool                      m_closed = false;
+};
+
+/* A Deduplicator for all generator threads, split by hash so they
+ * rarely wait for each other.
+ */
+class SharedDeduplicator {
+
+	public:
+		SharedDeduplicator(const std::size_t n_max_bytes, const std::size_t n_shards) {
+
+			for (std::size_t i = 0; i < n_shards; i++) {
+				m_shards.emplace_back(new Shard{ n_max_bytes / n_shards });
+			}
+		}
+
+		bool insert(const std::string &n_candidate) {
+
+			Shard &shard = *m_shards[std::hash<std::string>{}(n_candidate) % m_shards.size()];
+			boost::lock_guard<boost::mutex> lock(shard.m_mutex);
+			return shard.m_dedup.insert(n_candidate);
+		}
+
+		std::uint64_t duplicates() {
+
+			std::uint64_t ret = 0;
+			for (const std::unique_ptr<Shard> &shard : m_shards) {
+				boost::lock_guard<boost::mutex> lock(shard->m_mutex);
+				ret += shard->m_dedup.duplicates();
+			}
+			return ret;
+		}
+
+	private:
+		struct Shard {
+			explicit Shard(const std::size_t n_max_bytes)
+			        : m_dedup{ n_max_bytes } {
+			}
+
+			boost::mutex m_mutex;
+			Deduplicator m_dedup;
+		};
+
+		std::vector<std::unique_ptr<Shard> > m_shards;
+};
+
+//! candidates of a line ready for redis. The last one of each line says so, it may be empty
+struct batch_job {
+	std::size_t    m_range = 0;
+	std::uint64_t  m_line = 0;
+	bool           m_last = false;
+	prepared_batch m_batch;
+};
+
+struct pipeline_stats {
+	std::atomic<std::uint64_t> m_lines{ 0 };
+	std::atomic<std::uint64_t> m_generated{ 0 };
+};
+
+/* Generator stage: take ranges of the input and expand their lines into candidates,
+ * drop duplicates, hash and encrypt them in batches. That is where the time goes,
+ * so there are many of these. Lines before n_done_lines are skipped
+ */
+void generate(const MappedInput &n_input, const std::vector<input_range> &n_ranges, std::atomic<std::size_t> &n_next_range,
+              const std::uint64_t n_done_lines, Channel<batch_job> &n_batches, SharedDeduplicator *n_dedup,
+              const std::size_t n_batch_size, const bool n_quiet, pipeline_stats &n_stats) {
+
+	std::vector<std::string> candidates;
+	candidates.reserve(n_batch_size);
 
+	for (std::size_t r = n_next_range++; r < n_ranges.size(); r = n_next_range++) {
+
+		std::size_t offset = n_ranges[r].m_begin;
+		std::uint64_t number = n_ranges[r].m_first_line;
+		for (boost::string_view line; n_input.next_line(offset, n_ranges[r].m_end, line); number++) {
+
+			if (number < n_done_lines) {
+				continue;
+			}
+
+			batch_job batch;
+			batch.m_range = r;
+			batch.m_line = number;
+
+			const auto emit = [&](const bool n_last) {
+				prepare_batch(candidates, batch.m_batch);
+				candidates.clear();
+				batch.m_last = n_last;
+				return n_batches.push(std::move(batch));
+			};
+
+			if (!line.empty()) {
+
+				// Every line again with an added token "Master"
+				//const std::string master{ line.to_string() + " [Master|Slave] [1|2]" };
+				for (const std::string &pattern : { line.to_string(), line.to_string() + " Master [1|2]" }) {
+
+					PermutationGenerator permutations{ pattern };
+					if (!n_quiet) {
+						std::ostringstream os;
+						os << "Crunching input: " << pattern << " yielded " << permutations.size() << " permutations\n";
+						std::cout << os.str();
+					}
+
+					for (const std::string &candidate : permutations) {
+						n_stats.m_generated++;
+						if (n_dedup && !n_dedup->insert(candidate)) {
+							continue;
+						}
+
+						candidates.push_back(candidate);
+						if ((candidates.size() >= n_batch_size) && !emit(false)) {
+							return;
+						}
+					}
+				}
+			}
+
+			if (!emit(true)) {
+				return;
+			}
+			n_stats.m_lines++;
+		}
+	}
+}
+
+} // anon namespace
 
 int main(int argc, char **argv) {
 	
@@ -49,7 +281,17 @@ int main(int argc, char **argv) {
 	desc.add_options()
 	    ("help,h",   "Print this help message")
 	    ("server,s", po::value<std::string>()->default_value("127.0.0.1"), "give redis server ip")
-	    ("file,f",   po::value<std::string>()->default_value("candidates.txt"), "input file name");
+	    ("file,f",   po::value<std::string>()->default_value("candidates.txt"), "input file name")
+	    ("chunk-size,c", po::value<std::uint64_t>()->default_value(0), "queue chunks of this many candidates instead of each one, 0 to disable")
+	    ("batch-size,b", po::value<std::size_t>()->default_value(1000), "number of candidates sent to redis in one call")
+	    ("in-flight,i",  po::value<std::size_t>()->default_value(64), "number of batches sent without waiting for a response")
+	    ("binary-keys",  "key a new queue by 16 binary bytes instead of hex digits. Existing queues keep their format")
+	    ("filter",       po::value<std::string>()->default_value("rescue_client.filter"), "file to keep the filter of known candidates in, empty to disable")
+	    ("filter-capacity", po::value<std::uint64_t>()->default_value(10000000), "number of candidates a new filter is sized for")
+	    ("dedup-memory", po::value<std::size_t>()->default_value(256), "MiB to remember generated candidates in to drop duplicates, 0 to disable")
+	    ("checkpoint",   po::value<std::string>()->default_value(""), "directory to record progress in, so a restart skips lines already queued")
+	    ("threads,t",    po::value<unsigned int>()->default_value(std::max(1u, boost::thread::hardware_concurrency())), "number of threads generating candidates")
+	    ("quiet,q",      "don't report every line, only the rates every few seconds");
 
 	try {
 		po::variables_map vm;
@@ -75,44 +317,210 @@ int main(int argc, char **argv) {
 			return EXIT_FAILURE;
 		}
 
-		std::uint32_t count = 0;
+		// A queue has one key format. Only a new one can be told which
+		const key_format format = establish_key_format(redis, vm.count("binary-keys") ? key_format::binary : key_format::hex);
+		std::cout << "Queue uses " << to_string(format) << " keys" << std::endl;
 
-		// Open input file and read line by line, parse and enter into work queue
-		fs::ifstream ifile(infile, std::ios::in);
+		// Anything we keep about the queue on disk is only good until it is reset
+		const std::string queue_id = queue_identity(redis);
 
-		for (std::string line; std::getline(ifile, line); ) {
+		const std::uint64_t chunk_size = vm["chunk-size"].as<std::uint64_t>();
+		std::size_t count = 0;
 
-			if (line.empty()) {
-				continue;
+		// Candidates known from earlier runs are skipped without asking redis
+		const fs::path filter_file{ vm["filter"].as<std::string>() };
+		std::unique_ptr<BloomFilter> filter;
+		if (!filter_file.empty()) {
+			filter = open_filter(redis, filter_file, vm["filter-capacity"].as<std::uint64_t>(), queue_id);
+		}
+
+		const std::size_t batch_size = vm["batch-size"].as<std::size_t>();
+		BatchInserter inserter{ redis, batch_size, vm["in-flight"].as<std::size_t>(), filter.get() };
+
+		// Patterns overlap a lot. Duplicates are dropped before they are hashed
+		const std::size_t dedup_memory = vm["dedup-memory"].as<std::size_t>();
+		std::unique_ptr<SharedDeduplicator> dedup;
+		if (dedup_memory > 0) {
+			dedup.reset(new SharedDeduplicator{ dedup_memory * 1024 * 1024, 64 });
+		}
+
+		const bool quiet = vm.count("quiet") > 0;
+		const unsigned int threads = std::max(1u, vm["threads"].as<unsigned int>());
+
+		// Progress is only good for the same input queued the same way
+		std::unique_ptr<Checkpoint> checkpoint;
+		std::uint64_t done_lines = 0;
+		if (!vm["checkpoint"].as<std::string>().empty()) {
+			const fs::path checkpoint_dir{ vm["checkpoint"].as<std::string>() };
+			const std::string input_settings = "client " + fs::absolute(infile).string() + " chunk size " + std::to_string(chunk_size);
+			const std::string settings = input_settings + " queue " + queue_id;
+
+			// The lines were queued into a queue that has since been reset, so they are gone
+			const boost::optional<std::string> previous = Checkpoint::settings(checkpoint_dir);
+			if (previous && (*previous != settings)
+			        && ((*previous == input_settings) || (previous->compare(0, input_settings.size() + 7, input_settings + " queue ") == 0))) {
+				std::cout << "Checkpoint " << checkpoint_dir << " is from another queue, starting over\n";
+				Checkpoint::clear(checkpoint_dir);
+			}
+
+			checkpoint.reset(new Checkpoint{ checkpoint_dir, settings });
+			done_lines = checkpoint->input_position();
+			if (done_lines) {
+				std::cout << "Skipping " << done_lines << " lines queued before\n";
 			}
+		}
+
+		// Map the input file and go through it line by line, parse and enter into work queue
+		const MappedInput input{ infile };
 
-			std::cout << "Crunching input: " << line << std::endl;
+		// In chunk mode we only enter index ranges and the server generates the candidates.
+		// That's a few calls per line, no need to parallelize
+		if (chunk_size > 0) {
+			std::uint64_t lines = 0;
+			std::size_t offset = 0;
+			for (boost::string_view view; input.next_line(offset, input.size(), view); ) {
+
+				if ((++lines <= done_lines) || view.empty()) {
+					continue;
+				}
 
-			std::vector<std::string> permutations;
-			std::size_t num = generate_permutations(line, permutations);
-			std::cout << " yielded " << num << " permutations. Inserting them into Q...." << std::endl;
+				const std::string line = view.to_string();
+				std::size_t num = queue_pattern(redis, line, chunk_size);
+				num += queue_pattern(redis, line + " Master [1|2]", chunk_size);
+				if (!quiet) {
+					std::cout << "Crunching input: " << line << " yielded " << num << " chunks\n";
+				}
+				count += num;
 
-			for (const std::string &candidate : permutations) {
-				std::cout << "queing " << candidate << std::endl;
-				if (queue_candidate(redis, candidate)) {
-					count++;
+				if (checkpoint) {
+					checkpoint->input_done(lines);
+				}
+			}
+		} else {
+
+			/* Candidates go through a pipeline: generator threads take ranges of the input,
+			 * expand, hash and encrypt their lines and this thread takes the batches to redis.
+			 * Generating is the expensive part, so there are as many generators as cores.
+			 * Lines differ a lot in what they yield, more ranges than generators even that out
+			 */
+			const std::vector<input_range> ranges = input.split(16 * threads);
+			std::atomic<std::size_t> next_range{ 0 };
+
+			Channel<batch_job> batch_channel{ 4 * threads };
+			pipeline_stats stats;
+
+			boost::mutex error_mutex;
+			std::exception_ptr error;
+
+			const auto fail = [&] {
+				{
+					boost::lock_guard<boost::mutex> lock(error_mutex);
+					if (!error) {
+						error = std::current_exception();
+					}
 				}
+				batch_channel.close();
+			};
+
+			boost::thread_group generators;
+			for (unsigned int i = 0; i < threads; i++) {
+				generators.create_thread([&] {
+					try {
+						generate(input, ranges, next_range, done_lines, batch_channel, dedup.get(), batch_size, quiet, stats);
+					} catch (...) {
+						fail();
+					}
+				});
 			}
 
-			// Now do that again with an added tokens "Master"
-			permutations.clear();
-			//num = generate_permutations(line + " [Master|Slave] [1|2]", permutations);
-			num = generate_permutations(line + " Master [1|2]", permutations);
-			std::cout << " yielded " << num << " permutations plus 'Master'. Inserting them into Q...." << std::endl;
-			for (const std::string &candidate : permutations) {
-				std::cout << "queing '" << candidate << "'" << std::endl;
-				if (queue_candidate(redis, candidate)) {
-					count++;
+			// Once all generators are done, so are the batches
+			boost::thread closer{ [&] {
+				generators.join_all();
+				batch_channel.close();
+			}};
+
+			/* Each range is done in order by one generator, but ranges in any order.
+			 * So we track the next line of each range and everything before the
+			 * first unfinished range is in redis once flushed
+			 */
+			std::vector<std::uint64_t> range_next;
+			for (const input_range &range : ranges) {
+				range_next.push_back(std::min(std::max(range.m_first_line, done_lines), range.m_first_line + range.m_lines));
+			}
+			std::size_t first_open = 0;
+			const auto lines_done = [&] {
+				while ((first_open < ranges.size()) && (range_next[first_open] == ranges[first_open].m_first_line + ranges[first_open].m_lines)) {
+					first_open++;
+				}
+				return (first_open < ranges.size()) ? range_next[first_open] : (ranges.empty() ? done_lines : range_next.back());
+			};
+
+			const auto start = std::chrono::steady_clock::now();
+			auto last_report = start;
+			auto last_checkpoint = start;
+
+			try {
+				batch_job batch;
+				while (batch_channel.pop(batch)) {
+
+					inserter.add(batch.m_batch);
+
+					if (batch.m_last) {
+						range_next[batch.m_range] = batch.m_line + 1;
+					}
+
+					const auto now = std::chrono::steady_clock::now();
+
+					// Not after every line, flushing stalls the pipeline
+					if (checkpoint && (now - last_checkpoint >= std::chrono::seconds(1))) {
+						inserter.flush();
+						checkpoint->input_done(lines_done());
+						last_checkpoint = now;
+					}
+
+					if (now - last_report >= std::chrono::seconds(5)) {
+						const double seconds = std::chrono::duration<double>(now - start).count();
+						std::cout << stats.m_lines.load() << " lines, " << stats.m_generated.load() << " candidates generated ("
+						          << static_cast<std::uint64_t>(stats.m_generated.load() / seconds) << "/s), "
+						          << inserter.inserted() << " inserted ("
+						          << static_cast<std::uint64_t>(inserter.inserted() / seconds) << "/s)\n";
+						last_report = now;
+					}
 				}
+			} catch (...) {
+				fail();
 			}
+
+			closer.join();
+			if (error) {
+				std::rethrow_exception(error);
+			}
+
+			count += inserter.flush();
+			if (checkpoint) {
+				checkpoint->input_done(lines_done());
+			}
+
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << stats.m_lines.load() << " lines, " << stats.m_generated.load() << " candidates generated in "
+			          << seconds << "s on " << threads << " threads\n";
 		}
 
-		std::cout << "done, " << count << " candidates inserted" << std::endl;
+		std::cout << "done, " << count << ((chunk_size > 0) ? " chunks" : " candidates") << " inserted" << std::endl;
+
+		if (dedup) {
+			std::cout << dedup->duplicates() << " duplicate candidates were dropped" << std::endl;
+		}
+
+		if (filter) {
+			std::cout << inserter.skipped() << " candidates were known to the filter" << std::endl;
+			if (filter->saturated()) {
+				std::cout << "Filter is over capacity and no longer used to skip candidates. Raise --filter-capacity and delete "
+				          << filter_file << std::endl;
+			}
+			// With the identity from the start. Should the queue have been reset since, this filter isn't its
+			filter->save(filter_file, queue_items(redis), queue_id);
+		}
 
 		return EXIT_SUCCESS;
 
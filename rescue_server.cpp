@@ -15,12 +15,14 @@
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
 
 #include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <cstdlib>
 #include <string>
@@ -49,7 +51,13 @@ int main(int argc, char **argv) {
 	desc.add_options()
 	    ("help,h",   "Print this help message")
 	    ("server,s", po::value<std::string>()->default_value("127.0.0.1"), "give redis server ip")
-	    ("file,f",   po::value<std::string>()->default_value("luks_header"), "input file name");
+	    ("file,f",   po::value<std::string>()->default_value("luks_header"), "input file name")
+	    ("cryptsetup", "activate through libcryptsetup instead of checking key slots natively")
+	    ("slot",     po::value<std::string>()->default_value("all"), "key slot to attack: a slot number, 'cheapest' or 'all'")
+	    ("local",    "work alone without redis, on the patterns given by --input")
+	    ("input,i",  po::value<std::string>()->default_value("candidates.txt"), "input patterns for --local, one per line")
+	    ("chunk-size,c", po::value<std::uint64_t>()->default_value(10000), "candidates per chunk for --local")
+	    ("checkpoint", po::value<std::string>()->default_value(""), "directory to record progress of --local in and resume from");
 
 	try {
 		po::variables_map vm;
@@ -73,8 +81,51 @@ int main(int argc, char **argv) {
 			return EXIT_FAILURE;
 		}
 
+		// Either all active slots cheapest first, only the cheapest or just the one given
+		const std::string slot_string = vm["slot"].as<std::string>();
+		int slot = any_key_slot;
+		if (slot_string == "cheapest") {
+			slot = cheapest_key_slot;
+		} else if (slot_string != "all") {
+			try {
+				slot = boost::lexical_cast<int>(slot_string);
+			} catch (const boost::bad_lexical_cast &) {
+				slot = -1;
+			}
+
+			if (slot < 0) {
+				std::cerr << "Invalid key slot '" << slot_string << "', expected a slot number, 'cheapest' or 'all'" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		// Progress on the queue is kept in redis, only local runs have their own
+		if (!vm["checkpoint"].as<std::string>().empty() && !vm.count("local")) {
+			std::cerr << "--checkpoint only works with --local" << std::endl;
+			return EXIT_FAILURE;
+		}
+
 		RescueServer server(server_ip_string);
-		server.run(filename);
+
+		// Locally we feed ourselves with what the client would have put into redis
+		if (vm.count("local")) {
+			const fs::path input = vm["input"].as<std::string>();
+			const std::uint64_t chunk_size = vm["chunk-size"].as<std::uint64_t>();
+
+			if (!fs::is_regular_file(input, errc) || errc) {
+				std::cerr << "Could not access input file '" << input << "': " << errc << std::endl;
+				return EXIT_FAILURE;
+			}
+			if (chunk_size == 0) {
+				std::cerr << "Chunk size must not be 0" << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			const bool done = server.run_local(filename, input, chunk_size, !vm.count("cryptsetup"), slot, vm["checkpoint"].as<std::string>());
+			return done ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+
+		server.run(filename, !vm.count("cryptsetup"), slot);
 
 		return EXIT_SUCCESS;
 
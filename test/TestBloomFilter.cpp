@@ -0,0 +1,130 @@
+
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE BloomFilterTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/BloomFilter.hpp"
+#include "rescue/Sha512.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace moose::tools;
+using namespace moose::rescue;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::vector<sha512_digest> make_digests(const std::string &n_prefix, const std::size_t n_count) {
+
+	std::vector<std::string> inputs;
+	for (std::size_t i = 0; i < n_count; i++) {
+		inputs.push_back(n_prefix + std::to_string(i));
+	}
+
+	std::vector<sha512_digest> digests;
+	sha512_batch(inputs, digests);
+	return digests;
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(InsertContains) {
+
+	BloomFilter filter{ 10000, 1e-6 };
+	const std::vector<sha512_digest> known = make_digests("known ", 10000);
+	const std::vector<sha512_digest> unknown = make_digests("unknown ", 10000);
+
+	for (const sha512_digest &d : known) {
+		BOOST_CHECK(!filter.contains(d));
+		filter.insert(d);
+	}
+
+	// Never a false negative
+	for (const sha512_digest &d : known) {
+		BOOST_CHECK(filter.contains(d));
+		BOOST_CHECK(filter.insert(d));
+	}
+
+	// and at that rate hardly any false positives
+	std::size_t false_positives = 0;
+	for (const sha512_digest &d : unknown) {
+		if (filter.contains(d)) {
+			false_positives++;
+		}
+	}
+	BOOST_CHECK(false_positives <= 1);
+
+	BOOST_CHECK(filter.size() <= 10000);
+	BOOST_CHECK(!filter.saturated());
+
+	// The raw key prefix is the same thing
+	const sha512_digest extra = make_digests("extra", 1).front();
+	filter.insert(extra.data());
+	BOOST_CHECK(filter.contains(extra));
+}
+
+BOOST_AUTO_TEST_CASE(Saturation) {
+
+	BloomFilter filter{ 100 };
+	const std::vector<sha512_digest> digests = make_digests("many ", 101);
+	for (const sha512_digest &d : digests) {
+		filter.insert(d);
+	}
+
+	BOOST_CHECK(filter.saturated());
+}
+
+BOOST_AUTO_TEST_CASE(SaveLoad) {
+
+	const fs::path file = fs::temp_directory_path() / fs::unique_path("rescue-filter-%%%%-%%%%");
+
+	BloomFilter filter{ 1000 };
+	const std::vector<sha512_digest> digests = make_digests("saved ", 500);
+	for (const sha512_digest &d : digests) {
+		filter.insert(d);
+	}
+	BOOST_REQUIRE_NO_THROW(filter.save(file, 4711, "0123456789abcdef0123456789abcdef"));
+
+	{
+		std::unique_ptr<BloomFilter> loaded;
+		BOOST_REQUIRE_NO_THROW(loaded.reset(new BloomFilter{ file }));
+		BOOST_CHECK(loaded->queue_items() == 4711);
+		BOOST_CHECK(loaded->queue_id() == "0123456789abcdef0123456789abcdef");
+		BOOST_CHECK(loaded->size() == filter.size());
+		BOOST_CHECK(loaded->capacity() == 1000);
+		for (const sha512_digest &d : digests) {
+			BOOST_CHECK(loaded->contains(d));
+		}
+	}
+
+	// A header claiming more bits than the file has is refused before allocating them
+	const char absurd[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	const char plausible[] = { 0, 0, 0, 0x40, 0, 0, 0, 0 };
+	for (const char *bits : { absurd, plausible }) {
+		{
+			fs::fstream out(file, std::ios::in | std::ios::out | std::ios::binary);
+			out.seekp(16);
+			out.write(bits, 8);
+		}
+		BOOST_CHECK_THROW(BloomFilter{ file }, serialization_error);
+	}
+
+	// Anything else is refused
+	{
+		fs::ofstream out(file, std::ios::out | std::ios::trunc);
+		out << "not a filter at all, just some text that is long enough for a header";
+	}
+	BOOST_CHECK_THROW(BloomFilter{ file }, serialization_error);
+
+	fs::remove(file);
+	BOOST_CHECK_THROW(BloomFilter{ file }, serialization_error);
+}
@@ -0,0 +1,219 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE CheckpointTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/Checkpoint.hpp"
+#include "rescue/LocalQueue.hpp"
+#include "rescue/InputGenerator.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <memory>
+#include <string>
+
+using namespace moose::tools;
+using namespace moose::rescue;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::string pattern{ "[a|b|c] [1|2|3] [x|y|z]" };
+
+//! a fresh directory, removed again when done
+struct TempDir {
+
+	TempDir()
+	        : m_path{ fs::temp_directory_path() / fs::unique_path("rescue-checkpoint-%%%%-%%%%") } {
+	}
+
+	~TempDir() {
+
+		boost::system::error_code errc;
+		fs::remove_all(m_path, errc);
+	}
+
+	fs::path m_path;
+};
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(Ranges) {
+
+	TempDir dir;
+	const std::uint64_t size = count_permutations(pattern);
+	BOOST_REQUIRE(size > 20);
+
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		BOOST_CHECK_EQUAL(checkpoint.input_position(), 0u);
+		BOOST_CHECK(!checkpoint.is_done(pattern, 0, 1));
+
+		checkpoint.done(pattern, 10, 20);
+		checkpoint.done(pattern, 0, 5);
+		checkpoint.done(pattern, 5, 10);
+		checkpoint.input_done(3);
+
+		BOOST_CHECK(checkpoint.is_done(pattern, 0, 20));
+		BOOST_CHECK(checkpoint.is_done(pattern, 3, 17));
+		BOOST_CHECK(!checkpoint.is_done(pattern, 15, 21));
+		BOOST_CHECK(!checkpoint.complete(pattern));
+		BOOST_CHECK(!checkpoint.is_done("other", 0, 1));
+	}
+
+	// All of it is still there after a restart
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		BOOST_CHECK_EQUAL(checkpoint.input_position(), 3u);
+		BOOST_CHECK(checkpoint.is_done(pattern, 0, 20));
+		BOOST_CHECK(!checkpoint.is_done(pattern, 20, 21));
+
+		checkpoint.done(pattern, 20, size);
+		BOOST_CHECK(checkpoint.complete(pattern));
+	}
+
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		BOOST_CHECK(checkpoint.complete(pattern));
+	}
+
+	// Progress for another header is no good here
+	BOOST_CHECK_THROW(Checkpoint(dir.m_path, "other settings"), serialization_error);
+
+	// Unless it is dropped
+	BOOST_CHECK(Checkpoint::settings(dir.m_path) == std::string{ "settings" });
+	Checkpoint::clear(dir.m_path);
+	BOOST_CHECK(!Checkpoint::settings(dir.m_path));
+	{
+		Checkpoint checkpoint{ dir.m_path, "other settings" };
+		BOOST_CHECK_EQUAL(checkpoint.input_position(), 0u);
+		BOOST_CHECK(!checkpoint.is_done(pattern, 0, 1));
+	}
+	BOOST_CHECK(Checkpoint::settings(dir.m_path) == std::string{ "other settings" });
+}
+
+BOOST_AUTO_TEST_CASE(BadPattern) {
+
+	TempDir dir;
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		BOOST_CHECK_THROW(checkpoint.complete("[bad"), serialization_error);
+		BOOST_CHECK(!checkpoint.is_done("[bad", 0, 1));
+
+		// Nothing is left behind that could trip up later calls or the destructor
+		checkpoint.done(pattern, 0, 1);
+		BOOST_CHECK(checkpoint.is_done(pattern, 0, 1));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ManyPatterns) {
+
+	TempDir dir;
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+
+		// Asking about patterns without progress doesn't touch the disk
+		for (int i = 0; i < 2000; i++) {
+			BOOST_CHECK(!checkpoint.complete("pattern [" + std::to_string(i) + "|x]"));
+		}
+
+		// Progress on all of them goes into one file
+		for (int i = 0; i < 2000; i++) {
+			checkpoint.done("pattern [" + std::to_string(i) + "|x]", 0, 1);
+		}
+	}
+
+	std::size_t files = 0;
+	for (fs::directory_iterator it{ dir.m_path }; it != fs::directory_iterator{}; ++it) {
+		files++;
+	}
+	BOOST_CHECK_EQUAL(files, 2u);
+
+	Checkpoint checkpoint{ dir.m_path, "settings" };
+	for (int i = 0; i < 2000; i++) {
+		BOOST_CHECK(checkpoint.is_done("pattern [" + std::to_string(i) + "|x]", 0, 1));
+		BOOST_CHECK(!checkpoint.is_done("pattern [" + std::to_string(i) + "|x]", 1, 2));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(TornRecord) {
+
+	TempDir dir;
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		checkpoint.done(pattern, 0, 4);
+		checkpoint.input_done(1);
+	}
+
+	// As if we crashed in the middle of writing a record
+	for (fs::directory_iterator it{ dir.m_path }; it != fs::directory_iterator{}; ++it) {
+		fs::ofstream out(it->path(), std::ios::out | std::ios::app | std::ios::binary);
+		out << "torn";
+	}
+
+	{
+		Checkpoint checkpoint{ dir.m_path, "settings" };
+		BOOST_CHECK_EQUAL(checkpoint.input_position(), 1u);
+		BOOST_CHECK(checkpoint.is_done(pattern, 0, 4));
+
+		// Appended records must not be shifted by what was cut off
+		checkpoint.done(pattern, 4, 8);
+		checkpoint.input_done(2);
+	}
+
+	Checkpoint checkpoint{ dir.m_path, "settings" };
+	BOOST_CHECK_EQUAL(checkpoint.input_position(), 2u);
+	BOOST_CHECK(checkpoint.is_done(pattern, 0, 8));
+	BOOST_CHECK(!checkpoint.is_done(pattern, 8, 9));
+}
+
+BOOST_AUTO_TEST_CASE(SkipDone) {
+
+	TempDir dir;
+	Checkpoint checkpoint{ dir.m_path, "settings" };
+	const std::uint64_t size = count_permutations(pattern);
+
+	// Ten chunks, so they all fit into the queue
+	const std::uint64_t chunk_size = (size + 9) / 10;
+	const std::size_t chunks = static_cast<std::size_t>((size + chunk_size - 1) / chunk_size);
+
+	// The first run gets through two chunks
+	{
+		LocalQueue queue{ 64, &checkpoint };
+		BOOST_REQUIRE_EQUAL(queue.queue_pattern(pattern, chunk_size), chunks);
+		queue.close();
+
+		std::unique_ptr<WorkQueue> worker = queue.worker();
+		work_chunk chunk;
+		for (int i = 0; i < 2; i++) {
+			BOOST_REQUIRE(worker->next(chunk));
+			worker->result(chunk, false);
+		}
+	}
+
+	// The next one only gets what is left
+	{
+		LocalQueue queue{ 64, &checkpoint };
+		BOOST_CHECK_EQUAL(queue.queue_pattern(pattern, chunk_size), chunks - 2);
+		queue.close();
+
+		std::unique_ptr<WorkQueue> worker = queue.worker();
+		work_chunk chunk;
+		BOOST_REQUIRE(worker->next(chunk));
+		BOOST_CHECK_EQUAL(chunk.m_begin, 2 * chunk_size);
+
+		do {
+			worker->result(chunk, false);
+		} while (worker->next(chunk));
+	}
+
+	BOOST_CHECK(checkpoint.complete(pattern));
+
+	LocalQueue queue{ 64, &checkpoint };
+	BOOST_CHECK_EQUAL(queue.queue_pattern(pattern, chunk_size), 0u);
+}
@@ -7,6 +7,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "rescue/InputGenerator.hpp"
+#include "rescue/InputParser.hpp"
 #include "tools/Error.hpp"
 
 #include <boost/algorithm/string.hpp>
@@ -83,3 +84,206 @@ BOOST_AUTO_TEST_CASE(Diverse_1) {
 
 #endif
 }
+
+BOOST_AUTO_TEST_CASE(LazyGenerator) {
+
+	const std::string input("Hi [wo|rl]!");
+
+	std::vector<std::string> perms;
+	BOOST_REQUIRE_NO_THROW(generate_permutations(input, perms));
+
+	// The generator must yield exactly the same sequence, one by one
+	PermutationGenerator gen{ input };
+	std::string candidate;
+	std::size_t i = 0;
+	while (gen.next(candidate)) {
+		BOOST_REQUIRE(i < perms.size());
+		BOOST_CHECK(candidate == perms[i++]);
+	}
+	BOOST_CHECK(i == perms.size());
+	BOOST_CHECK(!gen.next(candidate));
+
+	// And again after reset, this time through the iterator interface
+	gen.reset();
+	i = 0;
+	for (const std::string &c : gen) {
+		BOOST_REQUIRE(i < perms.size());
+		BOOST_CHECK(c == perms[i++]);
+	}
+	BOOST_CHECK(i == perms.size());
+}
+
+BOOST_AUTO_TEST_CASE(LazyGeneratorOrder) {
+
+	PermutationGenerator gen{ "[1|2] 3" };
+
+	std::vector<std::string> perms;
+	for (const std::string &c : gen) {
+		perms.push_back(c);
+	}
+
+	// Last token turns fastest
+	BOOST_REQUIRE(perms.size() == 2 * 6);
+	BOOST_CHECK(perms[0] == "13");
+	BOOST_CHECK(perms[1] == "1 3");
+	BOOST_CHECK(perms[5] == "1\t3");
+	BOOST_CHECK(perms[6] == "23");
+	BOOST_CHECK(perms[11] == "2\t3");
+
+	PermutationGenerator empty{ "" };
+	std::string candidate;
+	BOOST_CHECK(!empty.next(candidate));
+	BOOST_CHECK(empty.begin() == empty.end());
+}
+
+BOOST_AUTO_TEST_CASE(RankUnrank) {
+
+	const std::string input("Hi [wo|rl] 1!");
+
+	std::vector<std::string> perms;
+	BOOST_REQUIRE_NO_THROW(generate_permutations(input, perms));
+
+	PermutationGenerator gen{ input };
+	BOOST_REQUIRE(gen.size() == perms.size());
+	BOOST_CHECK(count_permutations(input) == perms.size());
+	BOOST_CHECK(count_permutations("") == 0);
+
+	std::string candidate;
+	std::vector<std::size_t> digits;
+	for (std::uint64_t i = 0; i < gen.size(); i++) {
+		BOOST_REQUIRE_NO_THROW(gen.unrank(i, candidate));
+		BOOST_CHECK(candidate == perms[i]);
+
+		BOOST_REQUIRE_NO_THROW(gen.unrank(i, digits));
+		BOOST_CHECK(gen.rank(digits) == i);
+	}
+
+	BOOST_CHECK_THROW(gen.unrank(gen.size(), candidate), moose_error);
+
+	// seek into the middle and continue from there
+	BOOST_CHECK(gen.position() == 0);
+	gen.seek(17);
+	BOOST_CHECK(gen.position() == 17);
+	BOOST_REQUIRE(gen.next(candidate));
+	BOOST_CHECK(candidate == perms[17]);
+	BOOST_CHECK(gen.position() == 18);
+
+	gen.seek(gen.size() - 1);
+	BOOST_REQUIRE(gen.next(candidate));
+	BOOST_CHECK(candidate == perms.back());
+	BOOST_CHECK(gen.position() == gen.size());
+	BOOST_CHECK(!gen.next(candidate));
+}
+
+BOOST_AUTO_TEST_CASE(Compiled) {
+
+	const CompiledPattern pattern{ "[1|22|333] 4" };
+
+	BOOST_REQUIRE(pattern.tokens() == 3);
+	BOOST_CHECK(pattern.options(0) == 3);
+	BOOST_CHECK(pattern.options(1) == 6);
+	BOOST_CHECK(pattern.options(2) == 1);
+	BOOST_CHECK(std::string(pattern.option(0, 1), pattern.option_size(0, 1)) == "22");
+	BOOST_CHECK(std::string(pattern.option(1, 0), pattern.option_size(1, 0)) == "");
+	BOOST_CHECK(std::string(pattern.option(1, 5), pattern.option_size(1, 5)) == "\t");
+	BOOST_CHECK(std::string(pattern.option(2, 0), pattern.option_size(2, 0)) == "4");
+	BOOST_CHECK(pattern.max_size() == 5);
+
+	BOOST_CHECK(CompiledPattern{}.tokens() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(CompiledFromTokens) {
+
+	// Compiled from the string or from the tokens, candidates are the same
+	const std::string input{ "Hi [wo|rl]! x" };
+	PermutationGenerator from_string{ input };
+	PermutationGenerator from_tokens{ parse_input_string(input) };
+
+	BOOST_REQUIRE(from_string.size() == from_tokens.size());
+
+	std::string a;
+	std::string b;
+	while (from_string.next(a)) {
+		BOOST_REQUIRE(from_tokens.next(b));
+		BOOST_CHECK_EQUAL(a, b);
+	}
+	BOOST_CHECK(!from_tokens.next(b));
+}
+
+BOOST_AUTO_TEST_CASE(Incremental) {
+
+	// Options of different lengths, so rewriting a suffix moves what follows
+	const std::string input{ "[a|bbb] [cc|d|eeee] x[1|22]" };
+	PermutationGenerator gen{ input };
+
+	std::string candidate;
+	for (std::uint64_t i = 0; i < gen.size(); i++) {
+		std::string expected;
+		gen.unrank(i, expected);
+		BOOST_REQUIRE(gen.next(candidate));
+		BOOST_CHECK_EQUAL(candidate, expected);
+	}
+	BOOST_CHECK(!gen.next(candidate));
+
+	// Seeking starts over from a full candidate, the iterator yields the same
+	gen.seek(gen.size() / 3);
+	std::uint64_t i = gen.size() / 3;
+	for (const std::string &c : gen) {
+		std::string expected;
+		gen.unrank(i++, expected);
+		BOOST_CHECK_EQUAL(c, expected);
+	}
+	BOOST_CHECK(i == gen.size());
+}
+
+BOOST_AUTO_TEST_CASE(Batches) {
+
+	const std::string input{ "[a|bbb] [cc|d] x" };
+	std::vector<std::string> perms;
+	generate_permutations(input, perms);
+
+	PermutationGenerator gen{ input };
+	std::vector<std::string> batch;
+	std::vector<std::string> all;
+
+	while (gen.next(batch, 7) == 7) {
+		all.insert(all.end(), batch.begin(), batch.end());
+	}
+	BOOST_CHECK(batch.size() == perms.size() % 7);
+	all.insert(all.end(), batch.begin(), batch.end());
+
+	BOOST_CHECK_EQUAL_COLLECTIONS(all.begin(), all.end(), perms.begin(), perms.end());
+	BOOST_CHECK(gen.next(batch, 7) == 0);
+	BOOST_CHECK(batch.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Deduplicate) {
+
+	Deduplicator dedup;
+
+	// "nothing" between the tokens yields "13", as does the second pattern
+	std::size_t unique = 0;
+	for (const std::string &c : PermutationGenerator{ "[1|2] 3" }) {
+		if (dedup.insert(c)) {
+			unique++;
+		}
+	}
+	BOOST_CHECK(unique == 12);
+	BOOST_CHECK(dedup.duplicates() == 0);
+
+	for (const std::string &c : PermutationGenerator{ "13" }) {
+		BOOST_CHECK(!dedup.insert(c));
+	}
+	BOOST_CHECK(dedup.duplicates() == 1);
+	BOOST_CHECK(dedup.insert("14"));
+	BOOST_CHECK(!dedup.full());
+
+	// Once full, what is known is still recognized but nothing new is remembered
+	Deduplicator small{ 1 };
+	BOOST_CHECK(small.insert("first"));
+	BOOST_CHECK(small.full());
+	BOOST_CHECK(!small.insert("first"));
+	BOOST_CHECK(small.insert("second"));
+	BOOST_CHECK(small.insert("second"));
+	BOOST_CHECK(small.duplicates() == 1);
+}
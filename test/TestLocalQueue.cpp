@@ -0,0 +1,143 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE LocalQueueTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/LocalQueue.hpp"
+#include "rescue/InputGenerator.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace moose::rescue;
+
+namespace {
+
+/* Work a queue off like the server does: expand every chunk and look
+ * for n_password. @return all candidates the workers saw
+ */
+std::vector<std::string> drain(LocalQueue &n_queue, const unsigned int n_workers, const std::string &n_password = std::string()) {
+
+	boost::mutex mutex;
+	std::vector<std::string> seen;
+
+	boost::thread_group workers;
+	for (unsigned int i = 0; i < n_workers; i++) {
+		workers.create_thread([&] {
+			std::unique_ptr<WorkQueue> queue = n_queue.worker();
+
+			work_chunk chunk;
+			while (!queue->exhausted()) {
+				if (!queue->next(chunk)) {
+					boost::this_thread::yield();
+					continue;
+				}
+
+				PermutationGenerator generator{ chunk.m_pattern };
+				generator.seek(chunk.m_begin);
+
+				bool found = false;
+				std::string candidate;
+				for (std::uint64_t c = chunk.m_begin; c < chunk.m_end; c++) {
+					BOOST_REQUIRE(generator.next(candidate));
+					found |= (candidate == n_password);
+
+					boost::lock_guard<boost::mutex> lock(mutex);
+					seen.push_back(candidate);
+				}
+
+				queue->result(chunk, found);
+			}
+		});
+	}
+
+	workers.join_all();
+	return seen;
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(AllCandidates) {
+
+	const std::vector<std::string> patterns{ "[a|b|c] [1|2|3] [x|y]", "abc[1|2]", "[Master|Slave] [0|1|2|3]" };
+
+	std::vector<std::string> expected;
+	for (const std::string &pattern : patterns) {
+		for (const std::string &candidate : PermutationGenerator{ pattern }) {
+			expected.push_back(candidate);
+		}
+	}
+
+	// Small enough to make the feeder wait for the workers
+	LocalQueue queue{ 4 };
+	BOOST_CHECK(!queue.worker()->exhausted());
+
+	std::size_t chunks = 0;
+	boost::thread feeder{ [&] {
+		for (const std::string &pattern : patterns) {
+			chunks += queue.queue_pattern(pattern, 3);
+		}
+		queue.close();
+	}};
+
+	std::vector<std::string> seen = drain(queue, 4);
+	feeder.join();
+
+	BOOST_CHECK(queue.worker()->exhausted());
+	BOOST_CHECK(!queue.found());
+	BOOST_CHECK_EQUAL(queue.chunks_done(), chunks);
+
+	// Every candidate exactly once
+	std::sort(expected.begin(), expected.end());
+	std::sort(seen.begin(), seen.end());
+	BOOST_CHECK_EQUAL_COLLECTIONS(seen.begin(), seen.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(StopOnSuccess) {
+
+	const std::string pattern{ "[a|b|c|d|e|f|g|h] [a|b|c|d|e|f|g|h] [a|b|c|d|e|f|g|h] [a|b|c|d|e|f|g|h]" };
+
+	// The password is among the first few, far more chunks will never be looked at
+	PermutationGenerator generator{ pattern };
+	std::string password;
+	for (int i = 0; i < 5; i++) {
+		BOOST_REQUIRE(generator.next(password));
+	}
+
+	LocalQueue queue{ 2 };
+
+	std::size_t chunks = 0;
+	boost::thread feeder{ [&] {
+		chunks = queue.queue_pattern(pattern, 1);
+		queue.close();
+	}};
+
+	const std::vector<std::string> seen = drain(queue, 2, password);
+	feeder.join();
+
+	BOOST_CHECK(queue.found());
+	BOOST_CHECK(queue.worker()->exhausted());
+	BOOST_CHECK_LT(chunks, count_permutations(pattern));
+	BOOST_CHECK_LT(seen.size(), 100u);
+}
+
+BOOST_AUTO_TEST_CASE(Empty) {
+
+	LocalQueue queue;
+	std::unique_ptr<WorkQueue> worker = queue.worker();
+
+	work_chunk chunk;
+	BOOST_CHECK(!worker->next(chunk));
+	BOOST_CHECK(!worker->exhausted());
+
+	queue.close();
+	BOOST_CHECK(worker->exhausted());
+	BOOST_CHECK(drain(queue, 2).empty());
+}
@@ -0,0 +1,439 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE LuksTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/LuksVerifier.hpp"
+#include "tools/Error.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <argon2.h>
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace moose::tools;
+using namespace moose::rescue;
+namespace fs = boost::filesystem;
+
+namespace {
+
+void put_u32(std::vector<unsigned char> &n_dst, const std::size_t n_offset, const std::uint32_t n_value) {
+
+	n_dst[n_offset]     = static_cast<unsigned char>(n_value >> 24);
+	n_dst[n_offset + 1] = static_cast<unsigned char>(n_value >> 16);
+	n_dst[n_offset + 2] = static_cast<unsigned char>(n_value >> 8);
+	n_dst[n_offset + 3] = static_cast<unsigned char>(n_value);
+}
+
+void put_u64(std::vector<unsigned char> &n_dst, const std::size_t n_offset, const std::uint64_t n_value) {
+
+	put_u32(n_dst, n_offset, static_cast<std::uint32_t>(n_value >> 32));
+	put_u32(n_dst, n_offset + 4, static_cast<std::uint32_t>(n_value));
+}
+
+void put_string(std::vector<unsigned char> &n_dst, const std::size_t n_offset, const std::string &n_value) {
+
+	std::memcpy(n_dst.data() + n_offset, n_value.data(), n_value.size());
+}
+
+void diffuse(const EVP_MD *n_md, unsigned char *n_block, const std::size_t n_size) {
+
+	const std::size_t digest_size = EVP_MD_size(n_md);
+	unsigned char digest[EVP_MAX_MD_SIZE];
+
+	for (std::size_t i = 0, offset = 0; offset < n_size; i++, offset += digest_size) {
+		const std::size_t piece = std::min(digest_size, n_size - offset);
+		const unsigned char iv[4] = {
+			static_cast<unsigned char>(i >> 24), static_cast<unsigned char>(i >> 16),
+			static_cast<unsigned char>(i >> 8),  static_cast<unsigned char>(i)
+		};
+
+		EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+		EVP_DigestInit_ex(ctx, n_md, nullptr);
+		EVP_DigestUpdate(ctx, iv, sizeof(iv));
+		EVP_DigestUpdate(ctx, n_block + offset, piece);
+		EVP_DigestFinal_ex(ctx, digest, nullptr);
+		EVP_MD_CTX_free(ctx);
+
+		std::memcpy(n_block + offset, digest, piece);
+	}
+}
+
+/* AF split n_master_key and encrypt it with n_key, like cryptsetup does for a key slot.
+   Only xts-plain64 and cbc-essiv:sha256 are supported here.
+ */
+std::vector<unsigned char> make_key_material(const std::vector<unsigned char> &n_master_key, const std::vector<unsigned char> &n_key,
+                                             const std::string &n_mode, const std::uint32_t n_stripes) {
+
+	const EVP_MD *md = EVP_sha256();
+	const std::size_t key_bytes = n_master_key.size();
+	const std::size_t material_sectors = (key_bytes * n_stripes + 511) / 512;
+
+	std::vector<unsigned char> split(material_sectors * 512, 0);
+	std::vector<unsigned char> block(key_bytes, 0);
+	RAND_bytes(split.data(), key_bytes * (n_stripes - 1));
+	for (std::size_t s = 0; s < n_stripes - 1; s++) {
+		for (std::size_t i = 0; i < key_bytes; i++) {
+			block[i] ^= split[s * key_bytes + i];
+		}
+		diffuse(md, block.data(), key_bytes);
+	}
+	for (std::size_t i = 0; i < key_bytes; i++) {
+		split[(n_stripes - 1) * key_bytes + i] = block[i] ^ n_master_key[i];
+	}
+
+	const bool xts = (n_mode == "xts-plain64");
+	const EVP_CIPHER *cipher = xts ? ((n_key.size() == 64) ? EVP_aes_256_xts() : EVP_aes_128_xts())
+	                               : ((n_key.size() == 32) ? EVP_aes_256_cbc() : EVP_aes_128_cbc());
+
+	unsigned char essiv_key[32];
+	EVP_Digest(n_key.data(), n_key.size(), essiv_key, nullptr, EVP_sha256(), nullptr);
+
+	std::vector<unsigned char> ret(split.size());
+	for (std::size_t sector = 0; sector < material_sectors; sector++) {
+		unsigned char iv[16] = { 0 };
+		for (std::size_t i = 0; i < 8; i++) {
+			iv[i] = static_cast<unsigned char>(static_cast<std::uint64_t>(sector) >> (8 * i));
+		}
+
+		int len = 0;
+		if (!xts) {
+			EVP_CIPHER_CTX *essiv = EVP_CIPHER_CTX_new();
+			EVP_EncryptInit_ex(essiv, EVP_aes_256_ecb(), nullptr, essiv_key, nullptr);
+			EVP_CIPHER_CTX_set_padding(essiv, 0);
+			EVP_EncryptUpdate(essiv, iv, &len, iv, 16);
+			EVP_CIPHER_CTX_free(essiv);
+		}
+
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+		EVP_EncryptInit_ex(ctx, cipher, nullptr, n_key.data(), iv);
+		EVP_CIPHER_CTX_set_padding(ctx, 0);
+		EVP_EncryptUpdate(ctx, ret.data() + sector * 512, &len, split.data() + sector * 512, 512);
+		EVP_CIPHER_CTX_free(ctx);
+	}
+
+	return ret;
+}
+
+/* Write a LUKS1 header like cryptsetup luksFormat would, with the password in slot n_slot.
+   Only aes-xts-plain64 and aes-cbc-essiv:sha256 are supported here.
+ */
+void write_luks1_header(const fs::path &n_file, const std::string &n_password, const std::string &n_mode,
+                        const std::size_t n_key_bytes, const std::size_t n_slot) {
+
+	const EVP_MD *md = EVP_sha256();
+	const std::uint32_t stripes = 4000;
+	const std::uint32_t iterations = 1000;
+
+	std::vector<unsigned char> master_key(n_key_bytes);
+	RAND_bytes(master_key.data(), master_key.size());
+
+	// Header and one key slot area behind it
+	std::vector<unsigned char> file(4096, 0);
+	const unsigned char magic[] = { 'L', 'U', 'K', 'S', 0xba, 0xbe };
+	std::memcpy(file.data(), magic, sizeof(magic));
+	file[7] = 1;
+	put_string(file, 8, "aes");
+	put_string(file, 40, n_mode);
+	put_string(file, 72, "sha256");
+	put_u32(file, 104, 4096);
+	put_u32(file, 108, static_cast<std::uint32_t>(n_key_bytes));
+
+	unsigned char mk_salt[32];
+	RAND_bytes(mk_salt, sizeof(mk_salt));
+	std::memcpy(file.data() + 132, mk_salt, sizeof(mk_salt));
+	put_u32(file, 164, iterations);
+	PKCS5_PBKDF2_HMAC(reinterpret_cast<const char *>(master_key.data()), master_key.size(), mk_salt, sizeof(mk_salt),
+	                  iterations, md, 20, file.data() + 112);
+	put_string(file, 168, "12345678-1234-1234-1234-123456789012");
+
+	for (std::size_t i = 0; i < 8; i++) {
+		const std::size_t slot = 208 + i * 48;
+		put_u32(file, slot, (i == n_slot) ? 0x00AC71F3 : 0x0000DEAD);
+		put_u32(file, slot + 40, 8);
+		put_u32(file, slot + 44, stripes);
+	}
+
+	const std::size_t slot = 208 + n_slot * 48;
+	unsigned char salt[32];
+	RAND_bytes(salt, sizeof(salt));
+	std::memcpy(file.data() + slot + 8, salt, sizeof(salt));
+	put_u32(file, slot + 4, iterations);
+
+	// Key material encrypted with the key derived from the password
+	std::vector<unsigned char> key(n_key_bytes);
+	PKCS5_PBKDF2_HMAC(n_password.data(), n_password.size(), salt, sizeof(salt), iterations, md, n_key_bytes, key.data());
+	const std::vector<unsigned char> material = make_key_material(master_key, key, n_mode, stripes);
+	file.insert(file.end(), material.begin(), material.end());
+
+	fs::ofstream ofile(n_file, std::ios::out | std::ios::binary | std::ios::trunc);
+	ofile.write(reinterpret_cast<const char *>(file.data()), file.size());
+}
+
+std::string base64(const unsigned char *n_data, const std::size_t n_size) {
+
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	std::string ret;
+	for (std::size_t i = 0; i < n_size; i += 3) {
+		const std::uint32_t group = (static_cast<std::uint32_t>(n_data[i]) << 16)
+		        | ((i + 1 < n_size) ? (static_cast<std::uint32_t>(n_data[i + 1]) << 8) : 0)
+		        | ((i + 2 < n_size) ? n_data[i + 2] : 0);
+
+		ret += alphabet[(group >> 18) & 0x3f];
+		ret += alphabet[(group >> 12) & 0x3f];
+		ret += (i + 1 < n_size) ? alphabet[(group >> 6) & 0x3f] : '=';
+		ret += (i + 2 < n_size) ? alphabet[group & 0x3f] : '=';
+	}
+	return ret;
+}
+
+/* Write a LUKS2 header like cryptsetup luksFormat --type luks2 would, with
+   aes-xts-plain64 and the password in slot n_slot. n_kdf is either "pbkdf2"
+   or "argon2id". A reencryption key slot is thrown in, which must be ignored.
+ */
+void write_luks2_header(const fs::path &n_file, const std::string &n_password, const std::string &n_kdf, const std::size_t n_slot) {
+
+	const std::size_t key_bytes = 64;
+	const std::uint32_t stripes = 4000;
+	const std::uint32_t iterations = 1000;
+	const std::size_t area_offset = 32768;
+
+	std::vector<unsigned char> master_key(key_bytes);
+	RAND_bytes(master_key.data(), master_key.size());
+
+	unsigned char salt[32];
+	RAND_bytes(salt, sizeof(salt));
+
+	std::ostringstream kdf;
+	std::vector<unsigned char> key(key_bytes);
+	if (n_kdf == "pbkdf2") {
+		PKCS5_PBKDF2_HMAC(n_password.data(), n_password.size(), salt, sizeof(salt), iterations, EVP_sha256(), key_bytes, key.data());
+		kdf << R"({"type":"pbkdf2","hash":"sha256","iterations":)" << iterations << R"(,"salt":")" << base64(salt, sizeof(salt)) << R"("})";
+	} else {
+		argon2_hash(2, 1024, 1, n_password.data(), n_password.size(), salt, sizeof(salt), key.data(), key.size(),
+		            nullptr, 0, Argon2_id, ARGON2_VERSION_13);
+		kdf << R"({"type":"argon2id","time":2,"memory":1024,"cpus":1,"salt":")" << base64(salt, sizeof(salt)) << R"("})";
+	}
+
+	unsigned char mk_salt[32];
+	RAND_bytes(mk_salt, sizeof(mk_salt));
+	unsigned char digest[32];
+	PKCS5_PBKDF2_HMAC(reinterpret_cast<const char *>(master_key.data()), master_key.size(), mk_salt, sizeof(mk_salt),
+	                  iterations, EVP_sha256(), sizeof(digest), digest);
+
+	const std::vector<unsigned char> material = make_key_material(master_key, key, "xts-plain64", stripes);
+
+	std::ostringstream json;
+	json << R"({"keyslots":{")" << n_slot << R"(":{"type":"luks2","key_size":)" << key_bytes
+	     << R"(,"af":{"type":"luks1","stripes":)" << stripes << R"(,"hash":"sha256"},)"
+	     << R"("area":{"type":"raw","offset":")" << area_offset << R"(","size":")" << material.size()
+	     << R"(","encryption":"aes-xts-plain64","key_size":)" << key_bytes << R"(},)"
+	     << R"("kdf":)" << kdf.str() << R"(},)"
+	     << R"("7":{"type":"reencrypt","key_size":1,"mode":"encrypt","direction":"forward"}},)"
+	     << R"("tokens":{},)"
+	     << R"("segments":{"0":{"type":"crypt","offset":"16777216","size":"dynamic","iv_tweak":"0","encryption":"aes-xts-plain64","sector_size":512}},)"
+	     << R"("digests":{"0":{"type":"pbkdf2","keyslots":[")" << n_slot << R"("],"segments":["0"],"hash":"sha256","iterations":)" << iterations
+	     << R"(,"salt":")" << base64(mk_salt, sizeof(mk_salt)) << R"(","digest":")" << base64(digest, sizeof(digest)) << R"("}},)"
+	     << R"("config":{"json_size":"12288","keyslots_size":"16744448"}})";
+
+	// Binary header, JSON area and the key material behind it
+	std::vector<unsigned char> file(area_offset, 0);
+	const unsigned char magic[] = { 'L', 'U', 'K', 'S', 0xba, 0xbe };
+	std::memcpy(file.data(), magic, sizeof(magic));
+	file[7] = 2;
+	put_u64(file, 8, 16384);
+	put_string(file, 168, "12345678-1234-1234-1234-123456789012");
+	put_string(file, 4096, json.str());
+	file.insert(file.end(), material.begin(), material.end());
+
+	fs::ofstream ofile(n_file, std::ios::out | std::ios::binary | std::ios::trunc);
+	ofile.write(reinterpret_cast<const char *>(file.data()), file.size());
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(NativeXtsPlain64) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks1_header(header, "Hello World!", "xts-plain64", 64, 0));
+
+	{
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header }));
+
+		BOOST_CHECK(verifier->volume().m_version == 1);
+		BOOST_REQUIRE(verifier->volume().m_slots.size() == 1);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_index == 0);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_cipher == "aes-xts-plain64");
+		BOOST_CHECK(verifier->volume().m_slots[0].m_key_bytes == 64);
+		BOOST_CHECK(verifier->memory_cost() == 0);
+
+		BOOST_CHECK(verifier->verify("Hello World!"));
+		BOOST_CHECK(!verifier->verify("Hello World?"));
+		BOOST_CHECK(!verifier->verify(""));
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(NativeCbcEssiv) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks1_header(header, "grape", "cbc-essiv:sha256", 32, 3));
+
+	{
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header }));
+
+		BOOST_CHECK(verifier->verify("grape"));
+		BOOST_CHECK(!verifier->verify("Grape"));
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(NativeBatch) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks1_header(header, "candidate 13", "xts-plain64", 64, 1));
+
+	{
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header }));
+		BOOST_CHECK(verifier->batch_size() >= 1);
+
+		// More than any kernel has lanes, with the right one in the middle
+		std::vector<std::string> candidates;
+		for (std::size_t i = 0; i < 20; i++) {
+			candidates.push_back("candidate " + std::to_string(i));
+		}
+
+		const boost::optional<std::size_t> found = verifier->verify(candidates);
+		BOOST_REQUIRE(found);
+		BOOST_CHECK_EQUAL(*found, 13);
+
+		candidates.erase(candidates.begin() + 13);
+		BOOST_CHECK(!verifier->verify(candidates));
+		BOOST_CHECK(!verifier->verify(std::vector<std::string>{}));
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(NativeBadStripes) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks1_header(header, "grape", "xts-plain64", 64, 0));
+
+	// Claim way more stripes than the file has or anyone would allocate
+	{
+		fs::fstream file(header, std::ios::in | std::ios::out | std::ios::binary);
+		const unsigned char stripes[] = { 0xff, 0xff, 0xff, 0xff };
+		file.seekp(208 + 44);
+		file.write(reinterpret_cast<const char *>(stripes), sizeof(stripes));
+	}
+
+	BOOST_CHECK_THROW(LuksVerifier{ header }, serialization_error);
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(Luks2Pbkdf2) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks2_header(header, "Hello LUKS2", "pbkdf2", 2));
+
+	{
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header }));
+
+		// The reencryption slot is not for us
+		BOOST_CHECK(verifier->volume().m_version == 2);
+		BOOST_REQUIRE(verifier->volume().m_slots.size() == 1);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_index == 2);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_kdf.m_type == "pbkdf2");
+		BOOST_CHECK(verifier->volume().m_slots[0].m_kdf.m_salt.size() == 32);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_digest.size() == 32);
+
+		BOOST_CHECK(verifier->verify("Hello LUKS2"));
+		BOOST_CHECK(!verifier->verify("Hello LUKS1"));
+
+		const std::vector<std::string> candidates{ "a", "b", "Hello LUKS2", "c" };
+		const boost::optional<std::size_t> found = verifier->verify(candidates);
+		BOOST_REQUIRE(found);
+		BOOST_CHECK_EQUAL(*found, 2);
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(Luks2Argon2id) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks2_header(header, "memory hard", "argon2id", 0));
+
+	{
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header }));
+
+		BOOST_REQUIRE(verifier->volume().m_slots.size() == 1);
+		BOOST_CHECK(verifier->volume().m_slots[0].m_kdf.m_type == "argon2id");
+		BOOST_CHECK(verifier->volume().m_slots[0].m_kdf.m_iterations == 2);
+		BOOST_CHECK(verifier->memory_cost() == 1024 * 1024);
+
+		BOOST_CHECK(verifier->verify("memory hard"));
+		BOOST_CHECK(!verifier->verify("memory soft"));
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(SlotSelection) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	BOOST_REQUIRE_NO_THROW(write_luks2_header(header, "only this slot", "pbkdf2", 2));
+
+	{
+		const luks_volume volume = read_luks_volume(header);
+		const std::vector<luks_slot_cost> costs = estimate_slot_costs(volume);
+		BOOST_REQUIRE(costs.size() == 1);
+		BOOST_CHECK(costs[0].m_index == 2);
+		BOOST_CHECK(costs[0].m_seconds > 0.0);
+
+		std::unique_ptr<LuksVerifier> verifier;
+		BOOST_REQUIRE_NO_THROW(verifier.reset(new LuksVerifier{ header, { 2 } }));
+		BOOST_CHECK(verifier->verify("only this slot"));
+		BOOST_CHECK(!verifier->verify("some other slot"));
+
+		// slot 7 is there but not a keyslot we can use
+		BOOST_CHECK_THROW(LuksVerifier(header, { 0 }), internal_error);
+		BOOST_CHECK_THROW(LuksVerifier(header, { 7 }), internal_error);
+	}
+
+	fs::remove(header);
+}
+
+BOOST_AUTO_TEST_CASE(NotLuks) {
+
+	const fs::path header = fs::temp_directory_path() / fs::unique_path("rescue-luks-%%%%-%%%%");
+	{
+		fs::ofstream ofile(header, std::ios::out | std::ios::binary | std::ios::trunc);
+		ofile << std::string(1024, 'x');
+	}
+
+	BOOST_CHECK_THROW(LuksVerifier{ header }, moose_error);
+
+	fs::remove(header);
+}
@@ -0,0 +1,105 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE MappedInputTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/MappedInput.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace moose::rescue;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+//! a file with the given content, removed again when done
+struct TempFile {
+
+	explicit TempFile(const std::string &n_content)
+	        : m_path{ fs::temp_directory_path() / fs::unique_path("rescue-input-%%%%-%%%%") } {
+
+		fs::ofstream file(m_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		file << n_content;
+	}
+
+	~TempFile() {
+
+		boost::system::error_code errc;
+		fs::remove(m_path, errc);
+	}
+
+	fs::path m_path;
+};
+
+std::vector<std::string> lines(const MappedInput &n_input, const std::size_t n_begin, const std::size_t n_end) {
+
+	std::vector<std::string> result;
+	std::size_t offset = n_begin;
+	for (boost::string_view line; n_input.next_line(offset, n_end, line); ) {
+		result.push_back(line.to_string());
+	}
+	return result;
+}
+
+const std::string content{ "first\r\nsecond\n\nfourth [a|b]\r\n\r\nsixth\nlast without end" };
+const std::vector<std::string> expected{ "first", "second", "", "fourth [a|b]", "", "sixth", "last without end" };
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(Lines) {
+
+	const TempFile file{ content };
+	const MappedInput input{ file.m_path };
+
+	BOOST_CHECK_EQUAL(input.size(), content.size());
+
+	const std::vector<std::string> read = lines(input, 0, input.size());
+	BOOST_CHECK_EQUAL_COLLECTIONS(read.begin(), read.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(Split) {
+
+	const TempFile file{ content };
+	const MappedInput input{ file.m_path };
+
+	// Whatever the number of parts, together they hold all lines in order and know where they are
+	for (std::size_t parts = 1; parts < 40; parts++) {
+
+		const std::vector<input_range> ranges = input.split(parts);
+		BOOST_REQUIRE(!ranges.empty());
+		BOOST_CHECK_LE(ranges.size(), parts);
+		BOOST_CHECK_EQUAL(ranges.front().m_begin, 0);
+		BOOST_CHECK_EQUAL(ranges.back().m_end, input.size());
+
+		std::vector<std::string> read;
+		for (std::size_t i = 0; i < ranges.size(); i++) {
+			if (i > 0) {
+				BOOST_CHECK_EQUAL(ranges[i].m_begin, ranges[i - 1].m_end);
+			}
+
+			BOOST_CHECK_EQUAL(ranges[i].m_first_line, read.size());
+			const std::vector<std::string> part = lines(input, ranges[i].m_begin, ranges[i].m_end);
+			BOOST_CHECK_EQUAL(ranges[i].m_lines, part.size());
+			read.insert(read.end(), part.begin(), part.end());
+		}
+
+		BOOST_CHECK_EQUAL_COLLECTIONS(read.begin(), read.end(), expected.begin(), expected.end());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Empty) {
+
+	const TempFile file{ "" };
+	const MappedInput input{ file.m_path };
+
+	BOOST_CHECK_EQUAL(input.size(), 0);
+	BOOST_CHECK(input.split(4).empty());
+	BOOST_CHECK(lines(input, 0, input.size()).empty());
+}
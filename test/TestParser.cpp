@@ -62,3 +62,102 @@ BOOST_AUTO_TEST_CASE(FourTokens) {
 		tokens.pop_front();
 	}
 }
+
+namespace {
+
+/* Check the flat parse of n_input against the Spirit grammar's.
+ * Either both refuse the input or they agree on every token
+ */
+void check_flat(const std::string &n_input) {
+
+	BOOST_TEST_CONTEXT("input \"" << n_input << "\"") {
+
+		std::list<token> expected;
+		bool spirit_parsed = true;
+		try {
+			expected = parse_input_string(n_input);
+		} catch (const serialization_error &) {
+			spirit_parsed = false;
+		}
+
+		flat_pattern pattern;
+		if (!spirit_parsed) {
+			BOOST_CHECK_THROW(parse_input_flat(n_input, pattern), serialization_error);
+			return;
+		}
+
+		BOOST_REQUIRE_NO_THROW(parse_input_flat(n_input, pattern));
+		BOOST_REQUIRE_EQUAL(pattern.m_tokens.size(), expected.size());
+
+		std::size_t i = 0;
+		for (const token &t : expected) {
+			const flat_token &flat = pattern.m_tokens[i++];
+
+			if (is_string(t)) {
+				BOOST_REQUIRE(flat.m_type == flat_token::type::text);
+				BOOST_CHECK_EQUAL(n_input.substr(flat.m_span.m_offset, flat.m_span.m_size), boost::get<std::string>(t));
+			} else if (is_whitespace(t)) {
+				BOOST_CHECK(flat.m_type == flat_token::type::whitespace);
+			} else {
+				BOOST_REQUIRE(flat.m_type == flat_token::type::variant);
+				const std::vector<std::string> &options = boost::get<string_var>(t).m_options;
+				BOOST_REQUIRE_EQUAL(flat.m_span.m_size, options.size());
+				for (std::size_t o = 0; o < options.size(); o++) {
+					const input_span &option = pattern.m_options[flat.m_span.m_offset + o];
+					BOOST_CHECK_EQUAL(n_input.substr(option.m_offset, option.m_size), options[o]);
+				}
+			}
+		}
+	}
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(FlatMatchesSpirit) {
+
+	for (const std::string input : { "", "Hi [wo|rl]!", "a", " ", "  ", "|", "a|b", "[a]", "[a|b|c]", "[]", "[|]", "[a|]",
+	                                 "[|a]", "[a||b]", "[a", "[a|b", "a]", "]", "[", "[[a]]", "[a b]", "[a] [b]", "x[a]y",
+	                                 "[a][b]", "pass word 123", "[Master|Slave] [1|2]", "tab\there", "!#$%&'()*+,-./:;<=>?@\\^_`{}~" }) {
+		check_flat(input);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(FlatMatchesSpiritRandom) {
+
+	// Short strings of the characters that matter to the grammar find all its corners
+	const char alphabet[] = { 'a', 'Z', '1', '!', '|', '[', ']', ' ', '\t', '\0' };
+
+	unsigned int seed = 4711;
+	for (unsigned int n = 0; n < 20000; n++) {
+		std::string input;
+		seed = seed * 1103515245 + 12345;
+		const std::size_t length = (seed >> 16) % 12;
+		for (std::size_t i = 0; i < length; i++) {
+			seed = seed * 1103515245 + 12345;
+			input.push_back(alphabet[(seed >> 16) % sizeof(alphabet)]);
+		}
+		check_flat(input);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(FlatRefusesNonAscii) {
+
+	// The grammar only takes ASCII, see text_parser
+	flat_pattern pattern;
+	BOOST_CHECK_THROW(parse_input_flat("gr\xc3\xbc\xc3\x9f", pattern), serialization_error);
+	BOOST_CHECK_THROW(parse_input_flat("[a|\xff]", pattern), serialization_error);
+}
+
+BOOST_AUTO_TEST_CASE(FlatReuse) {
+
+	flat_pattern pattern;
+	parse_input_flat("[a|b|c] [d|e] f", pattern);
+	BOOST_CHECK_EQUAL(pattern.m_tokens.size(), 5);
+	BOOST_CHECK_EQUAL(pattern.m_options.size(), 5);
+
+	// A later parse replaces what was there
+	parse_input_flat("g", pattern);
+	BOOST_REQUIRE_EQUAL(pattern.m_tokens.size(), 1);
+	BOOST_CHECK(pattern.m_tokens[0].m_type == flat_token::type::text);
+	BOOST_CHECK(pattern.m_options.empty());
+}
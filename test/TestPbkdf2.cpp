@@ -0,0 +1,118 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE Pbkdf2Tests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/Pbkdf2.hpp"
+#include "tools/Error.hpp"
+
+#include <openssl/evp.h>
+
+#include <string>
+#include <vector>
+
+using namespace moose::tools;
+using namespace moose::rescue;
+
+namespace {
+
+const EVP_MD *openssl_digest(const pbkdf2_hash n_hash) {
+
+	switch (n_hash) {
+		case pbkdf2_hash::sha1:
+			return EVP_sha1();
+		case pbkdf2_hash::sha256:
+			return EVP_sha256();
+		default:
+		case pbkdf2_hash::sha512:
+			return EVP_sha512();
+	}
+}
+
+std::vector<simd_level> supported_levels() {
+
+	std::vector<simd_level> ret;
+	for (const simd_level level : { simd_level::scalar, simd_level::avx2, simd_level::avx512 }) {
+		if (simd_supported(level)) {
+			ret.push_back(level);
+		}
+	}
+	return ret;
+}
+
+//! Passwords of all kinds of lengths, including longer than a block
+std::vector<std::string> make_passwords(const std::size_t n_count) {
+
+	std::vector<std::string> ret;
+	for (std::size_t i = 0; i < n_count; i++) {
+		ret.push_back(std::string((i * 37) % 200, static_cast<char>('a' + (i % 26))) + std::to_string(i));
+	}
+	return ret;
+}
+
+void check_against_openssl(const pbkdf2_hash n_hash, const simd_level n_level, const std::size_t n_count,
+                           const std::vector<unsigned char> &n_salt, const unsigned int n_iterations, const std::size_t n_key_size) {
+
+	const std::vector<std::string> passwords = make_passwords(n_count);
+
+	std::vector<boost::uint8_t> keys;
+	BOOST_REQUIRE_NO_THROW(pbkdf2_batch(n_hash, passwords, n_salt.data(), n_salt.size(), n_iterations, n_key_size, keys, n_level));
+	BOOST_REQUIRE_EQUAL(keys.size(), n_count * n_key_size);
+
+	for (std::size_t i = 0; i < n_count; i++) {
+		std::vector<unsigned char> expected(n_key_size);
+		PKCS5_PBKDF2_HMAC(passwords[i].data(), static_cast<int>(passwords[i].size()), n_salt.data(), static_cast<int>(n_salt.size()),
+		                  static_cast<int>(n_iterations), openssl_digest(n_hash), static_cast<int>(n_key_size), expected.data());
+
+		BOOST_CHECK_MESSAGE(std::equal(expected.begin(), expected.end(), keys.begin() + i * n_key_size),
+		        "Key " << i << " differs for " << to_string(n_level) << " with " << n_iterations << " iterations");
+	}
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(Lanes) {
+
+	BOOST_CHECK_EQUAL(pbkdf2_lanes(pbkdf2_hash::sha256, simd_level::scalar), 1);
+	BOOST_CHECK_EQUAL(pbkdf2_lanes(pbkdf2_hash::sha1, simd_level::avx2), 8);
+	BOOST_CHECK_EQUAL(pbkdf2_lanes(pbkdf2_hash::sha512, simd_level::avx2), 4);
+	BOOST_CHECK_EQUAL(pbkdf2_lanes(pbkdf2_hash::sha256, simd_level::avx512), 16);
+	BOOST_CHECK_EQUAL(pbkdf2_lanes(pbkdf2_hash::sha512, simd_level::avx512), 8);
+
+	BOOST_CHECK(pbkdf2_hash_by_name("sha256") == pbkdf2_hash::sha256);
+	BOOST_CHECK(!pbkdf2_hash_by_name("ripemd160"));
+}
+
+BOOST_AUTO_TEST_CASE(MatchesOpenSSL) {
+
+	const std::vector<unsigned char> salt(32, 0x5a);
+	const std::vector<unsigned char> long_salt(150, 0xa5);
+
+	for (const simd_level level : supported_levels()) {
+		for (const pbkdf2_hash hash : { pbkdf2_hash::sha1, pbkdf2_hash::sha256, pbkdf2_hash::sha512 }) {
+
+			// Odd batch sizes leave lanes unused and a single one at the end
+			check_against_openssl(hash, level, 1, salt, 1, 32);
+			check_against_openssl(hash, level, 17, salt, 2, 32);
+			check_against_openssl(hash, level, 9, long_salt, 1000, 64);
+
+			// Keys longer than one digest take several blocks
+			check_against_openssl(hash, level, 5, salt, 10, 100);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Errors) {
+
+	const std::vector<std::string> passwords{ "password" };
+	const unsigned char salt[] = { 1, 2, 3, 4 };
+	std::vector<boost::uint8_t> keys;
+
+	BOOST_CHECK_THROW(pbkdf2_batch(pbkdf2_hash::sha256, passwords, salt, sizeof(salt), 0, 32, keys), moose_error);
+
+	// Empty batches are no error
+	BOOST_CHECK_NO_THROW(pbkdf2_batch(pbkdf2_hash::sha256, std::vector<std::string>{}, salt, sizeof(salt), 1000, 32, keys));
+	BOOST_CHECK(keys.empty());
+}
@@ -0,0 +1,187 @@
+//  Copyright 2019 Stephan Menzel. Distributed under the Boost
+//  Software License, Version 1.0. (See accompanying file
+//  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#define BOOST_TEST_MODULE SchedulerTests
+#include <boost/test/unit_test.hpp>
+
+#include "rescue/Scheduler.hpp"
+#include "rescue/LocalQueue.hpp"
+#include "rescue/InputGenerator.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace moose::rescue;
+
+namespace {
+
+struct range {
+	std::string   m_pattern;
+	std::uint64_t m_begin;
+	std::uint64_t m_end;
+};
+
+//! work a queue off like a server's worker, without success
+void drain(WorkQueue &n_queue, boost::mutex &n_mutex, std::vector<range> &n_seen) {
+
+	work_chunk chunk;
+	while (!n_queue.exhausted()) {
+		if (!n_queue.next(chunk)) {
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+			continue;
+		}
+
+		{
+			boost::lock_guard<boost::mutex> lock(n_mutex);
+			n_seen.push_back(range{ chunk.m_pattern, chunk.m_begin, chunk.m_end });
+		}
+		n_queue.result(chunk, false);
+	}
+}
+
+//! true if n_ranges cover [0, n_size) of n_pattern exactly once
+bool covers(std::vector<range> n_ranges, const std::string &n_pattern, const std::uint64_t n_size) {
+
+	n_ranges.erase(std::remove_if(n_ranges.begin(), n_ranges.end(), [&](const range &n_range) {
+		return n_range.m_pattern != n_pattern; }), n_ranges.end());
+	std::sort(n_ranges.begin(), n_ranges.end(), [](const range &n_lhs, const range &n_rhs) {
+		return n_lhs.m_begin < n_rhs.m_begin; });
+
+	std::uint64_t next = 0;
+	for (const range &r : n_ranges) {
+		if ((r.m_begin != next) || (r.m_end <= r.m_begin)) {
+			return false;
+		}
+		next = r.m_end;
+	}
+
+	return next == n_size;
+}
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(AllPieces) {
+
+	// Chunks of very different sizes
+	const std::vector<std::string> patterns{ "[a|b|c] [1|2|3] [x|y]", "abc[1|2]", "[Master|Slave] [0|1|2|3] [x|y|z]" };
+
+	LocalQueue local;
+	std::size_t chunks = 0;
+	chunks += local.queue_pattern(patterns[0], 7);
+	chunks += local.queue_pattern(patterns[1], 1000);
+	chunks += local.queue_pattern(patterns[2], 50);
+	local.close();
+
+	boost::mutex mutex;
+	std::vector<range> seen;
+	{
+		Scheduler scheduler{ local.worker(), 4 };
+
+		boost::thread_group workers;
+		for (unsigned int i = 0; i < 4; i++) {
+			WorkQueue *queue = &scheduler.worker(i);
+			workers.create_thread([&, queue] { drain(*queue, mutex, seen); });
+		}
+		workers.join_all();
+	}
+
+	// Every chunk went back once all of its pieces were done
+	BOOST_CHECK_EQUAL(local.chunks_done(), chunks);
+	BOOST_CHECK(!local.found());
+
+	for (const std::string &pattern : patterns) {
+		BOOST_CHECK(covers(seen, pattern, count_permutations(pattern)));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Stealing) {
+
+	const std::string pattern{ "[a|b|c|d] [1|2|3|4] [x|y]" };
+
+	LocalQueue local;
+	BOOST_REQUIRE_EQUAL(local.queue_pattern(pattern, 1000000), 1u);
+	local.close();
+
+	// One chunk dealt to four, of which only one works
+	boost::mutex mutex;
+	std::vector<range> seen;
+	Scheduler scheduler{ local.worker(), 4 };
+	drain(scheduler.worker(2), mutex, seen);
+
+	BOOST_CHECK(seen.size() > 1);
+	BOOST_CHECK_EQUAL(scheduler.steals(), seen.size() - seen.size() / 4);
+	BOOST_CHECK(covers(seen, pattern, count_permutations(pattern)));
+	BOOST_CHECK_EQUAL(local.chunks_done(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(Success) {
+
+	LocalQueue local;
+	local.queue_pattern("[a|b|c|d] [1|2|3|4] [x|y]", 1000000);
+	local.queue_pattern("[a|b|c|d] [1|2|3|4] [x|y] z", 1000000);
+	local.close();
+
+	Scheduler scheduler{ local.worker(), 2, 4 };
+	WorkQueue &queue = scheduler.worker(0);
+
+	// The first piece finds it and the chunk goes back right away
+	work_chunk chunk;
+	for (int i = 0; (i < 1000) && !queue.next(chunk); i++) {
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+	}
+	BOOST_REQUIRE(chunk.m_end > chunk.m_begin);
+	queue.result(chunk, true);
+
+	BOOST_CHECK(local.found());
+	BOOST_CHECK_EQUAL(local.chunks_done(), 1u);
+}
+
+namespace {
+
+//! a queue whose polls for chunks take long, like an idle one on redis
+class SlowChunks final : public WorkQueue {
+
+	public:
+		bool next(std::string &n_candidate) override {
+
+			n_candidate = "candidate";
+			return true;
+		}
+
+		void result(const std::string &, const bool) override {
+		}
+
+		bool next(work_chunk &) override {
+
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
+			return false;
+		}
+
+		void result(const work_chunk &, const bool) override {
+		}
+};
+
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(CandidatesDontWaitForChunks) {
+
+	Scheduler scheduler{ std::unique_ptr<WorkQueue>{ new SlowChunks }, 2 };
+
+	// Give the fetcher time to sit in a poll
+	boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+
+	const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+	std::string candidate;
+	for (int i = 0; i < 100; i++) {
+		BOOST_REQUIRE(scheduler.worker(i % 2).next(candidate));
+		scheduler.worker(i % 2).result(candidate, false);
+	}
+
+	BOOST_CHECK(boost::chrono::steady_clock::now() - start < boost::chrono::milliseconds(250));
+}
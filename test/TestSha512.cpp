@@ -13,6 +13,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 using namespace moose::tools;
 using namespace moose::rescue;
@@ -28,3 +29,77 @@ BOOST_AUTO_TEST_CASE(Sha512) {
 	BOOST_CHECK(hash == "9375d1abdb644a01955bccad12e2f5c2bd8a3e226187e548d99c559a99461453b980123746753d07c169c22a5d9cc75cb158f0e8d8c0e713559775b5e1391fc4");
 
 }
+
+BOOST_AUTO_TEST_CASE(KnownDigests) {
+
+	// FIPS 180-2 examples, the second one spans two blocks
+	BOOST_CHECK(sha512("") == "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e");
+	BOOST_CHECK(sha512("abc") == "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f");
+	BOOST_CHECK(sha512("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu")
+	            == "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909");
+	BOOST_CHECK(sha512(std::string(1000000, 'a')) == "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b");
+}
+
+BOOST_AUTO_TEST_CASE(Levels) {
+
+	// Every length around the padding and block boundaries, on all kernels we have here
+	std::string input;
+	for (std::size_t size = 0; size < 400; size++) {
+		const sha512_digest expected = sha512_raw(reinterpret_cast<const boost::uint8_t *>(input.data()), input.size(), simd_level::scalar);
+
+		for (const simd_level level : { simd_level::avx2, simd_level::avx512 }) {
+			if (simd_supported(level)) {
+				BOOST_CHECK(sha512_raw(reinterpret_cast<const boost::uint8_t *>(input.data()), input.size(), level) == expected);
+			}
+		}
+
+		input.push_back(static_cast<char>(size * 7 + 3));
+	}
+
+	if (!simd_supported(simd_level::avx512)) {
+		BOOST_CHECK_THROW(sha512_raw(nullptr, 0, simd_level::avx512), internal_error);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Hex) {
+
+	const std::vector<boost::uint8_t> bytes{ 0x00, 0x09, 0x0a, 0x7f, 0x80, 0xf0, 0xff };
+	std::string hex(2 * bytes.size(), ' ');
+	to_hex(bytes.data(), bytes.size(), &hex[0]);
+	BOOST_CHECK(hex == "00090a7f80f0ff");
+
+	BOOST_CHECK(to_hex(sha512_raw("grape")) == sha512("grape"));
+}
+
+BOOST_AUTO_TEST_CASE(Batch) {
+
+	// Mixed lengths, so lanes finish after different numbers of blocks
+	std::vector<std::string> inputs;
+	for (std::size_t i = 0; i < 61; i++) {
+		inputs.push_back(std::string((i * 37) % 300, static_cast<char>('a' + i % 26)));
+	}
+
+	for (const simd_level level : { simd_level::scalar, simd_level::avx2, simd_level::avx512 }) {
+		if (!simd_supported(level)) {
+			continue;
+		}
+
+		// Every batch size around the lane count, including a single leftover
+		for (std::size_t size = 0; size <= 2 * sha512_lanes(level) + 1; size++) {
+			const std::vector<std::string> batch(inputs.begin(), inputs.begin() + size);
+			std::vector<sha512_digest> digests;
+			BOOST_REQUIRE_NO_THROW(sha512_batch(batch, digests, level));
+			BOOST_REQUIRE(digests.size() == size);
+			for (std::size_t i = 0; i < size; i++) {
+				BOOST_CHECK(to_hex(digests[i]) == sha512(batch[i]));
+			}
+		}
+
+		std::vector<sha512_digest> digests;
+		BOOST_REQUIRE_NO_THROW(sha512_batch(inputs, digests, level));
+		BOOST_REQUIRE(digests.size() == inputs.size());
+		for (std::size_t i = 0; i < inputs.size(); i++) {
+			BOOST_CHECK(to_hex(digests[i]) == sha512(inputs[i]));
+		}
+	}
+}